@@ -33,8 +33,10 @@ void alsa_config_init( struct alsa_config *config, const char *config_path )
     config->rate = 48000;
     config->period = 960;
     config->buffer_period_count = 2;
+    config->start_threshold = 0;
     config->linking_capture_playback = 0;
-    config->format = SND_PCM_FORMAT_S16_LE; // only supported format for the moment
+    config->format = SND_PCM_FORMAT_S16_LE;
+    config->access = SND_PCM_ACCESS_RW_INTERLEAVED;
     config->device[0] = '\0';
     config->priority[0] = '\0';
 
@@ -54,6 +56,8 @@ void alsa_config_init( struct alsa_config *config, const char *config_path )
                 char line[128];
                 char priority[32];
                 char device[64];
+                char access[16];
+                char format[16];
                 dbg("alsa_config_init: using %s", exp_result.we_wordv[0]);
 
                 while (fgets( line, sizeof(line), F) != NULL) {
@@ -66,12 +70,25 @@ void alsa_config_init( struct alsa_config *config, const char *config_path )
                         config->period = v;
                     else if (sscanf(line, "buffer_period_count=%d", &v)==1)
                         config->buffer_period_count = v;
+                    else if (sscanf(line, "start_threshold=%d", &v)==1)
+                        config->start_threshold = v;
                     else if (sscanf(line, "linking_capture_playback=%d", &v)==1)
                         config->linking_capture_playback = v;
                     else if (sscanf(line, "priority=%32s", priority)==1)
                         strcpy( config->priority, priority );
                     else if (sscanf(line, "device=%64s", device)==1)
                         strcpy( config->device, device );
+                    else if (sscanf(line, "format=%15s", format)==1) {
+                        snd_pcm_format_t f = snd_pcm_format_value( format );
+                        if (f == SND_PCM_FORMAT_UNKNOWN)
+                            warn("alsa_config_init: unknown format '%s'", format);
+                        else
+                            config->format = f;
+                    }
+                    else if (sscanf(line, "access=%15s", access)==1) {
+                        if (alsa_access_parse( access, &config->access ))
+                            warn("alsa_config_init: unknown access '%s'", access);
+                    }
                 }
                 fclose(F);
                 stop_config_search = 1;
@@ -90,210 +107,277 @@ void alsa_config_dump( struct alsa_config *config ) {
     dbg("  rate=%u", config->rate);
     dbg("  period=%u", config->period);
     dbg("  buffer_period_count=%u", config->buffer_period_count);
+    dbg("  start_threshold=%u", config->start_threshold);
     dbg("  linking_capture_playback=%u", config->linking_capture_playback);
+    dbg("  format=%s", snd_pcm_format_name( config->format ));
+    dbg("  access=%s", alsa_access_name( config->access ));
 }
 
 
+int alsa_access_parse( const char *name, snd_pcm_access_t *access ) {
+    if (!strcmp( name, "rw" ))
+        *access = SND_PCM_ACCESS_RW_INTERLEAVED;
+    else if (!strcmp( name, "mmap" ))
+        *access = SND_PCM_ACCESS_MMAP_INTERLEAVED;
+    else if (!strcmp( name, "rw_noninterleaved" ))
+        *access = SND_PCM_ACCESS_RW_NONINTERLEAVED;
+    else if (!strcmp( name, "mmap_noninterleaved" ))
+        *access = SND_PCM_ACCESS_MMAP_NONINTERLEAVED;
+    else
+        return -1;
+    return 0;
+}
 
+const char *alsa_access_name( snd_pcm_access_t access ) {
+    switch (access) {
+    case SND_PCM_ACCESS_RW_INTERLEAVED:
+        return "rw";
+    case SND_PCM_ACCESS_MMAP_INTERLEAVED:
+        return "mmap";
+    case SND_PCM_ACCESS_RW_NONINTERLEAVED:
+        return "rw_noninterleaved";
+    case SND_PCM_ACCESS_MMAP_NONINTERLEAVED:
+        return "mmap_noninterleaved";
+    default:
+        return "unknown";
+    }
+}
 
+int alsa_access_is_mmap( snd_pcm_access_t access ) {
+    return (access == SND_PCM_ACCESS_MMAP_INTERLEAVED) || (access == SND_PCM_ACCESS_MMAP_NONINTERLEAVED);
+}
 
-int alsa_device_open( const char *device_name, struct alsa_config *config,
-        snd_pcm_t **capture_handle, snd_pcm_t **playback_handle )
-{
-    snd_pcm_hw_params_t *hw_params = NULL;
-    snd_pcm_sw_params_t *sw_params = NULL;
+int alsa_access_is_planar( snd_pcm_access_t access ) {
+    return (access == SND_PCM_ACCESS_RW_NONINTERLEAVED) || (access == SND_PCM_ACCESS_MMAP_NONINTERLEAVED);
+}
 
-    if (capture_handle) *capture_handle = NULL;
-    if (playback_handle) *playback_handle = NULL;
 
-    snd_pcm_uframes_t period_size = config->period;
-    int period_count = config->buffer_period_count;
-    snd_pcm_uframes_t buffer_size = period_count * period_size;
-    int dir, r;
+void **alsa_planes_split( struct alsa_config *config, void *buff, snd_pcm_uframes_t frames ) {
+    void **planes = malloc( config->channels * sizeof(void *) );
+    size_t plane_bytes = frames * snd_pcm_format_physical_width( config->format ) / 8;
+    unsigned ch;
 
-    if (capture_handle) {
-        /* open the capture */
+    if (!planes) return NULL;
+    for (ch = 0; ch < config->channels; ch++)
+        planes[ch] = (char *)buff + ch * plane_bytes;
+    return planes;
+}
 
-        if ((r = snd_pcm_open (capture_handle, device_name, SND_PCM_STREAM_CAPTURE, 0)) < 0) {
-           err( "%s c: cannot open audio device(%s)", device_name, snd_strerror (r));
-           *capture_handle = NULL;
-           goto open_failed;
-        }
+void alsa_planes_interleave( void *dst, const void * const *planes, unsigned channels,
+        unsigned sample_bytes, snd_pcm_uframes_t frames ) {
+    uint8_t *d = (uint8_t *)dst;
+    snd_pcm_uframes_t i;
+    unsigned ch;
 
-        if ((r = snd_pcm_hw_params_malloc (&hw_params)) < 0) {
-           err("%s c: cannot allocate hardware parameter structure (%s)", device_name, snd_strerror (r));
-           goto open_failed;
+    for (i = 0; i < frames; i++) {
+        for (ch = 0; ch < channels; ch++) {
+            memcpy( d, (const uint8_t *)planes[ch] + i * sample_bytes, sample_bytes );
+            d += sample_bytes;
         }
+    }
+}
 
-        if ((r = snd_pcm_hw_params_any (*capture_handle, hw_params)) < 0) {
-           err("%s c: cannot initialize hardware parameter structure (%s)", device_name, snd_strerror (r));
-           goto open_failed;
-        }
+void alsa_planes_deinterleave( void * const *planes, const void *src, unsigned channels,
+        unsigned sample_bytes, snd_pcm_uframes_t frames ) {
+    const uint8_t *s = (const uint8_t *)src;
+    snd_pcm_uframes_t i;
+    unsigned ch;
 
-        if ((r = snd_pcm_hw_params_set_access (*capture_handle, hw_params, SND_PCM_ACCESS_RW_INTERLEAVED)) < 0) {
-           err("%s c: cannot set access type (%s)", device_name, snd_strerror (r));
-           goto open_failed;
+    for (i = 0; i < frames; i++) {
+        for (ch = 0; ch < channels; ch++) {
+            memcpy( (uint8_t *)planes[ch] + i * sample_bytes, s, sample_bytes );
+            s += sample_bytes;
         }
+    }
+}
 
-        if ((r = snd_pcm_hw_params_set_format (*capture_handle, hw_params, SND_PCM_FORMAT_S16_LE)) < 0) {
-           err("%s c: cannot set sample format (%s)", device_name,snd_strerror (r));
-           goto open_failed;
-        }
 
-        if ((r = snd_pcm_hw_params_set_rate_near (*capture_handle, hw_params, &config->rate, 0)) < 0) {
-           err("%s c: cannot set sample rate (%s)", device_name,snd_strerror (r));
-           goto open_failed;
-        }
 
-        if ((r = snd_pcm_hw_params_set_channels (*capture_handle, hw_params, config->channels)) < 0) {
-           err("%s c: cannot set channel count (%s)", device_name,snd_strerror (r));
-           goto open_failed;
-        }
 
-        dir = 0;
-        if ((r = snd_pcm_hw_params_set_period_size_near (*capture_handle, hw_params, &period_size, &dir)) < 0) {
-           err("%s c: cannot set period size (%s)", device_name,snd_strerror (r));
-           goto open_failed;
-        }
-        if (period_size != config->period) {
-            warn("%s c: period size %u can't be used. set to %u instead",device_name, config->period, (unsigned)period_size  );
-            config->period = period_size;
-        }
-        buffer_size = period_size * period_count;
-        dir=0;
-        if ((r = snd_pcm_hw_params_set_buffer_size_near (*capture_handle, hw_params, &buffer_size)) < 0) {
-           err("%s c: cannot set buffer time (%s)", device_name,snd_strerror (r));
-           goto open_failed;
-        }
 
-        if ((r = snd_pcm_hw_params (*capture_handle, hw_params)) < 0) {
-           err("%s c: cannot set capture parameters (%s)", device_name,snd_strerror (r));
-           goto open_failed;
-        }
+/*
+ * timestamp the hw pointer updates with the monotonic clock, so the sample rate
+ * can be measured (see drift.h). Not fatal: the tests can run without it.
+ */
+static void alsa_sw_tstamp_set( snd_pcm_t *pcm, snd_pcm_sw_params_t *sw_params, const char *device_name, const char *dir )
+{
+    int r;
+    if ((r = snd_pcm_sw_params_set_tstamp_mode( pcm, sw_params, SND_PCM_TSTAMP_ENABLE )) < 0)
+        warn("%s %s: cannot enable timestamps (%s)", device_name, dir, snd_strerror (r));
+#if SND_LIB_VERSION >= 0x01001c
+    if ((r = snd_pcm_sw_params_set_tstamp_type( pcm, sw_params, SND_PCM_TSTAMP_TYPE_MONOTONIC )) < 0)
+        warn("%s %s: cannot select monotonic timestamps (%s)", device_name, dir, snd_strerror (r));
+#endif
+}
 
-        if ((r = snd_pcm_sw_params_malloc (&sw_params)) < 0) {
-               err("%s c: cannot allocate software parameters structure (%s)", device_name, snd_strerror (r));
-               goto open_failed;
-            }
-        if ((r = snd_pcm_sw_params_current (*capture_handle, sw_params)) < 0) {
-           err("%s c: cannot initialize software parameters structure (%s)", device_name,snd_strerror (r));
-           goto open_failed;
-        }
-        if ((r = snd_pcm_sw_params_set_avail_min (*capture_handle, sw_params, period_size)) < 0) {
-           err("%s c: cannot set minimum available count (%s)", device_name ,snd_strerror (r));
-           goto open_failed;
-        }
-        /*
-        if ((r = snd_pcm_sw_params_set_start_threshold (*capture_handle, sw_params, period)) < 0) {
-           err("cannot set start mode (%s)",snd_strerror (r));
-           goto open_failed;
-        }
-        */
-        if ((r = snd_pcm_sw_params (*capture_handle, sw_params)) < 0) {
-           err("%s c: cannot set software parameters (%s)", device_name,snd_strerror (r));
-           goto open_failed;
-        }
+/*
+ * check the request against what the stream supports, in 'hw_params' fresh from
+ * snd_pcm_hw_params_any(): fail at once on an access, a format or a channel count
+ * the stream can't do, naming what it can. The rate and the period are brought in
+ * their ranges by the set_*_near() calls
+ * return 0 if the request can be negotiated
+ */
+static int alsa_hw_check( snd_pcm_t *pcm, snd_pcm_hw_params_t *hw_params, const struct alsa_config *config,
+        const char *device_name, const char *dir ) {
+    unsigned min, max;
 
-        snd_pcm_hw_params_free(hw_params);
-        snd_pcm_sw_params_free(sw_params);
-        hw_params = NULL;
-        sw_params = NULL;
+    if (snd_pcm_hw_params_test_access( pcm, hw_params, config->access )) {
+        err("%s %s: access %s not supported", device_name, dir, alsa_access_name( config->access ));
+        return -1;
+    }
+    if (snd_pcm_hw_params_test_format( pcm, hw_params, config->format )) {
+        err("%s %s: format %s not supported", device_name, dir, snd_pcm_format_name( config->format ));
+        return -1;
+    }
+    if (snd_pcm_hw_params_test_channels( pcm, hw_params, config->channels )) {
+        if ((snd_pcm_hw_params_get_channels_min( hw_params, &min ) < 0) ||
+                (snd_pcm_hw_params_get_channels_max( hw_params, &max ) < 0))
+            err("%s %s: %u channels not supported", device_name, dir, config->channels);
+        else
+            err("%s %s: %u channels not supported, only %u to %u", device_name, dir, config->channels, min, max);
+        return -1;
+    }
+    return 0;
+}
 
+
+/*
+ * open one stream of the device and negotiate its hw and sw params.
+ * 'config' is updated with the rate and the period actually used
+ *
+ * return 0 on success
+ */
+static int alsa_stream_open( const char *device_name, snd_pcm_stream_t stream, struct alsa_config *config,
+        snd_pcm_t **handle )
+{
+    const char *dir = (stream == SND_PCM_STREAM_CAPTURE) ? "c" : "p";
+    snd_pcm_hw_params_t *hw_params = NULL;
+    snd_pcm_sw_params_t *sw_params = NULL;
+    snd_pcm_uframes_t period_size, buffer_size, start_threshold;
+    int period_count = config->buffer_period_count;
+    int d, r;
+
+    if ((r = snd_pcm_open (handle, device_name, stream, 0)) < 0) {
+       err("%s %s: cannot open audio device (%s)", device_name, dir, snd_strerror (r));
+       *handle = NULL;
+       return -1;
     }
 
-    if (playback_handle) {
-        if ((r = snd_pcm_open (playback_handle, device_name, SND_PCM_STREAM_PLAYBACK, 0)) < 0) {
-           err("%s p: cannot open audio device (%s)",device_name,snd_strerror (r));
-           *playback_handle = NULL;
-           goto open_failed;
-        }
+    if ((r = snd_pcm_hw_params_malloc (&hw_params)) < 0) {
+       err("%s %s: cannot allocate hardware parameter structure (%s)", device_name, dir, snd_strerror (r));
+       goto open_failed;
+    }
 
-        if ((r = snd_pcm_hw_params_malloc (&hw_params)) < 0) {
-           err("%s p: cannot allocate hardware parameter structure (%s)",device_name,snd_strerror (r));
-           goto open_failed;
-        }
+    if ((r = snd_pcm_hw_params_any (*handle, hw_params)) < 0) {
+       err("%s %s: cannot initialize hardware parameter structure (%s)", device_name, dir, snd_strerror (r));
+       goto open_failed;
+    }
 
-        if ((r = snd_pcm_hw_params_any (*playback_handle, hw_params)) < 0) {
-           err("%s p: cannot initialize hardware parameter structure (%s)",device_name,snd_strerror (r));
-           goto open_failed;
-        }
+    if (alsa_hw_check( *handle, hw_params, config, device_name, dir ))
+        goto open_failed;
 
-        if ((r = snd_pcm_hw_params_set_access (*playback_handle, hw_params, SND_PCM_ACCESS_RW_INTERLEAVED)) < 0) {
-           err("%s p: cannot set access type (%s)",device_name,snd_strerror (r));
-           goto open_failed;
-        }
+    if ((r = snd_pcm_hw_params_set_access (*handle, hw_params, config->access)) < 0) {
+       err("%s %s: cannot set access type (%s)", device_name, dir, snd_strerror (r));
+       goto open_failed;
+    }
 
-        if ((r = snd_pcm_hw_params_set_format (*playback_handle, hw_params, SND_PCM_FORMAT_S16_LE)) < 0) {
-           err("%s p: cannot set sample format (%s)",device_name, snd_strerror (r));
-           goto open_failed;
-        }
+    if ((r = snd_pcm_hw_params_set_format (*handle, hw_params, config->format)) < 0) {
+       err("%s %s: cannot set sample format (%s)", device_name, dir, snd_strerror (r));
+       goto open_failed;
+    }
 
-        if ((r = snd_pcm_hw_params_set_rate_near (*playback_handle, hw_params, &config->rate, 0)) < 0) {
-           err("%s p: cannot set sample rate (%s)",device_name,snd_strerror (r));
-           goto open_failed;
-        }
+    if ((r = snd_pcm_hw_params_set_rate_near (*handle, hw_params, &config->rate, 0)) < 0) {
+       err("%s %s: cannot set sample rate (%s)", device_name, dir, snd_strerror (r));
+       goto open_failed;
+    }
 
-        if ((r = snd_pcm_hw_params_set_channels (*playback_handle, hw_params, config->channels)) < 0) {
-           err("%s p: cannot set channel count (%s)",device_name, snd_strerror (r));
-           goto open_failed;
-        }
+    if ((r = snd_pcm_hw_params_set_channels (*handle, hw_params, config->channels)) < 0) {
+       err("%s %s: cannot set channel count (%s)", device_name, dir, snd_strerror (r));
+       goto open_failed;
+    }
 
-        dir = 0;
-        dbg("set period size: %d", (int)period_size);
-        if ((r = snd_pcm_hw_params_set_period_size_near (*playback_handle, hw_params, &period_size, &dir)) < 0) {
-           err("%s p: cannot set period size (%s)",device_name,snd_strerror (r));
-           goto open_failed;
-        }
-        if (period_size != config->period) {
-             warn("%s p: period size %d can't be used. set to %d instead",device_name, config->period, (int)period_size );
-             config->period = period_size;
-        }
-        /*
-        if ((r = snd_pcm_hw_params_set_periods (*playback_handle, hw_params, 2, 0)) < 0) {
-           err("%s p: cannot set number of periods (%s)",device_name, snd_strerror (r));
-           goto open_failed;
-        }
-        */
-        buffer_size = period_size * period_count;
-        dir=0;
-        if ((r = snd_pcm_hw_params_set_buffer_size_near (*playback_handle, hw_params, &buffer_size)) < 0) {
-           err("%s p: cannot set buffer time (%s)",device_name, snd_strerror (r));
-           goto open_failed;
-        }
+    d = 0;
+    period_size = config->period;
+    dbg("set period size: %d", (int)period_size);
+    if ((r = snd_pcm_hw_params_set_period_size_near (*handle, hw_params, &period_size, &d)) < 0) {
+       err("%s %s: cannot set period size (%s)", device_name, dir, snd_strerror (r));
+       goto open_failed;
+    }
+    if (period_size != config->period) {
+        warn("%s %s: period size %u can't be used. set to %u instead", device_name, dir, config->period, (unsigned)period_size );
+        config->period = period_size;
+    }
+    buffer_size = period_size * period_count;
+    if ((r = snd_pcm_hw_params_set_buffer_size_near (*handle, hw_params, &buffer_size)) < 0) {
+       err("%s %s: cannot set buffer time (%s)", device_name, dir, snd_strerror (r));
+       goto open_failed;
+    }
 
+    if ((r = snd_pcm_hw_params (*handle, hw_params)) < 0) {
+       err("%s %s: cannot set %s parameters (%s)", device_name, dir, snd_pcm_stream_name( stream ), snd_strerror (r));
+       goto open_failed;
+    }
 
-        if ((r = snd_pcm_hw_params (*playback_handle, hw_params)) < 0) {
-           err("%s p: cannot set playback parameters (%s)",device_name,snd_strerror (r));
+    if ((r = snd_pcm_sw_params_malloc (&sw_params)) < 0) {
+       err("%s %s: cannot allocate software parameters structure (%s)", device_name, dir, snd_strerror (r));
+       goto open_failed;
+    }
+    if ((r = snd_pcm_sw_params_current (*handle, sw_params)) < 0) {
+       err("%s %s: cannot initialize software parameters structure (%s)", device_name, dir, snd_strerror (r));
+       goto open_failed;
+    }
+    if ((r = snd_pcm_sw_params_set_avail_min (*handle, sw_params, period_size)) < 0) {
+       err("%s %s: cannot set minimum available count (%s)", device_name, dir, snd_strerror (r));
+       goto open_failed;
+    }
+    if (stream == SND_PCM_STREAM_PLAYBACK) {
+        /* the capture is started explicitly */
+        start_threshold = config->start_threshold ? config->start_threshold : (period_count -1) * period_size;
+        if (start_threshold > buffer_size) {
+            warn("%s %s: start threshold %u above the buffer size. set to %u instead", device_name, dir,
+                    (unsigned)start_threshold, (unsigned)buffer_size );
+            start_threshold = buffer_size;
+        }
+        if ((r = snd_pcm_sw_params_set_start_threshold (*handle, sw_params, start_threshold)) < 0) {
+           err("%s %s: cannot set start mode (%s)", device_name, dir, snd_strerror (r));
            goto open_failed;
         }
+    }
+    alsa_sw_tstamp_set( *handle, sw_params, device_name, dir );
+    if ((r = snd_pcm_sw_params (*handle, sw_params)) < 0) {
+       err("%s %s: cannot set software parameters (%s)", device_name, dir, snd_strerror (r));
+       goto open_failed;
+    }
+
+    snd_pcm_hw_params_free(hw_params);
+    snd_pcm_sw_params_free(sw_params);
+    return 0;
 
-        /*snd_pcm_dump_setup(dev->playback_handle, jcd_out);*/
+open_failed:
+    if (hw_params) snd_pcm_hw_params_free(hw_params);
+    if (sw_params) snd_pcm_sw_params_free(sw_params);
+    snd_pcm_close(*handle);
+    *handle = NULL;
+    return -1;
+}
 
+int alsa_device_open( const char *device_name, struct alsa_config *config,
+        snd_pcm_t **capture_handle, snd_pcm_t **playback_handle )
+{
+    int r;
 
-        if ((r = snd_pcm_sw_params_malloc (&sw_params)) < 0) {
-           err("%s p: cannot allocate software parameters structure (%s)",device_name ,snd_strerror (r));
-           goto open_failed;
-        }
-        if ((r = snd_pcm_sw_params_current (*playback_handle, sw_params)) < 0) {
-           err("%s p: cannot initialize software parameters structure (%s)",device_name,snd_strerror (r));
-           goto open_failed;
-        }
-        if ((r = snd_pcm_sw_params_set_avail_min (*playback_handle, sw_params, period_size)) < 0) {
-           err("%s p: cannot set minimum available count (%s)",device_name,snd_strerror (r));
-           goto open_failed;
-        }
-        if ((r = snd_pcm_sw_params_set_start_threshold (*playback_handle, sw_params, (period_count -1) * period_size)) < 0) {
-           err("%s p: cannot set start mode (%s)",device_name,snd_strerror (r));
-           goto open_failed;
-        }
-        if ((r = snd_pcm_sw_params (*playback_handle, sw_params)) < 0) {
-           err("%s p: cannot set software parameters (%s)",device_name,snd_strerror (r));
-           goto open_failed;
+    if (capture_handle) *capture_handle = NULL;
+    if (playback_handle) *playback_handle = NULL;
+
+    if (capture_handle && alsa_stream_open( device_name, SND_PCM_STREAM_CAPTURE, config, capture_handle ))
+        return -1;
+
+    if (playback_handle && alsa_stream_open( device_name, SND_PCM_STREAM_PLAYBACK, config, playback_handle )) {
+        if (capture_handle) {
+            snd_pcm_close(*capture_handle);
+            *capture_handle = NULL;
         }
-        snd_pcm_hw_params_free(hw_params);
-        snd_pcm_sw_params_free(sw_params);
-        hw_params = NULL;
-        sw_params = NULL;
+        return -1;
     }
 
     if (capture_handle && playback_handle && config->linking_capture_playback) {
@@ -305,17 +389,58 @@ int alsa_device_open( const char *device_name, struct alsa_config *config,
         }
     }
     return 0;
+}
 
-open_failed:
-    if (hw_params) snd_pcm_hw_params_free(hw_params);
-    if (sw_params) snd_pcm_sw_params_free(sw_params);
-    if (capture_handle && *capture_handle) {
-        snd_pcm_close(*capture_handle);
-        *capture_handle = NULL;
-    }
-    if (playback_handle && *playback_handle) {
-        snd_pcm_close(*playback_handle);
-        *playback_handle = NULL;
+
+
+snd_pcm_sframes_t alsa_mmap_transfer( snd_pcm_t *pcm, struct alsa_config *config,
+        snd_pcm_uframes_t frames, alsa_mmap_job job, void *data )
+{
+    const int planar = alsa_access_is_planar( config->access );
+    const unsigned width = snd_pcm_format_physical_width( config->format );
+    void *planes[ planar ? config->channels : 1 ];
+    snd_pcm_uframes_t done = 0;
+
+    while (done < frames) {
+        const snd_pcm_channel_area_t *areas;
+        snd_pcm_uframes_t offset, size;
+        snd_pcm_sframes_t avail, committed;
+        int r;
+
+        avail = snd_pcm_avail_update( pcm );
+        if (avail < 0) return avail;
+        if (avail == 0) {
+            /* nothing to transfer yet: block like snd_pcm_readi/writei would do */
+            r = snd_pcm_wait( pcm, -1 );
+            if (r < 0) return r;
+            continue;
+        }
+
+        size = frames - done;
+        r = snd_pcm_mmap_begin( pcm, &areas, &offset, &size );
+        if (r < 0) return r;
+
+        if (planar) {
+            /* the seq planar kernels need one contiguous buffer per channel */
+            unsigned ch;
+            for (ch = 0; ch < config->channels; ch++) {
+                if (areas[ch].step != width) {
+                    err("alsa_mmap_transfer: channel %u is not contiguous in the DMA ring (step %u)", ch, areas[ch].step);
+                    return -EINVAL;
+                }
+                planes[ch] = (char *)areas[ch].addr + (areas[ch].first + offset * areas[ch].step) / 8;
+            }
+        } else {
+            /* interleaved access: every channel shares the same area */
+            planes[0] = (char *)areas[0].addr + (areas[0].first + offset * areas[0].step) / 8;
+        }
+        job( data, planes, size );
+
+        committed = snd_pcm_mmap_commit( pcm, offset, size );
+        if (committed < 0) return committed;
+        if (committed != size) return -EPIPE;
+        done += size;
     }
-    return -1;
+    return done;
 }
+
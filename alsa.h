@@ -11,6 +11,7 @@
 #define __alsa_h__
 
 
+#include <stdint.h>
 #include <alsa/asoundlib.h>
 
 
@@ -22,9 +23,20 @@ struct alsa_config {
     unsigned int rate;
     snd_pcm_format_t format;
 
+    /*
+     * SND_PCM_ACCESS_RW_INTERLEAVED: frames copied with snd_pcm_writei/readi
+     * SND_PCM_ACCESS_MMAP_INTERLEAVED: frames generated/checked directly in the DMA ring
+     * SND_PCM_ACCESS_RW_NONINTERLEAVED, SND_PCM_ACCESS_MMAP_NONINTERLEAVED: same with
+     *   one buffer per channel
+     */
+    snd_pcm_access_t access;
+
     unsigned int period;
     unsigned int buffer_period_count;
 
+    /* playback: frames queued before the stream starts. 0 for (buffer_period_count-1) * period */
+    unsigned int start_threshold;
+
     /* set to 1 to open the capture and playback in linked mode */
     unsigned linking_capture_playback;
 
@@ -52,7 +64,9 @@ struct alsa_config {
  *    rate = 48000
  *    period = 960  (20ms)
  *    buffer_period_count = 2
+ *    start_threshold = 0
  *    format = S16_LE
+ *    access = rw (or rw_noninterleaved, mmap, mmap_noninterleaved)
  *
  *    linking_capture_playback = 0
  *
@@ -65,6 +79,35 @@ void alsa_config_init( struct alsa_config *config, const char *config_path );
 void alsa_config_dump( struct alsa_config *config );
 
 
+/*
+ * convert an access mode name ("rw", "mmap", "rw_noninterleaved" or "mmap_noninterleaved")
+ * to its alsa value
+ * return 0 on success, -1 if the name is unknown
+ */
+int alsa_access_parse( const char *name, snd_pcm_access_t *access );
+const char *alsa_access_name( snd_pcm_access_t access );
+
+int alsa_access_is_mmap( snd_pcm_access_t access );
+int alsa_access_is_planar( snd_pcm_access_t access );
+
+/*
+ * return a malloc'ed array of config->channels pointers to the channel buffers
+ * of 'buff', a non interleaved buffer of 'frames' frames
+ */
+void **alsa_planes_split( struct alsa_config *config, void *buff, snd_pcm_uframes_t frames );
+
+/*
+ * copy 'frames' frames of 'channels' channel buffers of 'sample_bytes' samples
+ * into the interleaved buffer 'dst'
+ */
+void alsa_planes_interleave( void *dst, const void * const *planes, unsigned channels,
+        unsigned sample_bytes, snd_pcm_uframes_t frames );
+
+/* and back, from the interleaved buffer 'src' */
+void alsa_planes_deinterleave( void * const *planes, const void *src, unsigned channels,
+        unsigned sample_bytes, snd_pcm_uframes_t frames );
+
+
 
 /*
  * Open an alsa device for capture and/or playback.
@@ -80,5 +123,23 @@ int alsa_device_open( const char *device, struct alsa_config *config,
         snd_pcm_t **capture_handle, snd_pcm_t **playback_handle );
 
 
+/*
+ * called by alsa_mmap_transfer() for every contiguous part of the DMA ring
+ * interleaved access: planes[0] points to 'count' interleaved frames
+ * non interleaved access: planes[ch] points to the 'count' samples of channel 'ch'
+ */
+typedef void (*alsa_mmap_job)( void *data, void * const *planes, snd_pcm_uframes_t count );
+
+/*
+ * mmap access: transfer 'frames' frames directly in the DMA ring buffer.
+ * 'job' fills (playback) or checks (capture) the frames in place, and may be
+ * called several times when the ring wraps.
+ * Like snd_pcm_writei/readi in blocking mode, wait until every frame is transferred.
+ *
+ * return the number of frames transferred or a negative error code
+ */
+snd_pcm_sframes_t alsa_mmap_transfer( snd_pcm_t *pcm, struct alsa_config *config,
+        snd_pcm_uframes_t frames, alsa_mmap_job job, void *data );
+
 
 #endif //__alsa_h__
@@ -12,21 +12,32 @@
 #include <errno.h>
 #include <string.h>
 #include <getopt.h>
-#include <sched.h>
+#include <pthread.h>
 #include <ev.h>
 
 
 #include "alsa.h"
 #include "log.h"
 #include "test.h"
+#include "seq_simd.h"
 #include "playback.h"
 #include "capture.h"
 #include "loopback_delay.h"
+#include "verify.h"
+#include "tune.h"
 
 
-struct ev_loop *loop = NULL;
 
+/* the running tests */
+static struct test **tests = NULL;
+static int tests_count = 0;
 
+static void tests_report( void ) {
+    int i;
+    for (i=0; i < tests_count; i++) {
+        if (tests[i]->ops->report) tests[i]->ops->report( tests[i] );
+    }
+}
 
 
 /*
@@ -58,7 +69,9 @@ static void on_stdin( struct ev_loop *loop, struct ev_io *w, int revents ) {
             ev_unloop( loop, EVUNLOOP_ALL);
             return;
         }
-
+        if (!strcmp(pipecmd, "stats")) {
+            tests_report();
+        }
 
         /* reset the pipecmd */
         pipecmd[0] = '\0';
@@ -69,6 +82,7 @@ static void on_stdin( struct ev_loop *loop, struct ev_io *w, int revents ) {
 
 /* manage clean shutdown on terminal signal */
 static ev_signal evw_intsig, evw_termsig;
+static int exit_requested = 0;
 static void on_exit_signal(struct ev_loop *loop, ev_signal *w, int revents)
 {
     switch (w->signum) {
@@ -79,6 +93,7 @@ static void on_exit_signal(struct ev_loop *loop, ev_signal *w, int revents)
         dbg("SIGINT");
         break;
     }
+    exit_requested = 1;
     ev_unloop(loop, EVUNLOOP_ALL);
 }
 
@@ -89,37 +104,297 @@ static void on_duration_timer( struct ev_loop *loop, struct ev_timer *w, int rev
 }
 
 
-static void seq_error_assert(void) {
+static void usage(void);
+
+/*
+ * stop on first error.
+ * the errors are detected in the test threads: wakeup the main loop
+ */
+static ev_async evw_assert;
+static void on_assert( struct ev_loop *loop, struct ev_async *w, int revents ) {
     dbg("stop on first error");
     ev_unloop(loop, EVUNLOOP_ALL);
 }
 
-void usage(void) {
+static void seq_error_assert( struct test *t, void *data ) {
+    ev_async_send( (struct ev_loop *)data, &evw_assert );
+}
+
+
+/*
+ * a test as described on the command line.
+ * the tests are created once every test is parsed, each one in its own thread, so
+ * opening dozens of devices doesn't take dozens of times longer.
+ */
+struct test_spec {
+    const char *type;   /* "play", "capture" or "loopback_delay" */
+    struct alsa_config config;
+    union {
+        struct playback_create_opts play;
+        struct capture_create_opts capture;
+        struct loopback_delay_create_opts loopback_delay;
+    } opts;
+    struct test_thread_opts thread_opts;
+
+    pthread_t thread;
+    struct test *t;     /* NULL if the creation failed */
+};
+
+static void *test_create_thread( void *arg ) {
+    struct test_spec *spec = (struct test_spec *)arg;
+
+    if (!strcmp( spec->type, "play" ))
+        spec->t = playback_create( &spec->config, &spec->opts.play );
+    else if (!strcmp( spec->type, "capture" ))
+        spec->t = capture_create( &spec->config, &spec->opts.capture );
+    else
+        spec->t = loopback_delay_create( &spec->config, &spec->opts.loopback_delay );
+    if (!spec->t)
+        err("%s: failed to create a %s test", spec->config.device, spec->type);
+    return NULL;
+}
+
+/*
+ * create the tests of 'specs' in 'tests', opening the devices in parallel
+ * return 0 on success. On failure, the tests already created are closed
+ */
+static int tests_create( struct test_spec *specs ) {
+    int i, j, r;
+
+    for (i=0; i < tests_count; i++) {
+        r = pthread_create( &specs[i].thread, NULL, test_create_thread, &specs[i] );
+        if (r) {
+            err("can't create a thread: %s", strerror(r));
+            exit(1);
+        }
+    }
+    r = 0;
+    for (i=0; i < tests_count; i++) {
+        pthread_join( specs[i].thread, NULL );
+        if (!specs[i].t) r = -1;
+    }
+    if (r) {
+        for (i=0; i < tests_count; i++) {
+            if (specs[i].t) specs[i].t->ops->close( specs[i].t );
+        }
+        return -1;
+    }
+
+    tests = calloc( tests_count, sizeof(*tests) );
+    if (!tests) {
+        err("out of memory");
+        exit(1);
+    }
+    for (i=0; i < tests_count; i++) {
+        tests[i] = specs[i].t;
+        tests[i]->thread_opts = specs[i].thread_opts;
+    }
+
+    /*
+     * a playback looped back on a capture of the same device: the playback restarts
+     * are timed by the capture checker
+     */
+    for (i=0; i < tests_count; i++) {
+        if (strcmp( tests[i]->name, "playback" ) || !tests[i]->recovery) continue;
+        for (j=0; j < tests_count; j++) {
+            if (!strcmp( tests[j]->name, "capture" ) && !tests[j]->peer_recovery &&
+                    !strcmp( tests[j]->device, tests[i]->device )) {
+                tests[j]->peer_recovery = tests[i]->recovery;
+                break;
+            }
+        }
+    }
+    return 0;
+}
+
+
+/*
+ * tune mode: run the tests with one configuration, and collect what happened
+ */
+struct tune_ctx {
+    struct test_spec *specs;
+    struct ev_loop *loop;
+};
+
+static int tune_run( const struct tune_point *p, unsigned seconds, struct tune_result *res, void *data ) {
+    struct tune_ctx *ctx = (struct tune_ctx *)data;
+    struct ev_timer soak_timer;
+    int i, started, completed = 0;
+
+    for (i=0; i < tests_count; i++) {
+        ctx->specs[i].config.period = p->period;
+        ctx->specs[i].config.buffer_period_count = p->buffer_period_count;
+        ctx->specs[i].config.start_threshold = p->start_threshold;
+    }
+    warn("tune: period=%u buffer_period_count=%u start_threshold=%u",
+            p->period, p->buffer_period_count, p->start_threshold);
+    if (tests_create( ctx->specs ))
+        return exit_requested ? -1 : 0;
+
+    for (started=0; started < tests_count; started++) {
+        if (test_start( tests[started], ctx->loop ) < 0) {
+            err("starting test %s failed", tests[started]->name );
+            break;
+        }
+    }
+    if (started == tests_count) {
+        ev_timer_init( &soak_timer, on_duration_timer, seconds, 0 );
+        ev_timer_start( ctx->loop, &soak_timer );
+        ev_run( ctx->loop, 0 );
+        /* the timer is still pending if a test ended the loop first */
+        completed = !ev_is_active( &soak_timer );
+        ev_timer_stop( ctx->loop, &soak_timer );
+
+        /* the counters are final once the test threads are joined */
+        for (i=0; i < tests_count; i++)
+            test_stop( tests[i] );
+        res->opened = 1;
+        res->period = tests[0]->config.period;
+        res->rate = tests[0]->config.rate;
+        if (!completed) {
+            warn("tune: the tests stopped before the end of the soak");
+            res->failed = 1;
+        }
+        for (i=0; i < tests_count; i++) {
+            res->xruns += tests[i]->xruns;
+            res->seq_errors += tests[i]->seq_errors;
+            if (tests[i]->headroom < res->headroom) res->headroom = tests[i]->headroom;
+        }
+    }
+
+    for (i=0; i < tests_count; i++) {
+        /* a test reporting a failure fails the configuration */
+        if ((test_close( tests[i] ) != 0) && res->opened) res->failed = 1;
+    }
+    free( tests );
+    tests = NULL;
+    return exit_requested ? -1 : 0;
+}
+
+
+/*
+ * parse the options shared by every test.
+ * return 1 if 'opt' was one of them
+ */
+#define TEST_COMMON_OPTS "D:c:R:p:f:A:T:P:"
+static int test_opt_parse( struct test_spec *spec, int opt, const char *arg ) {
+    struct alsa_config *config = &spec->config;
+    struct test_thread_opts *opts = &spec->thread_opts;
+
+    switch (opt) {
+    case 'D':
+        strncpy( config->device, arg, sizeof(config->device)-1 );
+        config->device[ sizeof(config->device)-1 ] = '\0';
+        return 1;
+    case 'c':
+        config->channels = atoi(arg);
+        return 1;
+    case 'R':
+        config->rate = atoi(arg);
+        return 1;
+    case 'p':
+        config->period = atoi(arg);
+        return 1;
+    case 'f':
+        config->format = snd_pcm_format_value( arg );
+        if (config->format == SND_PCM_FORMAT_UNKNOWN) {
+            printf("invalid format '%s' for test '%s'\n", arg, spec->type);
+            usage();
+        }
+        return 1;
+    case 'A':
+        if (alsa_access_parse( arg, &config->access )) {
+            printf("invalid access mode '%s' for test '%s'\n", arg, spec->type);
+            usage();
+        }
+        return 1;
+    case 'T':
+        opts->threaded = 1;
+        if (!strcmp( arg, "any" )) {
+            opts->cpu = -1;
+        } else if (sscanf( arg, "%d", &opts->cpu ) != 1 || opts->cpu < 0) {
+            printf("invalid value '%s' for test '%s' option '-T'\n", arg, spec->type);
+            usage();
+        }
+        return 1;
+    case 'P':
+        opts->threaded = 1;
+        strncpy( opts->priority, arg, sizeof(opts->priority)-1 );
+        opts->priority[ sizeof(opts->priority)-1 ] = '\0';
+        return 1;
+    }
+    return 0;
+}
+
+static void usage(void) {
     puts(
         "usage: atest OPTIONS -- TEST [test options] ...\n"
         "OPTIONS:\n"
         "-r, --rate=#             sample rate\n"
-        "-c, --channels=#         channels (max 32)\n"
+        "-c, --channels=#         channels (max 256)\n"
         "-p, --period=FRAMES      period size in number of frames\n"
-        "-D, --device=NAME        select PCM by name\n"
+        "-f, --format=FORMAT      sample format: (S16_LE)/S16_BE/S24_LE/S24_BE/S24_3LE/S24_3BE\n"
+        "                         S32_LE/S32_BE/FLOAT_LE/FLOAT_BE\n"
+        "-D, --device=NAME        select PCM by name, or a test backend:\n"
+        "                         file:PATH  raw interleaved frames read from/written to PATH\n"
+        "                         mem:NAME[,latency=FRAMES]  in-process loopback between the\n"
+        "                                    play and capture tests using the same NAME\n"
+        "-A, --access=MODE        access mode: (rw)/mmap/rw_noninterleaved/mmap_noninterleaved\n"
         "-C, --config=FILE        use this particular config file\n"
         "-P, --priority=PRIORITY  process priority to set ('fifo,N' 'rr,N' 'other,N')\n"
         "-d, --duration=SECONDS   stop the test after SECONDS\n"
         "-a, --assert             stop on first error detected\n"
         "-I, --invalid-log-size=N how many frames are logged on error (default 1)\n"
+        "-E, --encoding=ENC       sample encoding: (seq)/wide. wide adds a 32 bits frame counter\n"
+        "                         and a checksum in the sample MSB. The same on both sides\n"
+        "-t, --threads            run every test in its own thread\n"
+        "-L, --log=LEVELS         log levels printed, among err,warn,dbg (default all)\n"
+        "    --sync-log           print the logs directly instead of using the log thread\n"
+        "\n"
+        "TEST (as many as needed)\n"
+        "  common options:  -D NAME      PCM of this test (default: global --device)\n"
+        "                   -c N         channels of this test\n"
+        "                   -R N         sample rate of this test\n"
+        "                   -p FRAMES    period size of this test\n"
+        "                   -f FORMAT    sample format of this test\n"
+        "                   -A MODE      access mode of this test\n"
+        "                   -T CPU|any   run the test in its own thread, pinned on CPU\n"
+        "                   -P PRIORITY  run the test in its own thread, with this priority\n"
         "\n"
-        "TEST\n"
         "  play      continuously generate the sequence steam\n"
         "     options:  -x N      simulate a xrun every N ms\n"
         "               -r N,M    stop after N ms of playback,  and restart after M ms\n"
+        "                         the time from every restart to the first valid frame is\n"
+        "                         reported by a capture test of the same device, if any\n"
         "\n"
         "  capture   continuously check the received frame sequence\n"
         "     options:  -x N      simulate a xrun every N ms\n"
         "               -r N,M    stop after N ms of playback,  and restart after M ms\n"
+        "               -w FILE   also write the checked frames in FILE and FILE.meta (--record)\n"
+        "               -b PREFIX[,N[,E]]  keep the last N periods (default 16) and dump them in\n"
+        "                         PREFIX-#.wav on the first error, and every E errors\n"
         "\n"
-        "  loopback_delay   measure the loopback trip time\n"
+        "  loopback_delay   measure the loopback trip time, after every period\n"
         "     options:  -a N      assert that the loopback delay equal N frames\n"
+        "               -o FILE   write the delay measured at every period in FILE\n"
+        "               -b PREFIX[,N[,E]]  same as capture, with the played frames in PREFIX-#-play.wav\n"
         "               -s MODE   start mode: (capture)/play/link\n"
+        "               -x N      simulate a xrun every N ms\n"
+        "               -r N,M    stop a stream after N ms,  and restart it after M ms\n"
+        "               -i SIDE   stream of the xruns and stops: (both, alternately)/play/capture\n"
+        "                         the time from every recovery to the first valid frame is reported\n"
+        "\n"
+        "atest [OPTIONS] tune [-s SECONDS] [-p LIST] [-n LIST] [-t LIST] [-m US] [-l N] [-a] TEST...\n"
+        "  run the tests with every period size (-p, default 64,128,256,512,1024), buffer period\n"
+        "  count (-n, default 2,3,4) and playback start threshold in periods (-t, default 0: the\n"
+        "  buffer period count - 1), SECONDS each (default 10), from the lowest latency on. Print\n"
+        "  the smallest configuration without xrun and with at least US us of headroom left.\n"
+        "  -l N runs N busy threads meanwhile as a CPU load, -a tries every configuration\n"
+        "\n"
+        "atest [OPTIONS] verify [-j THREADS] FILE\n"
+        "  check a recording offline, with THREADS threads (default: every core)\n"
+        "\n"
+        "stdin commands: 'q' to quit, 'stats' to print the latency histograms\n"
         );
     exit(1);
 
@@ -130,12 +405,23 @@ const struct option options[] = {
     { "rate", 1, NULL, 'r' },
     { "channels", 1, NULL, 'c' },
     { "period", 1, NULL, 'p' },
+    { "format", 1, NULL, 'f' },
     { "device", 1, NULL, 'D' },
+    { "access", 1, NULL, 'A' },
     { "config", 1, NULL, 'C' },
     { "priority", 1, NULL, 'P' },
     { "duration", 1, NULL, 'd' },
     { "assert", 0, NULL, 'a' },
-    { "invalid-log-size", 0, NULL, 'I' },
+    { "invalid-log-size", 1, NULL, 'I' },
+    { "encoding", 1, NULL, 'E' },
+    { "threads", 0, NULL, 't' },
+    { "log", 1, NULL, 'L' },
+    { "sync-log", 0, NULL, 'S' },
+    { NULL, 0, NULL, 0 }
+};
+
+static const struct option capture_options[] = {
+    { "record", 1, NULL, 'w' },
     { NULL, 0, NULL, 0 }
 };
 
@@ -149,7 +435,13 @@ int main(int argc, char * const argv[]) {
     int opt_duration = 0;
     int opt_assert = 0;
     int opt_invalid_log_size = 0;
+    int opt_threads = 0;
+    int opt_sync_log = 0;
+    int opt_tune = 0;
+    struct tune_opts tune_opts;
     const char *opt_device = NULL;
+    const char *opt_access = NULL;
+    const char *opt_format = NULL;
     const char *opt_config = NULL;
     const char *opt_priority = NULL;
     struct alsa_config config;
@@ -157,10 +449,10 @@ int main(int argc, char * const argv[]) {
     struct ev_io stdin_watcher;
     struct ev_timer duration_timer;
 
-    loop = ev_default_loop(0);
+    struct ev_loop *loop = ev_default_loop(0);
 
     while (1) {
-        if ((result = getopt_long( argc, argv, "+r:c:p:D:C:P:d:aI:", options, &opt_index )) == EOF) break;
+        if ((result = getopt_long( argc, argv, "+r:c:p:f:D:A:C:P:d:aI:E:tL:S", options, &opt_index )) == EOF) break;
         switch (result) {
         case '?':
             usage();
@@ -180,6 +472,12 @@ int main(int argc, char * const argv[]) {
         case 'D':
             opt_device = optarg;
             break;
+        case 'A':
+            opt_access = optarg;
+            break;
+        case 'f':
+            opt_format = optarg;
+            break;
         case 'C':
             opt_config = optarg;
             break;
@@ -192,114 +490,237 @@ int main(int argc, char * const argv[]) {
         case 'I':
             opt_invalid_log_size = atoi(optarg);
             break;
+        case 'E':
+            if (seq_encoding_parse( optarg, &seq_encoding )) {
+                printf("Invalid encoding '%s'\n", optarg);
+                exit(1);
+            }
+            break;
+        case 't':
+            opt_threads = 1;
+            break;
+        case 'L':
+            if (log_levels_parse( optarg )) {
+                printf("Invalid log levels '%s'\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'S':
+            opt_sync_log = 1;
+            break;
         }
     }
 
+    if (opt_invalid_log_size > 0) {
+        seq_consecutive_invalid_frames_log = opt_invalid_log_size;
+    }
+
+    /* offline check of a recording: no device involved */
+    if ((optind < argc) && !strcmp( argv[optind], "verify" ))
+        return verify_main( argc - optind, argv + optind );
+
+    /* from now, the logs are written by a low priority thread */
+    if (!opt_sync_log) log_async_start();
+
     /* generate the config */
     alsa_config_init( &config, opt_config );
     if (opt_rate > 0) config.rate = opt_rate;
     if (opt_channels > 0) config.channels = opt_channels;
     if (opt_period > 0) config.period = opt_period;
     if (opt_device) { strncpy( config.device, opt_device, sizeof(config.device)-1 ); config.device[ sizeof(config.device)-1 ] = '\0'; }
-    if (opt_priority) { strncpy( config.priority, opt_priority, sizeof(config.priority)-1 ); config.priority[ sizeof(config.priority)-1 ] = '\0'; }
-
-    /* check if the config is valid */
-    if (config.device[0] == '\0') {
-        printf("Undefined device.\n");
+    if (opt_format) {
+        config.format = snd_pcm_format_value( opt_format );
+        if (config.format == SND_PCM_FORMAT_UNKNOWN) {
+            printf("Invalid format '%s'\n", opt_format);
+            exit(1);
+        }
+    }
+    if (opt_access && alsa_access_parse( opt_access, &config.access )) {
+        printf("Invalid access mode '%s'\n", opt_access);
         exit(1);
     }
+    if (opt_priority) { strncpy( config.priority, opt_priority, sizeof(config.priority)-1 ); config.priority[ sizeof(config.priority)-1 ] = '\0'; }
 
     dbg("dev: '%s'", config.device);
 
-#define MAX_TESTS 2
-    struct test *tests[MAX_TESTS];
-    int tests_count = 0;
+    struct test_spec *specs = NULL;
 
-    /* build the tests objects */
+    /* parse the tests */
     argc -= optind;
     argv += optind;
 
+    if (argc && !strcmp( argv[0], "tune" )) {
+        opt_tune = 1;
+        tune_opts_init( &tune_opts );
+        optind = 1;
+        while ((result = getopt( argc, argv, "+s:p:n:t:m:l:a" )) != EOF) {
+            switch (result) {
+            case 's':
+                tune_opts.soak = atoi(optarg);
+                break;
+            case 'p':
+                if (tune_list_parse( optarg, tune_opts.periods, &tune_opts.n_periods )) {
+                    printf("invalid value '%s' for 'tune' option '-p'\n", optarg);
+                    usage();
+                }
+                break;
+            case 'n':
+                if (tune_list_parse( optarg, tune_opts.counts, &tune_opts.n_counts )) {
+                    printf("invalid value '%s' for 'tune' option '-n'\n", optarg);
+                    usage();
+                }
+                break;
+            case 't':
+                if (tune_list_parse( optarg, tune_opts.thresholds, &tune_opts.n_thresholds )) {
+                    printf("invalid value '%s' for 'tune' option '-t'\n", optarg);
+                    usage();
+                }
+                break;
+            case 'm':
+                tune_opts.min_headroom_us = atoi(optarg);
+                break;
+            case 'l':
+                tune_opts.load_threads = atoi(optarg);
+                break;
+            case 'a':
+                tune_opts.all = 1;
+                break;
+            default:
+                usage();
+            }
+        }
+        if (tune_opts.soak == 0) {
+            printf("invalid soak time for 'tune'\n");
+            usage();
+        }
+        argc -= optind;
+        argv += optind;
+    }
+
     while (argc) {
-        struct test *t = NULL;
+        struct test_spec *spec;
+
+        specs = realloc( specs, (tests_count + 1) * sizeof(*specs) );
+        if (!specs) {
+            err("out of memory");
+            exit(1);
+        }
+        spec = &specs[ tests_count ];
+        memset( spec, 0, sizeof(*spec) );
+        spec->config = config;
+        spec->thread_opts.threaded = opt_threads;
+        spec->thread_opts.cpu = -1;
+
         if (!strcmp( argv[0], "play" )) {
-            struct playback_create_opts opts = {0};
+            struct playback_create_opts *opts = &spec->opts.play;
+            spec->type = "play";
             optind = 1;
             while (1) {
-                if ((result = getopt( argc, argv, "+x:r:" )) == EOF) break;
+                if ((result = getopt( argc, argv, "+x:r:" TEST_COMMON_OPTS )) == EOF) break;
+                if (test_opt_parse( spec, result, optarg )) continue;
                 switch (result) {
                 case '?':
                     printf("invalid option '%s' for test 'play'\n", optarg);
                     usage();
                     break;
                 case 'x':
-                    opts.xrun = atoi(optarg);
+                    opts->xrun = atoi(optarg);
                     break;
                 case 'r':
-                    if (sscanf(optarg, "%d,%d", &opts.restart_play_time, &opts.restart_pause_time) != 2) {
+                    if (sscanf(optarg, "%d,%d", &opts->restart_play_time, &opts->restart_pause_time) != 2) {
                         printf("invalid value '%s' for test 'play' option '-r'\n", optarg);
                         usage();
                     }
-                    dbg("%d,%d", opts.restart_play_time, opts.restart_pause_time);
+                    dbg("%d,%d", opts->restart_play_time, opts->restart_pause_time);
                     break;
                 }
             }
-            argc -= optind-1;
-            argv += optind-1;
-            t = playback_create( &config, &opts );
-            if (!t) {
-                err("failed to create a playback test");
-                exit(1);
-            }
         } else if (!strcmp( argv[0], "capture" )) {
-            struct capture_create_opts opts = {0};
+            struct capture_create_opts *opts = &spec->opts.capture;
+            spec->type = "capture";
             optind = 1;
             while (1) {
-                if ((result = getopt( argc, argv, "+x:r:" )) == EOF) break;
+                if ((result = getopt_long( argc, argv, "+x:r:w:b:" TEST_COMMON_OPTS, capture_options, NULL )) == EOF) break;
+                if (test_opt_parse( spec, result, optarg )) continue;
                 switch (result) {
                 case '?':
                     printf("invalid option '%s' for test 'capture'\n", optarg);
                     usage();
                     break;
                 case 'x':
-                    opts.xrun = atoi(optarg);
+                    opts->xrun = atoi(optarg);
                     break;
                 case 'r':
-                    if (sscanf(optarg, "%d,%d", &opts.restart_play_time, &opts.restart_pause_time) != 2) {
+                    if (sscanf(optarg, "%d,%d", &opts->restart_play_time, &opts->restart_pause_time) != 2) {
                         printf("invalid value '%s' for test 'capture' option '-r'\n", optarg);
                         usage();
                     }
-                    dbg("%d,%d", opts.restart_play_time, opts.restart_pause_time);
+                    dbg("%d,%d", opts->restart_play_time, opts->restart_pause_time);
+                    break;
+                case 'w':
+                    opts->record_path = optarg;
+                    break;
+                case 'b':
+                    if (blackbox_opts_parse( optarg, &opts->blackbox )) {
+                        printf("invalid value '%s' for test 'capture' option '-b'\n", optarg);
+                        usage();
+                    }
                     break;
                 }
             }
-            argc -= optind-1;
-            argv += optind-1;
-            t = capture_create( &config, &opts );
-            if (!t) {
-                err("failed to create a capture test");
-                exit(1);
-            }
         } else if (!strcmp( argv[0], "loopback_delay" )) {
-            struct loopback_delay_create_opts opts = {0};
+            struct loopback_delay_create_opts *opts = &spec->opts.loopback_delay;
+            spec->type = "loopback_delay";
             optind = 1;
             while (1) {
-                if ((result = getopt( argc, argv, "+a:s:x:" )) == EOF) break;
+                if ((result = getopt( argc, argv, "+a:s:x:r:i:o:b:" TEST_COMMON_OPTS )) == EOF) break;
+                if (test_opt_parse( spec, result, optarg )) continue;
                 switch (result) {
                 case '?':
                     printf("invalid option '%s' for test 'loopback_delay'\n", optarg);
                     usage();
                     break;
                 case 'a':
-                    opts.assert_delay = 1;
-                    opts.expected_delay = atoi(optarg);
+                    opts->assert_delay = 1;
+                    opts->expected_delay = atoi(optarg);
+                    break;
+                case 'x':
+                    opts->xrun = atoi(optarg);
+                    break;
+                case 'r':
+                    if (sscanf(optarg, "%d,%d", &opts->restart_play_time, &opts->restart_pause_time) != 2) {
+                        printf("invalid value '%s' for test 'loopback_delay' option '-r'\n", optarg);
+                        usage();
+                    }
+                    break;
+                case 'i':
+                    if (!strcmp(optarg, "both"))
+                        opts->inject = LDI_BOTH;
+                    else if (!strcmp(optarg, "play"))
+                        opts->inject = LDI_PLAYBACK;
+                    else if (!strcmp(optarg, "capture"))
+                        opts->inject = LDI_CAPTURE;
+                    else {
+                        printf("invalid value '%s' for test 'loopback_delay' option '-i'\n", optarg);
+                        usage();
+                    }
+                    break;
+                case 'o':
+                    opts->delay_series_path = optarg;
+                    break;
+                case 'b':
+                    if (blackbox_opts_parse( optarg, &opts->blackbox )) {
+                        printf("invalid value '%s' for test 'loopback_delay' option '-b'\n", optarg);
+                        usage();
+                    }
                     break;
                 case 's':
                     if (!strcmp(optarg, "capture"))
-                        opts.start_sync_mode = LSM_PREPARE_CAPTURE_PLAYBACK;
+                        opts->start_sync_mode = LSM_PREPARE_CAPTURE_PLAYBACK;
                     else if (!strcmp(optarg, "play"))
-                        opts.start_sync_mode = LSM_PREPARE_PLAYBACK_CAPTURE;
+                        opts->start_sync_mode = LSM_PREPARE_PLAYBACK_CAPTURE;
                     else if (!strcmp(optarg, "link"))
-                        opts.start_sync_mode = LSM_LINK;
+                        opts->start_sync_mode = LSM_LINK;
                     else {
                         printf("invalid value '%s' for test 'loopback_delay' option '-s'\n", optarg);
                         usage();
@@ -307,25 +728,24 @@ int main(int argc, char * const argv[]) {
                     break;
                 }
             }
-            argc -= optind-1;
-            argv += optind-1;
-            t = loopback_delay_create( &config, &opts );
-            if (!t) {
-                err("failed to create a capture test");
-                exit(1);
-            }
-        }
-
-        if (t) {
-            if (tests_count >= MAX_TESTS) {
-                err("too many tests defined.");
-                exit(1);
-            }
-            tests[tests_count++] = t;
         } else {
             printf("undefined test '%s'.\n", argv[0]);
             usage();
         }
+        argc -= optind-1;
+        argv += optind-1;
+
+        /* check if the config is valid */
+        if (spec->config.device[0] == '\0') {
+            printf("Undefined device for test '%s'.\n", spec->type);
+            exit(1);
+        }
+        if (!seq_format_supported( spec->config.format )) {
+            printf("Unsupported format '%s'.\n", snd_pcm_format_name( spec->config.format ));
+            exit(1);
+        }
+
+        tests_count++;
         argc--;
         argv++;
     }
@@ -334,63 +754,60 @@ int main(int argc, char * const argv[]) {
         exit(1);
     }
 
-    /* change the scheduling priority is required */
-    if (config.priority[0]) {
-        int p;
-        if (sscanf(config.priority, "fifo,%d", &p )==1) {
-            struct sched_param param;
-            param.sched_priority = p;
-
-            dbg("priority: fifo,%d", p);
-            if (sched_setscheduler(0, SCHED_FIFO, &param))
-               err("sched_setscheduler");
-        } else if (sscanf(config.priority, "rr,%d", &p )==1) {
-            struct sched_param param;
-            param.sched_priority = p;
-
-            dbg("priority: rr,%d", p);
-            if (sched_setscheduler(0, SCHED_RR, &param))
-                err("sched_setscheduler");
-        } else if (sscanf(config.priority, "other,%d", &p )==1) {
-            struct sched_param param;
-            param.sched_priority = p;
-
-            dbg("priority: other,%d", p);
-            if (sched_setscheduler(0, SCHED_OTHER, &param))
-                err("sched_setscheduler");
-        } else {
+    seq_simd_init();    /* not thread safe: select the implementation once for all */
+
+    /* setup signal handlers to exist cleanly */
+    ev_signal_init(&evw_intsig, on_exit_signal, SIGINT);
+    ev_signal_start(loop, &evw_intsig);
+
+    ev_signal_init(&evw_termsig, on_exit_signal, SIGTERM);
+    ev_signal_start(loop, &evw_termsig);
+
+    if (opt_tune) {
+        struct tune_ctx ctx = { specs, loop };
+
+        if (config.priority[0] && test_priority_set( config.priority )) {
             printf("Invalid priority '%s'\n", config.priority);
         }
+        r = tune_sweep( &tune_opts, config.rate, tune_run, &ctx );
+        log_async_stop();
+        free( specs );
+        return r;
+    }
+
+    /* open the devices in parallel */
+    if (tests_create( specs ))
+        exit(1);
+    if (opt_assert) {
+        for (i=0; i < tests_count; i++) {
+            tests[i]->error_notify = seq_error_assert;
+            tests[i]->error_notify_data = loop;
+        }
     }
+    free( specs );
 
+    /* change the scheduling priority is required (inherited by the test threads) */
+    if (config.priority[0] && test_priority_set( config.priority )) {
+        printf("Invalid priority '%s'\n", config.priority);
+    }
 
+    if (opt_assert) {
+        ev_async_init( &evw_assert, on_assert );
+        ev_async_start( loop, &evw_assert );
+    }
     /* start the various tests */
     for (i=0; i < tests_count; i++) {
         struct test *t = tests[i];
-        r = t->ops->start( t );
+        r = test_start( t, loop );
         if (r < 0) {
             err("starting test %s failed", t->name );
             exit(1);
         }
     }
 
-    /* setup signal handlers to exist cleanly */
-    ev_signal_init(&evw_intsig, on_exit_signal, SIGINT);
-    ev_signal_start(loop, &evw_intsig);
-
-    ev_signal_init(&evw_termsig, on_exit_signal, SIGTERM);
-    ev_signal_start(loop, &evw_termsig);
-
     ev_io_init(&stdin_watcher, on_stdin, 0, EV_READ);
     ev_io_start( loop, &stdin_watcher );
 
-    if (opt_assert) {
-        seq_error_notify = &seq_error_assert;
-    }
-    if (opt_invalid_log_size > 0) {
-        seq_consecutive_invalid_frames_log = opt_invalid_log_size;
-    }
-
     if (opt_duration > 0) {
         dbg("start a %d seconds duration timer", opt_duration);
         ev_timer_init( &duration_timer, on_duration_timer, opt_duration, 0 );
@@ -399,17 +816,40 @@ int main(int argc, char * const argv[]) {
 
     ev_run( loop, 0 );
 
+    /* the real time part is over */
+    for (i=0; i < tests_count; i++)
+        test_stop( tests[i] );
+    log_async_stop();
+    tests_report();
+
+    /* per device results */
     int test_exit_status = 0;
+    int tests_failed = 0;
+    printf("%-24s %-16s %10s %s\n", "device", "test", "seq errors", "status");
     for (i=0; i < tests_count; i++) {
         struct test *t = tests[i];
-        if (t->ops->close( t )) {
-            err("%s exit status: failed", t->name);
+        /* t is freed by test_close() */
+        const char *name = t->name;
+        char device[ sizeof(t->device) ];
+        unsigned seq_errors = __atomic_load_n( &t->seq_errors, __ATOMIC_RELAXED );
+        int failed;
+
+        memcpy( device, t->device, sizeof(device) );
+        failed = test_close( t ) != 0;
+        if (failed) {
+            err("%s exit status: failed", name);
             test_exit_status = 1;
         }
+        if (failed || seq_errors) tests_failed++;
+        printf("%-24s %-16s %10u %s\n", device, name, seq_errors, (failed || seq_errors) ? "FAILED" : "OK");
     }
+    free( tests );
 
-    printf("total number of sequence errors: %u\n", seq_errors_total);
+    printf("tests: %d, failed: %d\n", tests_count, tests_failed);
+    if (log_dropped())
+        printf("log messages dropped: %u\n", log_dropped());
+    printf("total number of sequence errors: %u\n", test_seq_errors_total());
     printf("global tests exit status: %s\n", test_exit_status ? "FAILED" : "OK");
     /* exit with a good status only if no error was detected */
-    return (seq_errors_total || test_exit_status) ? 2 : 0;
+    return (test_seq_errors_total() || test_exit_status) ? 2 : 0;
 }
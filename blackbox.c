@@ -0,0 +1,264 @@
+/*
+ * Copyright (C) 2015 Arnaud Mouiche <arnaud.mouiche@invoxia.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "blackbox.h"
+#include "alsa.h"
+#include "log.h"
+
+#define BLACKBOX_DEFAULT_PERIODS    16
+
+
+int blackbox_opts_parse( char *arg, struct blackbox_opts *opts ) {
+    char *p = strchr( arg, ',' );
+
+    opts->prefix = arg;
+    opts->periods = BLACKBOX_DEFAULT_PERIODS;
+    opts->every = 0;
+    if (p) {
+        *p++ = '\0';
+        if (sscanf( p, "%u,%u", &opts->periods, &opts->every ) < 1) return -1;
+    }
+    return (arg[0] && opts->periods) ? 0 : -1;
+}
+
+
+/*
+ * WAV format tag for the formats stored as is in a WAV file, 0 otherwise
+ */
+static unsigned wav_format_tag( snd_pcm_format_t format ) {
+    switch (format) {
+    case SND_PCM_FORMAT_S16_LE:
+    case SND_PCM_FORMAT_S24_3LE:
+    case SND_PCM_FORMAT_S32_LE:
+        return 1;   /* WAVE_FORMAT_PCM */
+    case SND_PCM_FORMAT_FLOAT_LE:
+        return 3;   /* WAVE_FORMAT_IEEE_FLOAT */
+    default:
+        return 0;
+    }
+}
+
+static void put_le16( uint8_t *p, unsigned v ) { p[0] = v; p[1] = v >> 8; }
+static void put_le32( uint8_t *p, unsigned v ) { put_le16( p, v ); put_le16( p + 2, v >> 16 ); }
+
+static void wav_header( struct blackbox *bb, uint8_t *h, unsigned data_bytes ) {
+    memcpy( h, "RIFF", 4 );
+    put_le32( h + 4, 36 + data_bytes );
+    memcpy( h + 8, "WAVEfmt ", 8 );
+    put_le32( h + 16, 16 );
+    put_le16( h + 20, wav_format_tag( bb->format ) );
+    put_le16( h + 22, bb->channels );
+    put_le32( h + 24, bb->rate );
+    put_le32( h + 28, bb->rate * bb->frame_bytes );
+    put_le16( h + 32, bb->frame_bytes );
+    put_le16( h + 34, bb->sample_bytes * 8 );
+    memcpy( h + 36, "data", 4 );
+    put_le32( h + 40, data_bytes );
+}
+
+/*
+ * write the content of a ring, oldest frame first
+ */
+static void blackbox_file_write( struct blackbox *bb, struct blackbox_bank *bank, const char *suffix,
+        const uint8_t *ring, unsigned long long total ) {
+    snd_pcm_uframes_t frames = (total < bb->ring_frames) ? total : bb->ring_frames;
+    snd_pcm_uframes_t first = (total < bb->ring_frames) ? 0 : total % bb->ring_frames;
+    int wav = wav_format_tag( bb->format ) != 0;
+    char path[ 512 ];
+    uint8_t header[44];
+    FILE *f;
+
+    snprintf( path, sizeof(path), "%s-%u%s.%s", bb->prefix, bank->dump_index, suffix, wav ? "wav" : "raw" );
+    f = fopen( path, "w" );
+    if (!f) {
+        err("black box: can't create '%s': %s", path, strerror(errno));
+        return;
+    }
+    if (wav) {
+        wav_header( bb, header, frames * bb->frame_bytes );
+        fwrite( header, sizeof(header), 1, f );
+    }
+    fwrite( ring + first * bb->frame_bytes, bb->frame_bytes, frames - first, f );
+    fwrite( ring, bb->frame_bytes, first, f );
+    if (ferror( f ) | fclose( f ))
+        err("black box: write failed on '%s'", path);
+    else
+        warn("black box: error #%llu, %lu frames dumped in %s", bank->first_error, (unsigned long)frames, path);
+}
+
+static void *blackbox_thread( void *arg ) {
+    struct blackbox *bb = (struct blackbox *)arg;
+
+    while (1) {
+        int stopping, b;
+
+        while (sem_wait( &bb->ready ) && (errno == EINTR));
+        stopping = __atomic_load_n( &bb->stopping, __ATOMIC_ACQUIRE );
+
+        for (b = 0; b < 2; b++) {
+            struct blackbox_bank *bank = &bb->banks[b];
+            if (!__atomic_load_n( &bank->busy, __ATOMIC_ACQUIRE )) continue;
+            blackbox_file_write( bb, bank, "", bank->capture, bank->capture_frames );
+            if (bank->playback)
+                blackbox_file_write( bb, bank, "-play", bank->playback, bank->playback_frames );
+            __atomic_store_n( &bank->busy, 0, __ATOMIC_RELEASE );
+        }
+        if (stopping) break;
+    }
+    return NULL;
+}
+
+
+struct blackbox *blackbox_create( const struct blackbox_opts *opts, snd_pcm_format_t format, unsigned channels,
+        unsigned rate, snd_pcm_uframes_t period, int playback ) {
+    struct blackbox *bb = calloc( 1, sizeof(*bb) );
+    size_t ring_bytes;
+    int b, r;
+
+    if (!bb) return NULL;
+    strncpy( bb->prefix, opts->prefix, sizeof(bb->prefix)-1 );
+    bb->format = format;
+    bb->channels = channels;
+    bb->rate = rate;
+    bb->sample_bytes = snd_pcm_format_physical_width( format ) / 8;
+    bb->frame_bytes = channels * bb->sample_bytes;
+    bb->ring_frames = period * opts->periods;
+    bb->every = opts->every;
+
+    ring_bytes = bb->ring_frames * bb->frame_bytes;
+    for (b = 0; b < 2; b++) {
+        bb->banks[b].capture = malloc( ring_bytes );
+        if (!bb->banks[b].capture) goto no_memory;
+        if (playback) {
+            bb->banks[b].playback = malloc( ring_bytes );
+            if (!bb->banks[b].playback) goto no_memory;
+        }
+    }
+
+    sem_init( &bb->ready, 0, 0 );
+    r = pthread_create( &bb->thread, NULL, blackbox_thread, bb );
+    if (r) {
+        err("black box: can't create the writer thread: %s", strerror(r));
+        sem_destroy( &bb->ready );
+        goto failed;
+    }
+    return bb;
+
+no_memory:
+    err("black box: out of memory");
+failed:
+    for (b = 0; b < 2; b++) {
+        free( bb->banks[b].capture );
+        free( bb->banks[b].playback );
+    }
+    free( bb );
+    return NULL;
+}
+
+
+static void ring_write( struct blackbox *bb, uint8_t *ring, unsigned long long *total,
+        const void * const *planes, snd_pcm_uframes_t count, int planar ) {
+    const void *p[ planar ? bb->channels : 1 ];
+    snd_pcm_uframes_t done = 0;
+    unsigned ch;
+
+    while (done < count) {
+        snd_pcm_uframes_t offset = *total % bb->ring_frames;
+        snd_pcm_uframes_t n = bb->ring_frames - offset;
+        uint8_t *dst = ring + offset * bb->frame_bytes;
+
+        if (n > count - done) n = count - done;
+        if (planar) {
+            for (ch = 0; ch < bb->channels; ch++)
+                p[ch] = (const uint8_t *)planes[ch] + done * bb->sample_bytes;
+            alsa_planes_interleave( dst, p, bb->channels, bb->sample_bytes, n );
+        } else {
+            memcpy( dst, (const uint8_t *)planes[0] + done * bb->frame_bytes, n * bb->frame_bytes );
+        }
+        done += n;
+        *total += n;
+    }
+}
+
+/* give the active ring to the writer thread, and go on with the other one */
+static void blackbox_dump( struct blackbox *bb ) {
+    struct blackbox_bank *bank = &bb->banks[ bb->active ];
+    struct blackbox_bank *next = &bb->banks[ !bb->active ];
+
+    bb->armed = 0;
+    if (__atomic_load_n( &next->busy, __ATOMIC_ACQUIRE )) {
+        /* the previous dump is still being written */
+        bb->skipped++;
+        return;
+    }
+    bank->dump_index = bb->dumps++;
+    __atomic_store_n( &bank->busy, 1, __ATOMIC_RELEASE );
+    sem_post( &bb->ready );
+
+    next->capture_frames = 0;
+    next->playback_frames = 0;
+    bb->active = !bb->active;
+}
+
+
+void blackbox_capture( struct blackbox *bb, const void * const *planes, snd_pcm_uframes_t count, int planar,
+        unsigned long long error_count ) {
+    struct blackbox_bank *bank = &bb->banks[ bb->active ];
+
+    ring_write( bb, bank->capture, &bank->capture_frames, planes, count, planar );
+
+    if (error_count != bb->errors_seen) {
+        int trigger = (bb->errors_seen == 0) ||
+                (bb->every && (error_count / bb->every != bb->errors_seen / bb->every));
+        if (trigger && !bb->armed) {
+            /* go on for half the ring, to see what follows the error */
+            bb->armed = 1;
+            bb->post_frames = bb->ring_frames / 2;
+            bank->first_error = bb->errors_seen + 1;
+        }
+        bb->errors_seen = error_count;
+    }
+
+    if (bb->armed) {
+        bb->post_frames -= count;
+        if (bb->post_frames <= 0) blackbox_dump( bb );
+    }
+}
+
+void blackbox_playback( struct blackbox *bb, const void * const *planes, snd_pcm_uframes_t count, int planar ) {
+    struct blackbox_bank *bank = &bb->banks[ bb->active ];
+    if (bank->playback)
+        ring_write( bb, bank->playback, &bank->playback_frames, planes, count, planar );
+}
+
+
+void blackbox_destroy( struct blackbox *bb ) {
+    int b;
+
+    /* the test stopped right after an error */
+    if (bb->armed) blackbox_dump( bb );
+
+    __atomic_store_n( &bb->stopping, 1, __ATOMIC_RELEASE );
+    sem_post( &bb->ready );
+    pthread_join( bb->thread, NULL );
+    sem_destroy( &bb->ready );
+
+    if (bb->skipped)
+        warn("black box: %u dumps skipped (writer busy)", bb->skipped);
+    for (b = 0; b < 2; b++) {
+        free( bb->banks[b].capture );
+        free( bb->banks[b].playback );
+    }
+    free( bb );
+}
@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2015 Arnaud Mouiche <arnaud.mouiche@invoxia.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ */
+
+#ifndef __blackbox_h__
+#define __blackbox_h__
+
+#include <semaphore.h>
+#include <pthread.h>
+#include <alsa/asoundlib.h>
+
+/*
+ * Black box: the last periods of captured audio (and optionally of the generated
+ * playback audio) kept in memory, and dumped to files around the sequence errors.
+ *
+ * On the first error (and every 'every' errors if not 0), the capture goes on for half
+ * the ring, so the dump holds the audio before and after the error. The filled ring
+ * is then given to a writer thread and the capture continues in a second one: the
+ * test thread only copies the periods in the ring, the files are written by the
+ * writer thread. If the writer still owns the second ring, the dump is skipped.
+ *
+ * The dumps are PREFIX-N.wav (PREFIX-N-play.wav for the playback side), or .raw for
+ * the formats WAV can't hold as is (big endian, S24 in 4 bytes).
+ */
+
+struct blackbox_opts {
+    const char *prefix;     /* NULL: no black box */
+    unsigned periods;       /* size of the ring */
+    unsigned every;         /* 0: only dump on the first error */
+};
+
+/*
+ * parse the value of the '-b PREFIX[,PERIODS[,EVERY]]' test option ('arg' is modified)
+ * return 0 on success
+ */
+int blackbox_opts_parse( char *arg, struct blackbox_opts *opts );
+
+
+struct blackbox_bank {
+    uint8_t *capture;
+    uint8_t *playback;                      /* NULL if the playback side is not kept */
+    unsigned long long capture_frames;      /* written since the bank is active */
+    unsigned long long playback_frames;
+    unsigned long long first_error;         /* error count when the dump was triggered */
+    unsigned dump_index;
+    int busy;                               /* owned by the writer thread */
+};
+
+struct blackbox {
+    char prefix[ 256 ];
+    snd_pcm_format_t format;
+    unsigned channels;
+    unsigned rate;
+    unsigned sample_bytes;
+    unsigned frame_bytes;
+    snd_pcm_uframes_t ring_frames;
+    unsigned every;
+
+    struct blackbox_bank banks[2];
+    unsigned active;
+
+    /* test thread */
+    unsigned long long errors_seen;
+    snd_pcm_sframes_t post_frames;          /* frames still captured before the dump, if armed */
+    int armed;
+    unsigned dumps;
+    unsigned skipped;
+
+    sem_t ready;
+    int stopping;
+    pthread_t thread;
+};
+
+/*
+ * keep opts->periods periods of 'period' frames.
+ * 'playback' is set to also keep the generated frames (see blackbox_playback())
+ * return NULL on failure
+ */
+struct blackbox *blackbox_create( const struct blackbox_opts *opts, snd_pcm_format_t format, unsigned channels,
+        unsigned rate, snd_pcm_uframes_t period, int playback );
+
+/*
+ * keep 'count' checked frames. 'error_count' is the checker error counter after those frames
+ * (seq_info.error_count). 'planes' holds one buffer per channel if 'planar' is set.
+ */
+void blackbox_capture( struct blackbox *bb, const void * const *planes, snd_pcm_uframes_t count, int planar,
+        unsigned long long error_count );
+
+/* keep 'count' generated frames */
+void blackbox_playback( struct blackbox *bb, const void * const *planes, snd_pcm_uframes_t count, int planar );
+
+/* dump the pending ring if any, and wait for the writer */
+void blackbox_destroy( struct blackbox *bb );
+
+#endif //__blackbox_h__
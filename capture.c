@@ -11,26 +11,121 @@
 #include "log.h"
 
 
+/*
+ * the frames were checked: keep them in the recording and the black box
+ */
+static void capture_keep( struct test_capture *tp, const void * const *planes, snd_pcm_uframes_t count, int planar ) {
+    if (tp->rec)
+        record_frames( tp->rec, planes, count, planar );
+    if (tp->bb)
+        blackbox_capture( tp->bb, planes, count, planar, tp->seq.error_count );
+}
+
+static void capture_mmap_check( void *data, void * const *planes, snd_pcm_uframes_t count ) {
+    struct test_capture *tp = (struct test_capture *)data;
+    uint64_t t0 = hist_now_ns();
+    if (alsa_access_is_planar( tp->t.config.access ))
+        seq_check_frames_planar( &tp->seq, (const void * const *)planes, count );
+    else
+        seq_check_frames( &tp->seq, planes[0], count );
+    tp->stats.seq_ns += hist_now_ns() - t0;
+    capture_keep( tp, (const void * const *)planes, count, alsa_access_is_planar( tp->t.config.access ) );
+}
+
+/*
+ * the stream was interrupted: resynchronize the checker, on the frames expected
+ * after the 'lost' ones when known (-1 otherwise)
+ */
+static void capture_jump_notify( struct test_capture *tp, long lost ) {
+    if (lost >= 0) {
+        seq_check_resync( &tp->seq, lost, tp->t.config.period );
+        if (tp->rec) record_resync( tp->rec, lost, tp->t.config.period );
+    } else {
+        seq_check_jump_notify( &tp->seq );
+        if (tp->rec) record_jump( tp->rec );
+    }
+}
+
+/*
+ * a period ended with valid frames: the recoveries in progress are over
+ */
+static void capture_recovery_update( struct test_capture *tp, snd_pcm_uframes_t frames ) {
+    uint64_t latency;
+
+    latency = recovery_update( &tp->recovery, &tp->seq, frames );
+    if (latency)
+        warn("%s: capture recovered in %.2f ms", tp->t.device, latency * 1e-6);
+    if (tp->t.peer_recovery) {
+        latency = recovery_update( tp->t.peer_recovery, &tp->seq, frames );
+        if (latency)
+            warn("%s: playback recovered in %.2f ms", tp->t.device, latency * 1e-6);
+    }
+}
+
+/*
+ * read and check one period of frames
+ * in mmap access, the frames are checked directly in the DMA ring.
+ *
+ * return the number of frames read or a negative error code
+ */
+static snd_pcm_sframes_t capture_read_period( struct test_capture *tp ) {
+    uint64_t t0 = hist_now_ns(), t1;
+    snd_pcm_sframes_t frames;
+
+    if (alsa_access_is_mmap( tp->t.config.access )) {
+        frames = pcm_mmap_transfer( tp->pcm, tp->t.config.period, capture_mmap_check, tp );
+    } else {
+        if (tp->period_planes)
+            frames = pcm_readn(tp->pcm, tp->period_planes, tp->t.config.period);
+        else
+            frames = pcm_readi(tp->pcm, tp->periof_buff, tp->t.config.period);
+        if (frames == tp->t.config.period) {
+            /* check the sequence */
+            t1 = hist_now_ns();
+            if (tp->period_planes)
+                seq_check_frames_planar( &tp->seq, (const void * const *)tp->period_planes, tp->t.config.period );
+            else
+                seq_check_frames( &tp->seq, tp->periof_buff, tp->t.config.period );
+            tp->stats.seq_ns = hist_now_ns() - t1;
+            if (tp->period_planes)
+                capture_keep( tp, (const void * const *)tp->period_planes, frames, 1 );
+            else
+                capture_keep( tp, (const void * const *)&tp->periof_buff, frames, 0 );
+        }
+    }
+    period_stats_record( &tp->stats, hist_now_ns() - t0 );
+    if (frames > 0) {
+        tp->frames_read += frames;
+        drift_rate_update( &tp->drift, tp->pcm, SND_PCM_STREAM_CAPTURE, tp->frames_read );
+        if (tp->seq.state == VALID_FRAME) {
+            drift_seq_update( &tp->drift, tp->frames_read, tp->seq.frame_num, tp->seq.frame_num_mask );
+            capture_recovery_update( tp, frames );
+        }
+    }
+    return frames;
+}
+
+
 static int capture_start(struct test *t) {
     struct test_capture *tp = (struct test_capture *)t;
     int r;
     dbg("%s: capture_start", tp->t.device);
-    r = snd_pcm_start( tp->pcm );
+    r = pcm_start( tp->pcm );
     if (r < 0) {
         warn("%s: capture start failed: %s", tp->t.device, snd_strerror(r));
         return -1;
     } else {
-        ev_io_start( loop, &tp->io_watcher );
+        ev_io_start( tp->t.loop, &tp->io_watcher );
         if (tp->opts.xrun) {
             dbg("%s: will simulate xrun every %d ms", tp->t.device, tp->opts.xrun);
             tp->timer_state = CT_W4_XRUN;
             ev_timer_set( &tp->timer, tp->opts.xrun * 1e-3, 0);
-            ev_timer_start( loop, &tp->timer );
+            ev_timer_start( tp->t.loop, &tp->timer );
         } else if (tp->opts.restart_play_time && tp->opts.restart_pause_time) {
             dbg("%s: will stop every %d ms during %d ms", tp->t.device, tp->opts.restart_play_time, tp->opts.restart_pause_time);
             tp->timer_state = CT_W4_STOP;
             ev_timer_set( &tp->timer, tp->opts.restart_play_time * 1e-3, 0);
-            ev_timer_start( loop, &tp->timer );
+            ev_timer_start( tp->t.loop, &tp->timer );
         }
     }
 
@@ -57,6 +152,8 @@ static void capture_timer( struct ev_loop *loop, struct ev_timer *w, int revents
     case CT_W4_XRUN_END:
         warn("%s: CT_W4_XRUN_END", tp->t.device);
         ev_io_start( loop, &tp->io_watcher );
+        /* timed from here if the stream didn't xrun, else from its recovery by the io job */
+        recovery_start( &tp->recovery );
         tp->timer_state = CT_W4_XRUN;
         ev_timer_set( &tp->timer, tp->opts.xrun*1e-3, 0);
         ev_timer_start( loop, &tp->timer );
@@ -64,7 +161,7 @@ static void capture_timer( struct ev_loop *loop, struct ev_timer *w, int revents
 
     case CT_W4_STOP:
         warn("%s: CT_W4_STOP", tp->t.device);
-        snd_pcm_drop( tp->pcm );
+        pcm_drop( tp->pcm );
         ev_io_stop( loop, &tp->io_watcher );
         tp->timer_state = CT_W4_RESTART;
         ev_timer_set( &tp->timer, tp->opts.restart_pause_time * 1e-3, 0);
@@ -74,9 +171,11 @@ static void capture_timer( struct ev_loop *loop, struct ev_timer *w, int revents
     case CT_W4_RESTART: {
         int r;
         warn("%s: CT_W4_RESTART", tp->t.device);
-        seq_check_jump_notify( &tp->seq );
-        snd_pcm_prepare(tp->pcm);
-        r = snd_pcm_start( tp->pcm );
+        capture_jump_notify( tp, -1 );
+        /* the stream startup counts in its recovery time */
+        recovery_start( &tp->recovery );
+        pcm_prepare(tp->pcm);
+        r = pcm_start( tp->pcm );
         if (r >= 0) {
             ev_io_start( loop, &tp->io_watcher );
             tp->timer_state = CT_W4_STOP;
@@ -98,33 +197,44 @@ static void capture_io_job( struct ev_loop *loop, struct ev_io *w, int revents )
     struct test_capture *tp = (struct test_capture *)(w->data);
     snd_pcm_sframes_t frames;
 
-    frames = snd_pcm_readi(tp->pcm, tp->periof_buff, tp->t.config.period);
+    test_wakeup_record( &tp->t, tp->pcm, &tp->stats.wakeup );
+
+    frames = capture_read_period( tp );
     if (frames < 0) {
+        struct pcm_position before, after;
+        int known;
         int r;
+        if (frames == -ENODATA) {
+            dbg("%s: end of file", tp->t.device);
+            ev_unloop(loop, EVUNLOOP_ALL);
+            return;
+        }
         warn("%s: capture read failed: %s", tp->t.device, snd_strerror(frames));
         if (frames == -EBADFD) {
             err("unrecoverable alsa error");
             ev_unloop(loop, EVUNLOOP_ALL);
             return;
         }
-        r = snd_pcm_recover(tp->pcm, frames, 0);
+        test_xrun( &tp->t );
+        /* the positions around the recovery tell how many frames are lost */
+        known = !pcm_get_position( tp->pcm, &before );
+        r = pcm_recover( tp->pcm, frames );
         if (r < 0) {
             err("%s: capture recover failed: %s", tp->t.device, snd_strerror(frames));
         }
-        r = snd_pcm_start( tp->pcm );
+        r = pcm_start( tp->pcm );
         if (r < 0) {
             warn("%s: capture start failed after recover: %s", tp->t.device, snd_strerror(r));
             ev_unloop(loop, EVUNLOOP_ALL);
             return;
         }
-        seq_check_jump_notify( &tp->seq );
+        known = known && !pcm_get_position( tp->pcm, &after );
+        capture_jump_notify( tp, known ? pcm_frames_lost( tp->pcm, &before, &after ) : -1 );
+        recovery_start( &tp->recovery );
 
     } else if (frames != tp->t.config.period) {
         err("%s: capture read less than the expected period size: %ld / %u", tp->t.device, frames, tp->t.config.period);
 
-    } else {
-        /* check the sequence */
-        seq_check_frames( &tp->seq, tp->periof_buff, tp->t.config.period );
     }
 }
 
@@ -133,9 +243,14 @@ static void capture_io_job( struct ev_loop *loop, struct ev_io *w, int revents )
 static int capture_close(struct test *t) {
     struct test_capture *tp = (struct test_capture *)t;
 
-    ev_io_stop(loop, &tp->io_watcher);
-    snd_pcm_close( tp->pcm );
+    ev_io_stop(tp->t.loop, &tp->io_watcher);
+    ev_timer_stop(tp->t.loop, &tp->timer);
+    pcm_close( tp->pcm );
+    if (tp->rec) record_close( tp->rec );
+    if (tp->bb) blackbox_destroy( tp->bb );
 
+    seq_free( &tp->seq );
+    free( tp->period_planes );
     free( tp->periof_buff );
     free( tp );
     return 0;
@@ -143,9 +258,19 @@ static int capture_close(struct test *t) {
 
 
 
+static void capture_report(struct test *t) {
+    struct test_capture *tp = (struct test_capture *)t;
+    period_stats_report( &tp->stats, tp->t.device, "capture" );
+    drift_report( &tp->drift, tp->t.device, "capture" );
+    seq_classify_report( tp->seq.classify, tp->t.device, "capture" );
+    recovery_report( &tp->recovery, tp->t.device, "capture" );
+}
+
+
 const struct test_ops capture_ops = {
         .start = capture_start,
         .close = capture_close,
+        .report = capture_report,
 };
 
 /*
@@ -163,22 +288,39 @@ struct test *capture_create(struct alsa_config *config, struct capture_create_op
     memcpy( tp->t.device, config->device, sizeof(tp->t.device) );
     tp->opts = *opts;
 
-    r = alsa_device_open( tp->t.config.device, &tp->t.config, &tp->pcm, NULL );
+    r = pcm_open( tp->t.config.device, &tp->t.config, &tp->pcm, NULL );
     if (r) goto failed1;
 
-    seq_init( &tp->seq, tp->t.config.channels, tp->t.config.format );
-    tp->periof_buff = malloc( snd_pcm_frames_to_bytes( tp->pcm, tp->t.config.period ));
-    if (!tp->periof_buff) goto failed;
-
-    r = snd_pcm_poll_descriptors_count(tp->pcm);
-    if (r != 1) {
-        err("capture_create: expect only 1 fd to monitor (snd_pcm_poll_descriptors_count)");
-        goto failed;
+    if (seq_init( &tp->seq, tp->t.config.channels, tp->t.config.format )) goto failed;
+    if (seq_classify_attach( &tp->seq )) goto failed;
+    test_seq_attach( &tp->t, &tp->seq );
+    drift_init( &tp->drift, tp->pcm, tp->t.config.rate, tp->t.config.period );
+    recovery_init( &tp->recovery, tp->t.config.rate );
+    tp->t.recovery = &tp->recovery;
+    if (tp->opts.record_path) {
+        /* a few seconds of margin for the writer thread */
+        tp->rec = record_open( tp->opts.record_path, tp->t.config.format, tp->t.config.channels,
+                tp->t.config.rate, tp->t.config.period, 4 );
+        if (!tp->rec) goto failed;
+    }
+    if (tp->opts.blackbox.prefix) {
+        tp->bb = blackbox_create( &tp->opts.blackbox, tp->t.config.format, tp->t.config.channels,
+                tp->t.config.rate, tp->t.config.period, 0 );
+        if (!tp->bb) goto failed;
+    }
+    if (!alsa_access_is_mmap( tp->t.config.access )) {
+        /* mmap access: the frames are checked directly in the DMA ring */
+        tp->periof_buff = malloc( pcm_frames_to_bytes( tp->pcm, tp->t.config.period ));
+        if (!tp->periof_buff) goto failed;
+        if (alsa_access_is_planar( tp->t.config.access )) {
+            tp->period_planes = alsa_planes_split( &tp->t.config, tp->periof_buff, tp->t.config.period );
+            if (!tp->period_planes) goto failed;
+        }
     }
 
-    r = snd_pcm_poll_descriptors(tp->pcm, &tp->pollfd, 1);
+    r = pcm_poll_descriptor( tp->pcm, &tp->pollfd );
     if (r < 0) {
-        err("%s: snd_pcm_poll_descriptors failed", tp->t.device);
+        err("%s: pcm_poll_descriptor failed", tp->t.device);
         goto failed;
     }
 
@@ -196,7 +338,11 @@ struct test *capture_create(struct alsa_config *config, struct capture_create_op
     return &tp->t;
 
 failed:
-    snd_pcm_close( tp->pcm );
+    pcm_close( tp->pcm );
+    if (tp->rec) record_close( tp->rec );
+    if (tp->bb) blackbox_destroy( tp->bb );
+    seq_free( &tp->seq );
+    free(tp->period_planes);
     free(tp->periof_buff);
 failed1:
     free(tp);
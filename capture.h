@@ -15,20 +15,40 @@
 #include <ev.h>
 
 #include "test.h"
+#include "pcm.h"
 #include "seq.h"
+#include "classify.h"
+#include "hist.h"
+#include "drift.h"
+#include "record.h"
+#include "blackbox.h"
+#include "recovery.h"
 
 struct capture_create_opts {
     int xrun;
     int restart_play_time;
     int restart_pause_time;
+
+    /* if not NULL, the checked frames are also written in this file (see record.h) */
+    const char *record_path;
+
+    /* dump the audio around the errors (see blackbox.h) */
+    struct blackbox_opts blackbox;
 };
 
 
 struct test_capture {
     struct test t;
-    snd_pcm_t *pcm;
+    struct pcm *pcm;
     struct seq_info seq;
     void *periof_buff;
+    void **period_planes;   /* non interleaved RW access: channel buffers of periof_buff */
+    struct period_stats stats;
+    struct drift drift;
+    unsigned long long frames_read;
+    struct record *rec;
+    struct blackbox *bb;
+    struct recovery recovery;
 
     struct pollfd pollfd;
     struct ev_io io_watcher;
@@ -0,0 +1,310 @@
+/*
+ * Copyright (C) 2015 Arnaud Mouiche <arnaud.mouiche@invoxia.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "classify.h"
+
+static const char *class_names[ SEQ_CLASS_COUNT ] = {
+    [SEQ_CLASS_DROP] = "drop",
+    [SEQ_CLASS_REPEAT] = "repeat",
+    [SEQ_CLASS_ROTATION] = "rotation",
+    [SEQ_CLASS_SLIP] = "slip",
+    [SEQ_CLASS_BIT_FLIP] = "bit_flip",
+    [SEQ_CLASS_NULL_INSERT] = "null_insert",
+    [SEQ_CLASS_NULL_GAP] = "null_gap",
+    [SEQ_CLASS_UNKNOWN] = "unknown",
+};
+
+const char *seq_class_name( enum seq_class cls ) {
+    return ((unsigned)cls < SEQ_CLASS_COUNT) ? class_names[cls] : "?";
+}
+
+
+int seq_classify_attach( struct seq_info *seq ) {
+    struct seq_classify *c = calloc( 1, sizeof(*c) );
+    if (!c) return -1;
+    c->run_class = -1;
+    c->mask = seq->frame_num_mask;
+    seq_classify_reset( c );
+    seq->classify = c;
+    return 0;
+}
+
+
+static void record( struct seq_classify *c, enum seq_class cls, unsigned len ) {
+    HIST_INC( c->events[cls], 1 );
+    HIST_INC( c->frames[cls], len );
+    hist_record( &c->len[cls], len );
+}
+
+/* close the run of invalid frames in progress */
+static void run_flush( struct seq_classify *c ) {
+    if (c->run_class < 0) return;
+    record( c, c->run_class, c->run_len );
+    if (c->run_class == SEQ_CLASS_ROTATION) HIST_INC( c->rotation[ c->run_arg ], 1 );
+    c->run_class = -1;
+}
+
+/* the stream went from 'expected' to 'received' */
+static void classify_jump( struct seq_classify *c, unsigned mask, unsigned expected, unsigned received ) {
+    unsigned delta = (received - expected) & mask;
+    if (delta == 0) return;
+    if (delta <= mask / 2)
+        record( c, SEQ_CLASS_DROP, delta );
+    else
+        record( c, SEQ_CLASS_REPEAT, mask + 1 - delta );
+}
+
+static void record_flip( struct seq_classify *c, unsigned ch ) {
+    record( c, SEQ_CLASS_BIT_FLIP, 1 );
+    HIST_INC( c->flip_channel[ch], 1 );
+}
+
+/* anything but the jump back: the pending mono jump was a real one */
+static void flip_flush( struct seq_classify *c ) {
+    if (c->flip_expected == SEQ_SLOT_REF_NONE) return;
+    if (!c->flip_recorded) classify_jump( c, c->mask, c->flip_expected, c->flip_received );
+    c->flip_expected = SEQ_SLOT_REF_NONE;
+}
+
+/* close what is in progress before a new anomaly */
+static void flush( struct seq_classify *c ) {
+    run_flush( c );
+    flip_flush( c );
+}
+
+void seq_classify_reset( struct seq_classify *c ) {
+    flush( c );
+    c->null_expected = SEQ_SLOT_REF_NONE;
+}
+
+
+void seq_classify_jump( struct seq_classify *c, const struct seq_info *seq, unsigned received, const uint8_t *next ) {
+    const unsigned mask = seq->frame_num_mask;
+    const unsigned expected = seq->frame_num;
+
+    run_flush( c );
+    if (c->flip_expected != SEQ_SLOT_REF_NONE) {
+        if ((expected == ((c->flip_received + 1) & mask)) && (received == ((c->flip_expected + 1) & mask))) {
+            /* back to the sequence */
+            if (!c->flip_recorded) record_flip( c, 0 );
+            c->flip_expected = SEQ_SLOT_REF_NONE;
+            return;
+        }
+        flip_flush( c );
+    }
+    /*
+     * in mono, a bit flip in the counter is a jump, immediately followed by a jump back.
+     * The next frame tells, or the next jump if the frame is the last of the buffer.
+     */
+    if ((seq->channels == 1) && (__builtin_popcount( (expected ^ received) & mask ) == 1)) {
+        unsigned n = next ? (seq->kernel->get( next ) >> FRAME_NUM_SHIFT) & mask : 0;
+        if (!next || (n == ((expected + 1) & mask))) {
+            c->flip_expected = expected;
+            c->flip_received = received;
+            c->flip_recorded = (next != NULL);
+            if (c->flip_recorded) record_flip( c, 0 );
+            return;
+        }
+    }
+    classify_jump( c, mask, expected, received );
+}
+
+
+static inline uint32_t sample_get( const struct seq_info *seq, const uint8_t *frame, const uint8_t * const *planes,
+        int idx, unsigned ch ) {
+    const unsigned bytes = seq->kernel->sample_bytes;
+    return seq->kernel->get( frame ? frame + ch * bytes : planes[ch] + idx * bytes );
+}
+
+/*
+ * bit flip: every sample but one is the expected one for the counter 'ref', and this one
+ * differs by one bit. return the channel, or -1
+ */
+static int flip_find( const struct seq_info *seq, const uint8_t *frame, const uint8_t * const *planes, int idx,
+        unsigned ref ) {
+    const unsigned mask = seq->frame_num_mask;
+    const uint32_t keep = CHANNEL_MASK | (mask << FRAME_NUM_SHIFT);
+    const unsigned width = seq->kernel->width;
+    const uint32_t value_mask = (width < 32) ? (1u << width) - 1 : 0xFFFFFFFF;
+    int flipped = -1;
+    unsigned ch;
+
+    for (ch = 0; ch < seq->channels; ch++) {
+        uint32_t v = sample_get( seq, frame, planes, idx, ch );
+        uint32_t diff = (v ^ SEQ_SAMPLE( ch, ref, mask )) & keep;
+        if (!diff && !(v & ~value_mask)) continue;
+        if ((flipped >= 0) || (v & ~value_mask) || (__builtin_popcount( diff ) != 1)) return -1;
+        flipped = ch;
+    }
+    return flipped;
+}
+
+/*
+ * rotation: the slot #s holds the channel (s + k) % channels of the same frame.
+ * (a slip of the stream is followed by the checker, see seq_classify_slip())
+ * The first slot gives k and the frame, up to the bank: every bank is tried.
+ * return k, or 0
+ */
+static unsigned rotation_find( const struct seq_info *seq, const uint8_t *frame, const uint8_t * const *planes,
+        int idx ) {
+    const unsigned channels = seq->channels;
+    const unsigned mask = seq->frame_num_mask;
+    const uint32_t keep = CHANNEL_MASK | (mask << FRAME_NUM_SHIFT);
+    const uint32_t v0 = sample_get( seq, frame, planes, idx, 0 ) & keep;
+    unsigned b, k;
+
+    for (b = 0; (k = (b << CHANNEL_BANK_SHIFT) | (v0 & CHANNEL_MASK)) < channels; b++) {
+        unsigned f = (v0 >> FRAME_NUM_SHIFT) - b;
+        unsigned s;
+
+        if (k == 0) continue;
+        for (s = 1; s < channels; s++) {
+            uint32_t v = sample_get( seq, frame, planes, idx, s ) & keep;
+            if (v != SEQ_SAMPLE( (s + k) % channels, f, mask )) break;
+        }
+        if (s == channels) return k;
+    }
+    return 0;
+}
+
+void seq_classify_invalid( struct seq_classify *c, const struct seq_info *seq,
+        const uint8_t *frame, const uint8_t * const *planes, int idx ) {
+    unsigned ref = seq->slot_ref, k;
+    enum seq_class cls;
+    int ch;
+
+    flip_flush( c );
+    /* no expected counter (after null frames): the one of the channel 1 sample, if not the flipped one */
+    if ((ref == SEQ_SLOT_REF_NONE) && (seq->channels > 1))
+        ref = (sample_get( seq, frame, planes, idx, 1 ) >> FRAME_NUM_SHIFT) & seq->frame_num_mask;
+
+    if ((ref != SEQ_SLOT_REF_NONE) && ((ch = flip_find( seq, frame, planes, idx, ref )) >= 0)) {
+        run_flush( c );
+        record_flip( c, ch );
+        return;
+    }
+
+    k = rotation_find( seq, frame, planes, idx );
+    cls = k ? SEQ_CLASS_ROTATION : SEQ_CLASS_UNKNOWN;
+    if ((c->run_class == cls) && (c->run_arg == k)) {
+        c->run_len++;
+        return;
+    }
+    run_flush( c );
+    c->run_class = cls;
+    c->run_arg = k;
+    c->run_len = 1;
+}
+
+
+void seq_classify_slip( struct seq_classify *c, unsigned k, unsigned frames ) {
+    flush( c );
+    record( c, SEQ_CLASS_SLIP, frames );
+    HIST_INC( c->slip[k], 1 );
+}
+
+
+void seq_classify_null( struct seq_classify *c, const struct seq_info *seq ) {
+    flush( c );
+    if (seq->state == VALID_FRAME)
+        c->null_expected = seq->frame_num;
+    else if ((seq->state == INVALID_FRAME) && (seq->slot_ref != SEQ_SLOT_REF_NONE))
+        c->null_expected = (seq->slot_ref + 1) & seq->frame_num_mask;
+    else
+        c->null_expected = SEQ_SLOT_REF_NONE;
+}
+
+/* the expected mono frame is itself a null frame (S16 frames #0 and #0x7F8) */
+static int expected_null( const struct seq_info *seq, unsigned frame_num ) {
+    uint8_t sample[4];
+    unsigned i;
+
+    if (seq->channels != 1) return 0;
+    seq->kernel->put( sample, SEQ_SAMPLE( 0, frame_num, seq->frame_num_mask ) );
+    for (i = 0; i < seq->kernel->sample_bytes; i++) {
+        if ((sample[i] != 0x00) && (sample[i] != 0xFF)) return 0;
+    }
+    return 1;
+}
+
+void seq_classify_valid( struct seq_classify *c, const struct seq_info *seq, unsigned received ) {
+    const unsigned mask = seq->frame_num_mask;
+    const unsigned count = seq->frame_num;
+
+    flush( c );
+    if (seq->state == NULL_FRAME) {
+        unsigned expected = c->null_expected;
+        c->null_expected = SEQ_SLOT_REF_NONE;
+        if ((expected == SEQ_SLOT_REF_NONE) || (count == 0)) return;
+        if (received == expected) {
+            record( c, SEQ_CLASS_NULL_INSERT, count );
+            return;
+        }
+        if ((count == 1) && (received == ((expected + 1) & mask)) && expected_null( seq, expected ))
+            return;
+        record( c, SEQ_CLASS_NULL_GAP, count );
+        classify_jump( c, mask, (expected + count) & mask, received );
+    } else if ((seq->state == INVALID_FRAME) && (seq->slot_ref != SEQ_SLOT_REF_NONE)) {
+        /* the invalid frames replaced the expected ones */
+        classify_jump( c, mask, (seq->slot_ref + 1) & mask, received );
+    }
+}
+
+
+/* the 3 most frequent indexes of 'counts' */
+static void top3( const uint32_t *counts, unsigned n, const char *label, char *line, size_t size ) {
+    unsigned best[3] = { 0, 0, 0 }, i, j;
+    uint32_t v[3] = { 0, 0, 0 };
+    int pos = 0;
+
+    for (i = 0; i < n; i++) {
+        uint32_t x = __atomic_load_n( &counts[i], __ATOMIC_RELAXED );
+        for (j = 0; j < 3; j++) {
+            if (x > v[j]) {
+                memmove( &v[j+1], &v[j], (2 - j) * sizeof(v[0]) );
+                memmove( &best[j+1], &best[j], (2 - j) * sizeof(best[0]) );
+                v[j] = x;
+                best[j] = i;
+                break;
+            }
+        }
+    }
+    line[0] = '\0';
+    for (j = 0; (j < 3) && v[j]; j++)
+        pos += snprintf( line + pos, size - pos, " %s%u:%u", label, best[j], v[j] );
+}
+
+void seq_classify_report( struct seq_classify *c, const char *device, const char *name ) {
+    int cls, seen = 0;
+
+    if (!c) return;
+    for (cls = 0; cls < SEQ_CLASS_COUNT; cls++) {
+        uint64_t events = __atomic_load_n( &c->events[cls], __ATOMIC_RELAXED );
+        char extra[64] = "";
+        if (!events) continue;
+        seen = 1;
+        if (cls == SEQ_CLASS_ROTATION)
+            top3( c->rotation, SEQ_MAX_CHANNELS, "k=", extra, sizeof(extra) );
+        else if (cls == SEQ_CLASS_SLIP)
+            top3( c->slip, SEQ_MAX_CHANNELS, "k=", extra, sizeof(extra) );
+        else if (cls == SEQ_CLASS_BIT_FLIP)
+            top3( c->flip_channel, SEQ_MAX_CHANNELS, "ch", extra, sizeof(extra) );
+        printf("%s %s %-11s n=%llu frames=%llu len p50=%llu p99=%llu max=%llu%s\n",
+                device, name, class_names[cls], (unsigned long long)events,
+                (unsigned long long)__atomic_load_n( &c->frames[cls], __ATOMIC_RELAXED ),
+                (unsigned long long)hist_percentile( &c->len[cls], 50 ),
+                (unsigned long long)hist_percentile( &c->len[cls], 99 ),
+                (unsigned long long)__atomic_load_n( &c->len[cls].max, __ATOMIC_RELAXED ), extra);
+    }
+    if (!seen) printf("%s %s no anomaly\n", device, name);
+}
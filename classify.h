@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2015 Arnaud Mouiche <arnaud.mouiche@invoxia.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ */
+
+#ifndef __classify_h__
+#define __classify_h__
+
+#include <stdint.h>
+#include <alsa/asoundlib.h>
+
+#include "seq.h"
+#include "hist.h"
+
+/*
+ * online classification of the anomalies seen by the sequence checker.
+ *
+ * The checker calls the hooks below on its slow path only (state changes,
+ * counter jumps, invalid frames): the cost per anomaly is at most a couple of
+ * passes over the frame, nothing is added to the frames following the sequence.
+ * Each anomaly is counted in its class, with the histogram of its length in
+ * frames, so that a long run can be summarized without the logs.
+ */
+enum seq_class {
+    SEQ_CLASS_DROP,         /* N frames missing */
+    SEQ_CLASS_REPEAT,       /* N frames received again */
+    SEQ_CLASS_ROTATION,     /* N frames with the channels rotated by k slots within the frame */
+    SEQ_CLASS_SLIP,         /* N frames with the channels slipped by k slots (see seq_info.rotation) */
+    SEQ_CLASS_BIT_FLIP,     /* one bit of one sample inverted */
+    SEQ_CLASS_NULL_INSERT,  /* N null frames (0x00 or 0xFF) inserted, nothing lost */
+    SEQ_CLASS_NULL_GAP,     /* N frames replaced by null frames */
+    SEQ_CLASS_UNKNOWN,      /* N invalid frames not explained by the classes above */
+    SEQ_CLASS_COUNT,
+};
+
+/* "drop", "repeat", "rotation", "slip", "bit_flip", "null_insert", "null_gap", "unknown" */
+const char *seq_class_name( enum seq_class cls );
+
+struct seq_classify {
+    /* per class: number of anomalies, frames involved, and the length of each anomaly */
+    uint64_t events[ SEQ_CLASS_COUNT ];
+    uint64_t frames[ SEQ_CLASS_COUNT ];
+    struct hist len[ SEQ_CLASS_COUNT ];
+
+    /* rotations and slips per number of slots, and bit flips per channel */
+    uint32_t rotation[ SEQ_MAX_CHANNELS ];
+    uint32_t slip[ SEQ_MAX_CHANNELS ];
+    uint32_t flip_channel[ SEQ_MAX_CHANNELS ];
+
+    unsigned mask;              /* frame counter mask of the checker */
+
+    /* run of invalid frames of the same class in progress */
+    int run_class;              /* -1: none */
+    unsigned run_arg;
+    unsigned run_len;
+
+    /* counter expected at the first null frame of the current null run, or SEQ_SLOT_REF_NONE */
+    unsigned null_expected;
+
+    /*
+     * mono stream: jump from 'flip_expected' to 'flip_received' which is a bit flip
+     * if the jump back to the sequence follows. 'flip_recorded' if already known
+     * (the next frame was available), otherwise the class is decided by the next hook.
+     * flip_expected is SEQ_SLOT_REF_NONE if there is none
+     */
+    unsigned flip_expected;
+    unsigned flip_received;
+    int flip_recorded;
+};
+
+/*
+ * allocate the classifier of the checker 'seq' (released by seq_free()).
+ * return 0 on success, -1 if out of memory
+ */
+int seq_classify_attach( struct seq_info *seq );
+
+/* print the counters and length percentiles of every class seen. can be called from any thread */
+void seq_classify_report( struct seq_classify *c, const char *device, const char *name );
+
+
+/*
+ * checker hooks, called before the state change, with 'seq' still in the previous state
+ * and 'received' the counter of the frame.
+ */
+
+/*
+ * valid frame while expecting seq->frame_num. 'next' is the channel 0 sample of the
+ * next frame, or NULL at the end of the buffer
+ */
+void seq_classify_jump( struct seq_classify *c, const struct seq_info *seq, unsigned received, const uint8_t *next );
+/* invalid frame: the interleaved 'frame', or the frame #idx of 'planes' */
+void seq_classify_invalid( struct seq_classify *c, const struct seq_info *seq,
+        const uint8_t *frame, const uint8_t * const *planes, int idx );
+/* first null frame of a run */
+void seq_classify_null( struct seq_classify *c, const struct seq_info *seq );
+/* first valid frame after null or invalid frames */
+void seq_classify_valid( struct seq_classify *c, const struct seq_info *seq, unsigned received );
+/* end of a channel slip by 'k' slots, which lasted 'frames' frames */
+void seq_classify_slip( struct seq_classify *c, unsigned k, unsigned frames );
+/* stream interruption: nothing is an anomaly across it */
+void seq_classify_reset( struct seq_classify *c );
+
+#endif //__classify_h__
@@ -0,0 +1,140 @@
+/*
+ * Copyright (C) 2015 Arnaud Mouiche <arnaud.mouiche@invoxia.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "drift.h"
+
+/*
+ * the received frame numbers follow the captured frames exactly, but for the drift:
+ * anything larger is a slip, a restart of the producer...
+ */
+#define SEQ_TOLERANCE   2.
+
+
+void linreg_reset( struct linreg *r ) {
+    memset( r, 0, sizeof(*r) );
+}
+
+void linreg_add( struct linreg *r, double x, double y ) {
+    double dx;
+
+    if (r->n == 0) {
+        r->x0 = x;
+        r->y0 = y;
+    }
+    x -= r->x0;
+    y -= r->y0;
+
+    r->n++;
+    dx = x - r->mx;
+    r->mx += dx / r->n;
+    r->my += (y - r->my) / r->n;
+    r->m2x += dx * (x - r->mx);
+    r->cxy += dx * (y - r->my);
+}
+
+double linreg_slope( struct linreg *r ) {
+    return (r->m2x > 0) ? r->cxy / r->m2x : 0;
+}
+
+double linreg_predict( struct linreg *r, double x ) {
+    return r->y0 + r->my + linreg_slope( r ) * (x - r->x0 - r->mx);
+}
+
+
+/*
+ * add the point, or start a new regression if the point doesn't follow the
+ * current one by more than 'tolerance'
+ * return 1 if the regression was restarted
+ */
+static int linreg_add_checked( struct linreg *r, double x, double y, double tolerance ) {
+    int reset = 0;
+    if ((r->n >= 2) && (fabs( linreg_predict( r, x ) - y ) > tolerance)) {
+        linreg_reset( r );
+        reset = 1;
+    }
+    linreg_add( r, x, y );
+    return reset;
+}
+
+
+void drift_init( struct drift *d, struct pcm *pcm, unsigned rate, snd_pcm_uframes_t period ) {
+    memset( d, 0, sizeof(*d) );
+    d->nominal_rate = rate;
+    d->tolerance = period;
+    d->buffer_size = pcm->buffer_size;
+}
+
+
+static double timespec_s( const struct timespec *ts ) {
+    return ts->tv_sec + ts->tv_nsec * 1e-9;
+}
+
+void drift_rate_update( struct drift *d, struct pcm *pcm, snd_pcm_stream_t stream, unsigned long long transferred ) {
+    snd_pcm_uframes_t avail;
+    snd_htimestamp_t tstamp;
+    struct timespec now;
+    double position, t;
+
+    if (pcm_status( pcm, &avail, &tstamp ) < 0) return;
+
+    /* time of the last hw pointer update, when the backend has monotonic timestamps (see pcm_alsa.c) */
+    if (tstamp.tv_sec || tstamp.tv_nsec) {
+        t = timespec_s( &tstamp );
+    } else {
+        clock_gettime( CLOCK_MONOTONIC, &now );
+        t = timespec_s( &now );
+    }
+
+    /* frames already played, or already captured */
+    if (stream == SND_PCM_STREAM_PLAYBACK)
+        position = (double)transferred - (double)(d->buffer_size - avail);
+    else
+        position = (double)transferred + avail;
+
+    d->rate_resets += linreg_add_checked( &d->rate, t, position, d->tolerance );
+}
+
+
+void drift_seq_update( struct drift *d, unsigned long long captured, unsigned frame_num, unsigned frame_num_mask ) {
+    const long long modulo = (long long)frame_num_mask + 1;
+
+    if (d->seq.n == 0) {
+        d->seq_num = frame_num;
+    } else {
+        /* unwrap the frame number around its value predicted with a 1:1 ratio */
+        unsigned long long predicted = d->seq_num + (captured - d->seq_captured);
+        long long diff = (((long long)frame_num - (long long)(predicted % modulo)) % modulo + modulo) % modulo;
+        if (diff > modulo / 2) diff -= modulo;
+        d->seq_num = predicted + diff;
+    }
+    d->seq_captured = captured;
+
+    d->seq_resets += linreg_add_checked( &d->seq, captured, d->seq_num, SEQ_TOLERANCE );
+}
+
+
+void drift_report( struct drift *d, const char *device, const char *name ) {
+    if (d->rate.n >= 2) {
+        double rate = linreg_slope( &d->rate );
+        printf("%s %s rate: %.3f Hz (%+.1f ppm) over %.1fs, restarted %u times\n",
+                device, name, rate, (rate / d->nominal_rate - 1.) * 1e6,
+                (d->rate.mx * 2), d->rate_resets);
+    } else {
+        printf("%s %s rate: not measured\n", device, name);
+    }
+    if (d->seq.n >= 2) {
+        printf("%s %s drift vs producer: %+.1f ppm over %.0f frames, restarted %u times\n",
+                device, name, (linreg_slope( &d->seq ) - 1.) * 1e6, d->seq.mx * 2, d->seq_resets);
+    }
+}
@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2015 Arnaud Mouiche <arnaud.mouiche@invoxia.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ */
+
+#ifndef __drift_h__
+#define __drift_h__
+
+#include <alsa/asoundlib.h>
+
+#include "pcm.h"
+
+/*
+ * running linear regression y = a + slope * x, O(1) per point
+ * (Welford style update of the means and co-moments)
+ */
+struct linreg {
+    unsigned long long n;
+    double x0, y0;      /* first point, to keep the values small */
+    double mx, my;
+    double m2x, cxy;
+};
+
+void linreg_reset( struct linreg *r );
+void linreg_add( struct linreg *r, double x, double y );
+double linreg_slope( struct linreg *r );
+/* y predicted at 'x'. only valid if r->n >= 2 */
+double linreg_predict( struct linreg *r, double x );
+
+
+/*
+ * sample clock measurements of one stream.
+ *
+ * - rate: the hardware position (frames) against CLOCK_MONOTONIC, sampled once per
+ *   period with pcm_status(). The slope is the real sample rate.
+ * - seq (capture only): the unwrapped number of the received frames against the
+ *   captured frames. The slope is the producer sample clock relative to the capture one.
+ *
+ * A point too far from the regression line (xrun, restart...) starts a new measurement.
+ */
+struct drift {
+    unsigned nominal_rate;
+    snd_pcm_uframes_t buffer_size;
+    double tolerance;                   /* of the rate regression, in frames */
+
+    struct linreg rate;
+    unsigned rate_resets;
+
+    struct linreg seq;
+    unsigned seq_resets;
+    unsigned long long seq_num;         /* unwrapped frame number */
+    unsigned long long seq_captured;    /* captured frames at the last point */
+};
+
+/* 'period' is used as the tolerance of the rate regression */
+void drift_init( struct drift *d, struct pcm *pcm, unsigned rate, snd_pcm_uframes_t period );
+
+/*
+ * add a point of the hw position to the rate regression.
+ * 'transferred' is the number of frames written (playback) or read (capture) since the start
+ */
+void drift_rate_update( struct drift *d, struct pcm *pcm, snd_pcm_stream_t stream, unsigned long long transferred );
+
+/*
+ * add a point to the producer/consumer regression, after a period ending with valid frames.
+ * 'captured' frames were read so far, and 'frame_num' is the next expected frame number.
+ */
+void drift_seq_update( struct drift *d, unsigned long long captured, unsigned frame_num, unsigned frame_num_mask );
+
+void drift_report( struct drift *d, const char *device, const char *name );
+
+#endif //__drift_h__
@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2015 Arnaud Mouiche <arnaud.mouiche@invoxia.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ */
+
+#include <stdio.h>
+
+#include "hist.h"
+
+
+/* highest value of the bucket */
+static uint64_t hist_bucket_max( unsigned b ) {
+    int shift;
+    if (b < (2 << HIST_SUB_BITS)) return b;
+    shift = (b >> HIST_SUB_BITS) - 1;
+    return ((uint64_t)(b - (shift << HIST_SUB_BITS) + 1) << shift) - 1;
+}
+
+
+uint64_t hist_percentile( struct hist *h, double p ) {
+    uint64_t total = __atomic_load_n( &h->total, __ATOMIC_RELAXED );
+    uint64_t max = __atomic_load_n( &h->max, __ATOMIC_RELAXED );
+    uint64_t rank, seen = 0;
+    unsigned b;
+
+    if (total == 0) return 0;
+    rank = (uint64_t)(p / 100. * total + 0.5);
+    if (rank == 0) rank = 1;
+
+    for (b = 0; b < HIST_BUCKETS; b++) {
+        seen += __atomic_load_n( &h->count[b], __ATOMIC_RELAXED );
+        if (seen >= rank) {
+            uint64_t v = hist_bucket_max( b );
+            return (v < max) ? v : max;
+        }
+    }
+    return max;
+}
+
+
+static void hist_report( struct hist *h, const char *device, const char *name, const char *what ) {
+    printf("%s %s %-6s n=%llu p50=%.1fus p99=%.1fus p99.9=%.1fus max=%.1fus\n",
+            device, name, what,
+            (unsigned long long)__atomic_load_n( &h->total, __ATOMIC_RELAXED ),
+            hist_percentile( h, 50 ) * 1e-3,
+            hist_percentile( h, 99 ) * 1e-3,
+            hist_percentile( h, 99.9 ) * 1e-3,
+            __atomic_load_n( &h->max, __ATOMIC_RELAXED ) * 1e-3);
+}
+
+void period_stats_report( struct period_stats *ps, const char *device, const char *name ) {
+    hist_report( &ps->wakeup, device, name, "wakeup" );
+    hist_report( &ps->io, device, name, "io" );
+    hist_report( &ps->seq, device, name, "seq" );
+}
@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2015 Arnaud Mouiche <arnaud.mouiche@invoxia.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ */
+
+#ifndef __hist_h__
+#define __hist_h__
+
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * log-linear histogram of durations in ns.
+ * values below 2^(HIST_SUB_BITS+1) have their own bucket. Above, every power of 2
+ * is split in 2^HIST_SUB_BITS buckets: the relative error is below 1/2^HIST_SUB_BITS.
+ *
+ * a histogram has a single writer (the test thread), but can be read at any time
+ * from another thread.
+ */
+#define HIST_SUB_BITS   4
+#define HIST_BUCKETS    ((64 - HIST_SUB_BITS + 1) << HIST_SUB_BITS)
+
+struct hist {
+    uint32_t count[ HIST_BUCKETS ];
+    uint64_t total;
+    uint64_t max;
+};
+
+static inline unsigned hist_bucket( uint64_t v ) {
+    int shift = (v >> (HIST_SUB_BITS+1)) ? (63 - __builtin_clzll( v )) - HIST_SUB_BITS : 0;
+    return (shift << HIST_SUB_BITS) + (unsigned)(v >> shift);
+}
+
+/* a plain load/store is enough with a single writer, and keeps the readers race free */
+#define HIST_INC( var, v ) __atomic_store_n( &(var), __atomic_load_n( &(var), __ATOMIC_RELAXED ) + (v), __ATOMIC_RELAXED )
+
+static inline void hist_record( struct hist *h, uint64_t v ) {
+    HIST_INC( h->count[ hist_bucket( v ) ], 1 );
+    HIST_INC( h->total, 1 );
+    if (v > __atomic_load_n( &h->max, __ATOMIC_RELAXED ))
+        __atomic_store_n( &h->max, v, __ATOMIC_RELAXED );
+}
+
+/*
+ * return the value below which 'p' percent of the recorded values are
+ * (upper bound of the bucket, 0 if the histogram is empty)
+ */
+uint64_t hist_percentile( struct hist *h, double p );
+
+
+static inline uint64_t hist_now_ns( void ) {
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+
+/*
+ * what happens during every period of a stream
+ */
+struct period_stats {
+    /* how late the io job wakes up after the period boundary */
+    struct hist wakeup;
+
+    /* time spent transferring the period (snd_pcm_writei/readi, mmap begin/commit) */
+    struct hist io;
+
+    /* time spent generating or checking the sequence */
+    struct hist seq;
+
+    /* seq time of the period in progress (the mmap jobs are called within the transfer) */
+    uint64_t seq_ns;
+};
+
+/*
+ * account a period transferred in 'total_ns', including ps->seq_ns spent in the sequence
+ * and reset ps->seq_ns
+ */
+static inline void period_stats_record( struct period_stats *ps, uint64_t total_ns ) {
+    hist_record( &ps->seq, ps->seq_ns );
+    hist_record( &ps->io, (total_ns > ps->seq_ns) ? total_ns - ps->seq_ns : 0 );
+    ps->seq_ns = 0;
+}
+
+/* print p50/p99/p99.9/max of every histogram */
+void period_stats_report( struct period_stats *ps, const char *device, const char *name );
+
+#endif //__hist_h__
@@ -0,0 +1,239 @@
+/*
+ * Copyright (C) 2015 Arnaud Mouiche <arnaud.mouiche@invoxia.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ */
+
+/*
+ * Asynchronous logging.
+ *
+ * The messages are formatted by the producers directly in the slots of a bounded
+ * multi producers / single consumer ring (Vyukov's bounded queue):
+ * - every slot holds a sequence number. A slot at ring position 'pos' is free for
+ *   the producers when its sequence is 'pos', and ready for the consumer when
+ *   its sequence is 'pos + 1'.
+ * - a producer reserves a position with a CAS on 'head', formats its message and
+ *   publishes it by setting the slot sequence.
+ * - the flush thread takes the ready slots in order, writes them on stdout and
+ *   releases them for the next round by setting their sequence to 'pos + LOG_SLOTS'.
+ * Nothing blocks on the producer side: when the ring is full, the message is dropped
+ * and counted.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "log.h"
+
+#define LOG_SLOTS       1024        /* power of 2 */
+#define LOG_MSG_SIZE    256
+
+/* flush thread polling period */
+#define LOG_FLUSH_PERIOD_NS (10 * 1000 * 1000)
+
+struct log_slot {
+    unsigned seq;
+    char msg[ LOG_MSG_SIZE ];
+};
+
+static struct log_slot *ring = NULL;
+static unsigned head = 0;       /* next position reserved by a producer */
+static unsigned tail = 0;       /* next position written by the flush thread */
+static unsigned dropped = 0;
+static unsigned dropped_reported = 0;
+
+static int async = 0;
+static int running = 0;
+static pthread_t flush_thread;
+
+static unsigned levels_enabled = (1 << LOG_WARN) | (1 << LOG_ERR) | (1 << LOG_DBG);
+
+
+void log_level_enable( enum log_level level, int enable ) {
+    if (enable)
+        __atomic_or_fetch( &levels_enabled, 1u << level, __ATOMIC_RELAXED );
+    else
+        __atomic_and_fetch( &levels_enabled, ~(1u << level), __ATOMIC_RELAXED );
+}
+
+int log_level_enabled( enum log_level level ) {
+    return (__atomic_load_n( &levels_enabled, __ATOMIC_RELAXED ) >> level) & 1;
+}
+
+int log_levels_parse( const char *levels ) {
+    unsigned mask = 0;
+    const char *p = levels;
+
+    while (*p) {
+        size_t l = strcspn( p, "," );
+        if ((l == 3) && !strncmp( p, "err", l ))
+            mask |= 1 << LOG_ERR;
+        else if ((l == 4) && !strncmp( p, "warn", l ))
+            mask |= 1 << LOG_WARN;
+        else if ((l == 3) && !strncmp( p, "dbg", l ))
+            mask |= 1 << LOG_DBG;
+        else if (l)
+            return -1;
+        p += l;
+        if (*p == ',') p++;
+    }
+    __atomic_store_n( &levels_enabled, mask, __ATOMIC_RELAXED );
+    return 0;
+}
+
+
+unsigned log_dropped( void ) {
+    return __atomic_load_n( &dropped, __ATOMIC_RELAXED );
+}
+
+
+void log_printf( enum log_level level, const char *format, ... ) {
+    struct log_slot *slot;
+    unsigned pos;
+    va_list ap;
+
+    if (!log_level_enabled( level )) return;
+
+    va_start( ap, format );
+    if (!__atomic_load_n( &async, __ATOMIC_ACQUIRE )) {
+        vprintf( format, ap );
+        va_end( ap );
+        return;
+    }
+
+    /* reserve a slot */
+    pos = __atomic_load_n( &head, __ATOMIC_RELAXED );
+    while (1) {
+        int dif;
+        slot = &ring[ pos & (LOG_SLOTS-1) ];
+        dif = (int)(__atomic_load_n( &slot->seq, __ATOMIC_ACQUIRE ) - pos);
+        if (dif == 0) {
+            if (__atomic_compare_exchange_n( &head, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED ))
+                break;
+        } else if (dif < 0) {
+            /* the ring is full */
+            __atomic_add_fetch( &dropped, 1, __ATOMIC_RELAXED );
+            va_end( ap );
+            return;
+        } else {
+            pos = __atomic_load_n( &head, __ATOMIC_RELAXED );
+        }
+    }
+
+    if (vsnprintf( slot->msg, LOG_MSG_SIZE, format, ap ) >= LOG_MSG_SIZE)
+        slot->msg[ LOG_MSG_SIZE-2 ] = '\n';     /* truncated */
+    va_end( ap );
+
+    /* publish */
+    __atomic_store_n( &slot->seq, pos + 1, __ATOMIC_RELEASE );
+}
+
+
+/*
+ * write every ready message
+ * return the number of messages written
+ */
+static int log_flush( void ) {
+    unsigned d;
+    int count = 0;
+
+    while (1) {
+        struct log_slot *slot = &ring[ tail & (LOG_SLOTS-1) ];
+        if (__atomic_load_n( &slot->seq, __ATOMIC_ACQUIRE ) != tail + 1) break;
+        fputs( slot->msg, stdout );
+        __atomic_store_n( &slot->seq, tail + LOG_SLOTS, __ATOMIC_RELEASE );
+        tail++;
+        count++;
+    }
+
+    d = log_dropped();
+    if (d != dropped_reported) {
+        printf("warn: %u log messages dropped\n", d - dropped_reported);
+        dropped_reported = d;
+        count++;
+    }
+    if (count) fflush( stdout );
+    return count;
+}
+
+static void *log_flush_thread( void *arg ) {
+    const struct timespec period = { 0, LOG_FLUSH_PERIOD_NS };
+
+    while (__atomic_load_n( &running, __ATOMIC_ACQUIRE )) {
+        if (!log_flush())
+            nanosleep( &period, NULL );
+    }
+    return NULL;
+}
+
+
+int log_async_start( void ) {
+    pthread_attr_t attr;
+    struct sched_param param = { .sched_priority = 0 };
+    unsigned i;
+    int r;
+
+    static int atexit_registered = 0;
+
+    if (async) return 0;
+
+    ring = malloc( LOG_SLOTS * sizeof(*ring) );
+    if (!ring) {
+        err("log_async_start: out of memory");
+        return -1;
+    }
+    for (i = 0; i < LOG_SLOTS; i++)
+        ring[i].seq = i;
+    head = tail = 0;
+    fflush( stdout );
+
+    /* the flush thread never inherits the real time priority of the caller */
+    pthread_attr_init( &attr );
+    pthread_attr_setinheritsched( &attr, PTHREAD_EXPLICIT_SCHED );
+    pthread_attr_setschedpolicy( &attr, SCHED_OTHER );
+    pthread_attr_setschedparam( &attr, &param );
+
+    running = 1;
+    r = pthread_create( &flush_thread, &attr, log_flush_thread, NULL );
+    pthread_attr_destroy( &attr );
+    if (r) {
+        running = 0;
+        free( ring );
+        ring = NULL;
+        err("log_async_start: can't create the flush thread: %s", strerror(r));
+        return -1;
+    }
+    __atomic_store_n( &async, 1, __ATOMIC_RELEASE );
+
+    /* don't lose the last messages on exit() */
+    if (!atexit_registered) {
+        atexit( log_async_stop );
+        atexit_registered = 1;
+    }
+    return 0;
+}
+
+
+void log_async_stop( void ) {
+    if (!async) return;
+
+    /* from now on, the messages are printed directly */
+    __atomic_store_n( &async, 0, __ATOMIC_RELEASE );
+    __atomic_store_n( &running, 0, __ATOMIC_RELEASE );
+    pthread_join( flush_thread, NULL );
+
+    /* messages reserved before the switch may still be in progress: wait for them */
+    while (tail != __atomic_load_n( &head, __ATOMIC_ACQUIRE )) {
+        if (!log_flush()) sched_yield();
+    }
+    log_flush();
+    /* the ring is not released: a late producer could still be using it */
+}
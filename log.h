@@ -1,14 +1,55 @@
+/*
+ * Copyright (C) 2015 Arnaud Mouiche <arnaud.mouiche@invoxia.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ */
 
-
+#ifndef __log_h__
+#define __log_h__
 
 enum log_level {
     LOG_WARN,
-    LOG_ERR
+    LOG_ERR,
+    LOG_DBG,
 };
 
 
-#define warn(format, arg...) printf( "warn: " format "\n", ##arg )
-#define err(format, arg...)  printf( "err: " format "\n", ##arg )
-#define dbg(format, arg...)  printf( "dbg: " format "\n", ##arg )
+#define warn(format, arg...) log_printf( LOG_WARN, "warn: " format "\n", ##arg )
+#define err(format, arg...)  log_printf( LOG_ERR, "err: " format "\n", ##arg )
+#define dbg(format, arg...)  log_printf( LOG_DBG, "dbg: " format "\n", ##arg )
+
+#define log(level, format, arg...)  log_printf( level, "%s: " format "\n", level == LOG_ERR ? "err" : "warn", ##arg )
+
+
+/*
+ * print a message if its level is enabled.
+ * once log_async_start() is called, the message is only formatted in a preallocated
+ * lock-free ring, and written to stdout later by a low priority thread: logging never
+ * blocks the real time threads. When the ring is full, the message is dropped.
+ */
+void log_printf( enum log_level level, const char *format, ... ) __attribute__((format(printf, 2, 3)));
+
+/* runtime filtering. every level is enabled by default */
+void log_level_enable( enum log_level level, int enable );
+int log_level_enabled( enum log_level level );
+
+/*
+ * enable only the levels of the comma separated list 'levels' ("err,warn,dbg")
+ * return 0 on success, -1 if a level is unknown
+ */
+int log_levels_parse( const char *levels );
+
+/*
+ * start / stop the asynchronous logging.
+ * log_async_stop() writes the pending messages before returning.
+ */
+int log_async_start( void );
+void log_async_stop( void );
+
+/* number of messages dropped because the ring was full */
+unsigned log_dropped( void );
 
-#define log(level, format, arg...)  printf( "%s: " format "\n", level == LOG_ERR ? "err" : "warn", ##arg )
+#endif //__log_h__
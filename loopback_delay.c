@@ -7,44 +7,141 @@
  *  (at your option) any later version.
  */
 
+#include <math.h>
+
 #include "loopback_delay.h"
 #include "log.h"
 
 
-static int loopback_delay_start(struct test *t) {
-    struct test_loopback_delay *tp = (struct test_loopback_delay *)t;
+static void loopback_delay_mmap_fill( void *data, void * const *planes, snd_pcm_uframes_t count ) {
+    struct test_loopback_delay *tp = (struct test_loopback_delay *)data;
+    uint64_t t0 = hist_now_ns();
+    if (alsa_access_is_planar( tp->t.config.access ))
+        seq_fill_frames_planar( &tp->seq_p, planes, count );
+    else
+        seq_fill_frames( &tp->seq_p, planes[0], count );
+    tp->stats_p.seq_ns += hist_now_ns() - t0;
+    if (tp->bb)
+        blackbox_playback( tp->bb, (const void * const *)planes, count, alsa_access_is_planar( tp->t.config.access ) );
+}
+
+static void loopback_delay_mmap_check( void *data, void * const *planes, snd_pcm_uframes_t count ) {
+    struct test_loopback_delay *tp = (struct test_loopback_delay *)data;
+    uint64_t t0 = hist_now_ns();
+    if (alsa_access_is_planar( tp->t.config.access ))
+        seq_check_frames_planar( &tp->seq_c, (const void * const *)planes, count );
+    else
+        seq_check_frames( &tp->seq_c, planes[0], count );
+    tp->stats_c.seq_ns += hist_now_ns() - t0;
+    if (tp->bb)
+        blackbox_capture( tp->bb, (const void * const *)planes, count, alsa_access_is_planar( tp->t.config.access ),
+                tp->seq_c.error_count );
+}
+
+/*
+ * queue one period of the sequence on the playback side.
+ * in RW access, 'refill' set to 0 writes the previous period again (after an xrun)
+ *
+ * return the number of frames written or a negative error code
+ */
+static snd_pcm_sframes_t loopback_delay_write_period( struct test_loopback_delay *tp, int refill ) {
+    uint64_t t0 = hist_now_ns();
+    snd_pcm_sframes_t frames;
+
+    if (alsa_access_is_mmap( tp->t.config.access )) {
+        frames = pcm_mmap_transfer( tp->pcm_p, tp->t.config.period, loopback_delay_mmap_fill, tp );
+    } else {
+        if (refill) {
+            if (tp->period_planes)
+                seq_fill_frames_planar( &tp->seq_p, tp->period_planes, tp->t.config.period );
+            else
+                seq_fill_frames( &tp->seq_p, tp->periof_buff, tp->t.config.period );
+            tp->stats_p.seq_ns = hist_now_ns() - t0;
+            if (tp->bb)
+                blackbox_playback( tp->bb, tp->period_planes ? (const void * const *)tp->period_planes :
+                        (const void * const *)&tp->periof_buff, tp->t.config.period, tp->period_planes != NULL );
+        }
+        if (tp->period_planes)
+            frames = pcm_writen(tp->pcm_p, tp->period_planes, tp->t.config.period);
+        else
+            frames = pcm_writei(tp->pcm_p, tp->periof_buff, tp->t.config.period);
+    }
+    period_stats_record( &tp->stats_p, hist_now_ns() - t0 );
+    if (frames > 0) {
+        tp->written_frames += frames;
+        drift_rate_update( &tp->drift_p, tp->pcm_p, SND_PCM_STREAM_PLAYBACK, tp->written_frames );
+    }
+    return frames;
+}
+
+/*
+ * read and check one period of frames on the capture side
+ *
+ * return the number of frames read or a negative error code
+ */
+static snd_pcm_sframes_t loopback_delay_read_period( struct test_loopback_delay *tp ) {
+    uint64_t t0 = hist_now_ns(), t1;
+    snd_pcm_sframes_t frames;
+
+    if (alsa_access_is_mmap( tp->t.config.access )) {
+        frames = pcm_mmap_transfer( tp->pcm_c, tp->t.config.period, loopback_delay_mmap_check, tp );
+    } else {
+        if (tp->period_planes)
+            frames = pcm_readn(tp->pcm_c, tp->period_planes, tp->t.config.period);
+        else
+            frames = pcm_readi(tp->pcm_c, tp->periof_buff, tp->t.config.period);
+        if (frames == tp->t.config.period) {
+            /* check the sequence */
+            t1 = hist_now_ns();
+            if (tp->period_planes)
+                seq_check_frames_planar( &tp->seq_c, (const void * const *)tp->period_planes, tp->t.config.period );
+            else
+                seq_check_frames( &tp->seq_c, tp->periof_buff, tp->t.config.period );
+            tp->stats_c.seq_ns = hist_now_ns() - t1;
+            if (tp->bb)
+                blackbox_capture( tp->bb, tp->period_planes ? (const void * const *)tp->period_planes :
+                        (const void * const *)&tp->periof_buff, tp->t.config.period, tp->period_planes != NULL,
+                        tp->seq_c.error_count );
+        }
+    }
+    period_stats_record( &tp->stats_c, hist_now_ns() - t0 );
+    return frames;
+}
+
+
+/*
+ * prepare both streams and start them in the order of opts.start_sync_mode
+ *
+ * return 0 or a negative error code
+ */
+static int loopback_delay_start_streams( struct test_loopback_delay *tp ) {
     int r;
-    dbg("%s: loopback_delay_start", tp->t.device);
 
     /* first, prepare both streams at once */
-    tp->delay_detected = 0;
-    tp->measured_delay = 0;
-    tp->exit_status = 1; /* consider the test as failed until the first valid frame is received */
-    r = snd_pcm_prepare(tp->pcm_c);
+    r = pcm_prepare(tp->pcm_c);
     if (r < 0) {
         warn("%s: loopback_delay capture prepare failed: %s", tp->t.device, snd_strerror(r));
     }
-    r = snd_pcm_prepare(tp->pcm_p);
+    r = pcm_prepare(tp->pcm_p);
     if (r < 0) {
         warn("%s: loopback_delay playback prepare failed: %s", tp->t.device, snd_strerror(r));
     }
 
-    seq_fill_frames( &tp->seq_p, tp->periof_buff, tp->t.config.period );
     switch (tp->opts.start_sync_mode) {
     case LSM_PREPARE_CAPTURE_PLAYBACK:
         /* start the capture explicitly */
         dbg("start capture");
-        r = snd_pcm_start( tp->pcm_c );
+        r = pcm_start( tp->pcm_c );
         if (r < 0) {
             warn("%s: loopback_delay start capture failed: %s", tp->t.device, snd_strerror(r));
-            return -1;
+            return r;
         }
         /* playback is start by writing the first period */
         dbg("start playback");
-        snd_pcm_sframes_t frames = snd_pcm_writei(tp->pcm_p, tp->periof_buff, tp->t.config.period);
+        snd_pcm_sframes_t frames = loopback_delay_write_period( tp, 1 );
         if (frames < 0) {
-            warn("%s: loopback_delay start playback failed: %s", tp->t.device, snd_strerror(r));
-            return -1;
+            warn("%s: loopback_delay start playback failed: %s", tp->t.device, snd_strerror(frames));
+            return frames;
         }
         break;
 
@@ -61,17 +158,17 @@ static int loopback_delay_start(struct test *t) {
          */
         /* playback is start by writing the first period */
         dbg("start playback");
-        snd_pcm_sframes_t frames = snd_pcm_writei(tp->pcm_p, tp->periof_buff, tp->t.config.period);
+        snd_pcm_sframes_t frames = loopback_delay_write_period( tp, 1 );
         if (frames < 0) {
-            warn("%s: loopback_delay start playback failed: %s", tp->t.device, snd_strerror(r));
-            return -1;
+            warn("%s: loopback_delay start playback failed: %s", tp->t.device, snd_strerror(frames));
+            return frames;
         }
         dbg("start capture");
-        r = snd_pcm_start( tp->pcm_c );
+        r = pcm_start( tp->pcm_c );
         if (r < 0) {
             if (tp->opts.start_sync_mode == LSM_PREPARE_PLAYBACK_CAPTURE) {
                 warn("%s: loopback_delay start capture failed: %s", tp->t.device, snd_strerror(r));
-                return -1;
+                return r;
             } else {
                 dbg("%s: loopback_delay start capture returns reason '%s' as expected",
                         tp->t.device, snd_strerror(r));
@@ -79,13 +176,53 @@ static int loopback_delay_start(struct test *t) {
         }
     } break;
     }
+    return 0;
+}
+
 
-    ev_io_start( loop, &tp->io_watcher_p );
-    ev_io_start( loop, &tp->io_watcher_c );
+static int loopback_delay_start(struct test *t) {
+    struct test_loopback_delay *tp = (struct test_loopback_delay *)t;
+    dbg("%s: loopback_delay_start", tp->t.device);
+
+    tp->delay_detected = 0;
+    tp->measured_delay = 0;
+    tp->delay_rebase = 0;
+    tp->exit_status = 1; /* consider the test as failed until the first valid frame is received */
+    tp->captured_frames = 0;
+    tp->start_ns = hist_now_ns();
+    if (loopback_delay_start_streams( tp ) < 0)
+        return -1;
+
+    ev_io_start( tp->t.loop, &tp->io_watcher_p );
+    ev_io_start( tp->t.loop, &tp->io_watcher_c );
+
+    tp->inject_capture = 1; /* LDI_BOTH: the first event is on the playback */
+    if (tp->opts.xrun) {
+        dbg("%s: will simulate xrun every %d ms", tp->t.device, tp->opts.xrun);
+        tp->timer_state = LDT_W4_XRUN;
+        ev_timer_set( &tp->timer, tp->opts.xrun * 1e-3, 0);
+        ev_timer_start( tp->t.loop, &tp->timer );
+    } else if (tp->opts.restart_play_time && tp->opts.restart_pause_time) {
+        dbg("%s: will stop every %d ms during %d ms", tp->t.device, tp->opts.restart_play_time, tp->opts.restart_pause_time);
+        tp->timer_state = LDT_W4_STOP;
+        ev_timer_set( &tp->timer, tp->opts.restart_play_time * 1e-3, 0);
+        ev_timer_start( tp->t.loop, &tp->timer );
+    }
     return 0;
 }
 
 
+/*
+ * a stream was just recovered: time it until the first valid frame captured, and
+ * keep the delay it had before
+ */
+static void loopback_delay_recovered( struct test_loopback_delay *tp ) {
+    if (!tp->recovery.recovered_ns)
+        tp->delay_before = tp->measured_delay;
+    recovery_start( &tp->recovery );
+}
+
+
 
 
 /*
@@ -94,10 +231,12 @@ static int loopback_delay_start(struct test *t) {
 static void loopback_delay_play_job( struct ev_loop *loop, struct ev_io *w, int revents ) {
 
     struct test_loopback_delay *tp = (struct test_loopback_delay *)(w->data);
+    snd_pcm_sframes_t frames;
+
+    test_wakeup_record( &tp->t, tp->pcm_p, &tp->stats_p.wakeup );
 
     /* simply fill a first period */
-    seq_fill_frames( &tp->seq_p, tp->periof_buff, tp->t.config.period );
-    snd_pcm_sframes_t frames = snd_pcm_writei(tp->pcm_p, tp->periof_buff, tp->t.config.period);
+    frames = loopback_delay_write_period( tp, 1 );
 
     if (frames < 0) {
         warn("%s: loopback_delay write failed: %s", tp->t.device, snd_strerror(frames));
@@ -106,15 +245,19 @@ static void loopback_delay_play_job( struct ev_loop *loop, struct ev_io *w, int
             ev_unloop(loop, EVUNLOOP_ALL);
             return;
         }
-        snd_pcm_recover(tp->pcm_p, frames, 0);
+        test_xrun( &tp->t );
+        pcm_recover( tp->pcm_p, frames );
 
         /* write again the period to start the stream again */
-        frames = snd_pcm_writei(tp->pcm_p, tp->periof_buff, tp->t.config.period);
+        frames = loopback_delay_write_period( tp, 0 );
         if (frames < 0) {
             err("%s: loopback_delay write failed after recover: %s", tp->t.device, snd_strerror(frames));
             ev_unloop(loop, EVUNLOOP_ALL);
             return;
         }
+        /* the playback position starts again */
+        tp->delay_rebase = 1;
+        loopback_delay_recovered( tp );
     } else if (frames != tp->t.config.period) {
         err("%s: loopback_delay write less than the expected period size: %ld / %u", tp->t.device, frames, tp->t.config.period);
 
@@ -123,134 +266,274 @@ static void loopback_delay_play_job( struct ev_loop *loop, struct ev_io *w, int
 }
 
 
+/*
+ * measure the delay after a period ending with valid frames.
+ *
+ * tp->seq_c.frame_num (A) holds the expected number of the first frame we will receive
+ * in the next period, and tp->captured_frames (C) the position of this next frame.
+ * The frame #A was sent at the playback position A, so the delay is C - A.
+ *
+ * in a zero delay scenario, the first period sent in playback is equal to the
+ * first period received. Since the first frame of the first period has number #0
+ * the first of the second period will be #period_size, equal to C.
+ *
+ * if the period is late, A < C.
+ * For example, in case of a "period_size-1" delay, we have A=1 since only the frame #0
+ * will be receive at the end of the first period
+ *
+ * A wraps after frame_num_mask: the delay kept is the closest one to the previous delay.
+ */
+static void loopback_delay_update( struct test_loopback_delay *tp ) {
+    const long long modulo = tp->seq_c.frame_num_mask + 1;
+    long long delay = (long long)tp->captured_frames - tp->seq_c.frame_num;
+    double t = (hist_now_ns() - tp->start_ns) * 1e-9;
+
+    if (!tp->delay_detected) {
+        dbg("tp->seq_c.frame_num: %d", tp->seq_c.frame_num);
+        tp->delay_rebase = 0;
+        tp->measured_delay = delay;
+        tp->delay_detected = 1;
+        warn("measured_delay: %d", tp->measured_delay);
+        if (tp->opts.assert_delay) {
+            if (tp->measured_delay != tp->opts.expected_delay) {
+                err("assert: delay %d doesn't match the expected one %d", tp->measured_delay, tp->opts.expected_delay);
+                tp->exit_status = 1;
+            } else {
+                warn("good loopback delay");
+                tp->exit_status = 0;
+            }
+        } else {
+            tp->exit_status = 0;
+        }
+    } else {
+        long long diff = ((delay - tp->measured_delay) % modulo + modulo) % modulo;
+        if (diff > modulo / 2) diff -= modulo;
+        delay = tp->measured_delay + diff;
+
+        if (tp->delay_rebase) {
+            /*
+             * a stream position was lost or restarted: a new measure, not a change of the
+             * loopback. It is off by the frames not played or captured meanwhile, so it
+             * isn't compared with the expected delay either
+             */
+            tp->delay_rebase = 0;
+            warn("%s: loopback delay measured again: %lld frames at %.3fs", tp->t.device, delay, t);
+            tp->measured_delay = delay;
+        } else if (delay != tp->measured_delay) {
+            tp->delay_changes++;
+            warn("%s: loopback delay changed from %d to %lld frames at %.3fs",
+                    tp->t.device, tp->measured_delay, delay, t);
+            if (tp->opts.assert_delay && (delay != tp->opts.expected_delay)) {
+                err("assert: delay %lld doesn't match the expected one %d", delay, tp->opts.expected_delay);
+                tp->exit_status = 1;
+            }
+            tp->measured_delay = delay;
+        }
+    }
+
+    /* running min/max/mean/variance */
+    if (tp->delay_stats.n == 0) {
+        tp->delay_stats.min = tp->delay_stats.max = delay;
+    } else {
+        if (delay < tp->delay_stats.min) tp->delay_stats.min = delay;
+        if (delay > tp->delay_stats.max) tp->delay_stats.max = delay;
+    }
+    tp->delay_stats.n++;
+    double d = delay - tp->delay_stats.mean;
+    tp->delay_stats.mean += d / tp->delay_stats.n;
+    tp->delay_stats.m2 += d * (delay - tp->delay_stats.mean);
+
+    if (tp->delay_series)
+        fprintf( tp->delay_series, "%.6f %lld\n", t, delay );
+}
+
+
 static void loopback_delay_capture_job( struct ev_loop *loop, struct ev_io *w, int revents ) {
 
     struct test_loopback_delay *tp = (struct test_loopback_delay *)(w->data);
     snd_pcm_sframes_t frames;
+    uint64_t latency;
 
-    frames = snd_pcm_readi(tp->pcm_c, tp->periof_buff, tp->t.config.period);
+    test_wakeup_record( &tp->t, tp->pcm_c, &tp->stats_c.wakeup );
+
+    frames = loopback_delay_read_period( tp );
     if (frames < 0) {
+        struct pcm_position before, after;
+        long lost = -1;
+        int known;
         int r;
+        if (frames == -ENODATA) {
+            dbg("%s: end of file", tp->t.device);
+            ev_unloop(loop, EVUNLOOP_ALL);
+            return;
+        }
         warn("%s: loopback_delay read failed: %s", tp->t.device, snd_strerror(frames));
         if (frames == -EBADFD) {
             err("unrecoverable alsa error");
             ev_unloop(loop, EVUNLOOP_ALL);
             return;
         }
-        r = snd_pcm_recover(tp->pcm_c, frames, 0);
+        test_xrun( &tp->t );
+        /* the positions around the recovery tell how many frames are lost */
+        known = !pcm_get_position( tp->pcm_c, &before );
+        r = pcm_recover( tp->pcm_c, frames );
         if (r < 0) {
             err("%s: loopback_delay recover failed: %s", tp->t.device, snd_strerror(frames));
         }
-        r = snd_pcm_start( tp->pcm_c );
+        r = pcm_start( tp->pcm_c );
         if (r < 0) {
             warn("%s: loopback_delay start failed after recover: %s", tp->t.device, snd_strerror(r));
             ev_unloop(loop, EVUNLOOP_ALL);
             return;
         }
-        seq_check_jump_notify( &tp->seq_c );
+        if (known && !pcm_get_position( tp->pcm_c, &after ))
+            lost = pcm_frames_lost( tp->pcm_c, &before, &after );
+        if (lost >= 0) {
+            /* the lost frames still count in the capture position: the delay is kept */
+            tp->captured_frames += lost;
+            seq_check_resync( &tp->seq_c, lost, tp->t.config.period );
+        } else {
+            seq_check_jump_notify( &tp->seq_c );
+            tp->delay_rebase = 1;
+        }
+        loopback_delay_recovered( tp );
 
     } else if (frames != tp->t.config.period) {
         err("%s: loopback_delay read less than the expected period size: %ld / %u", tp->t.device, frames, tp->t.config.period);
 
     } else {
-        /* check the sequence */
-        seq_check_frames( &tp->seq_c, tp->periof_buff, tp->t.config.period );
-        if (!tp->delay_detected) {
-            switch (tp->seq_c.state) {
-            case NULL_FRAME:
-                /* we received a full NULL frame. add period_size to the measured delay */
-                tp->measured_delay += tp->t.config.period;
-                break;
-            case VALID_FRAME:
-                /*
-                 * this is the first period with valid frames received.
-                 * seq_check_frames has been done and tp->seq_c.frame_num (A) now hold the
-                 * expected number of the first frame we will receive in the future period.
-                 *
-                 * in a zero delay scenario, the first period sent in playback is equal to the
-                 * first period received. Since the first frame of the first period has number #0
-                 * the first of the second period will be #period_size, equal to (A)
-                 *
-                 * if the period is late, A < #period_size.
-                 * For example, in case of a "period_size-1" delay, we have A=1 since only the frame #0
-                 * will be receive at the end of the first period
-                 */
-                dbg("tp->seq_c.frame_num: %d", tp->seq_c.frame_num);
-                tp->measured_delay += tp->t.config.period - tp->seq_c.frame_num;
-                tp->delay_detected = 1;
-                warn("measured_delay: %d", tp->measured_delay);
-                if (tp->opts.assert_delay) {
-                    if (tp->measured_delay != tp->opts.expected_delay) {
-                        err("assert: delay %d doesn't match the expected one %d", tp->measured_delay, tp->opts.expected_delay);
-                        tp->exit_status = 1;
-                    } else {
-                        warn("good loopback delay");
-                        tp->exit_status = 0;
-                    }
-                } else {
-                    tp->exit_status = 0;
-                }
-                break;
-            case INVALID_FRAME:
-                /* log for this frame was already generated by seq_check_frames() */
-                tp->exit_status = 1;
-                break;
-            }
+        /* the sequence has been checked by loopback_delay_read_period() */
+        tp->captured_frames += frames;
+        drift_rate_update( &tp->drift_c, tp->pcm_c, SND_PCM_STREAM_CAPTURE, tp->captured_frames );
+        switch (tp->seq_c.state) {
+        case NULL_FRAME:
+            /* nothing received yet (or the stream was interrupted) */
+            break;
+        case VALID_FRAME:
+            loopback_delay_update( tp );
+            drift_seq_update( &tp->drift_c, tp->captured_frames, tp->seq_c.frame_num, tp->seq_c.frame_num_mask );
+            latency = recovery_update( &tp->recovery, &tp->seq_c, frames );
+            if (latency)
+                warn("%s: loopback_delay recovered in %.2f ms, delay %d -> %d frames",
+                        tp->t.device, latency * 1e-6, tp->delay_before, tp->measured_delay);
+            break;
+        case INVALID_FRAME:
+            /* log for this frame was already generated by seq_check_frames() */
+            if (!tp->delay_detected) tp->exit_status = 1;
+            break;
         }
     }
 }
 
 
+/* stream of the next injected event: the capture if true */
+static int loopback_delay_inject_capture( struct test_loopback_delay *tp ) {
+    switch (tp->opts.inject) {
+    case LDI_PLAYBACK:
+        return 0;
+    case LDI_CAPTURE:
+        return 1;
+    default:
+        return !tp->inject_capture;
+    }
+}
+
+/*
+ * restart the stream stopped by LDT_W4_STOP.
+ * linked streams were stopped together: they are started again like at the beginning
+ *
+ * return 0 or a negative error code
+ */
+static int loopback_delay_restart( struct test_loopback_delay *tp ) {
+    snd_pcm_sframes_t frames;
+    int r;
+
+    if (tp->inject_capture || (tp->opts.start_sync_mode == LSM_LINK)) {
+        /* the capture position starts again */
+        seq_check_jump_notify( &tp->seq_c );
+    }
+    /* and so does the playback one otherwise */
+    tp->delay_rebase = 1;
+    if (tp->opts.start_sync_mode == LSM_LINK)
+        return loopback_delay_start_streams( tp );
+
+    if (tp->inject_capture) {
+        r = pcm_prepare( tp->pcm_c );
+        if (r < 0) return r;
+        return pcm_start( tp->pcm_c );
+    }
+    r = pcm_prepare( tp->pcm_p );
+    if (r < 0) return r;
+    frames = loopback_delay_write_period( tp, 1 );
+    return (frames < 0) ? frames : 0;
+}
+
 static void loopback_delay_timer( struct ev_loop *loop, struct ev_timer *w, int revents) {
     struct test_loopback_delay *tp = (struct test_loopback_delay *)(w->data);
-#if 0
+
     switch (tp->timer_state) {
-    case CT_IDLE:
+    case LDT_IDLE:
         break;
-    case CT_W4_XRUN:
-        warn("%s: force capture xrun", tp->t.device);
+    case LDT_W4_XRUN:
+        tp->inject_capture = loopback_delay_inject_capture( tp );
+        warn("%s: force loopback_delay %s xrun", tp->t.device, tp->inject_capture ? "capture" : "playback");
         /* simply stop handling the pcm handler during few ms */
-        ev_io_stop( loop, &tp->io_watcher );
-        tp->timer_state = CT_W4_XRUN_END;
+        ev_io_stop( loop, tp->inject_capture ? &tp->io_watcher_c : &tp->io_watcher_p );
+        tp->timer_state = LDT_W4_XRUN_END;
         ev_timer_set( &tp->timer, 0.5, 0);
         ev_timer_start( loop, &tp->timer );
         break;
 
-    case CT_W4_XRUN_END:
-        warn("%s: CT_W4_XRUN_END", tp->t.device);
-        ev_io_start( loop, &tp->io_watcher );
-        tp->timer_state = CT_W4_XRUN;
+    case LDT_W4_XRUN_END:
+        warn("%s: LDT_W4_XRUN_END", tp->t.device);
+        ev_io_start( loop, tp->inject_capture ? &tp->io_watcher_c : &tp->io_watcher_p );
+        /* a stalled playback runs dry: the frames it didn't play move the delay */
+        if (!tp->inject_capture) tp->delay_rebase = 1;
+        /* timed from here if the stream didn't xrun, else from its recovery by the io job */
+        loopback_delay_recovered( tp );
+        tp->timer_state = LDT_W4_XRUN;
         ev_timer_set( &tp->timer, tp->opts.xrun*1e-3, 0);
         ev_timer_start( loop, &tp->timer );
         break;
 
-    case CT_W4_STOP:
-        warn("%s: CT_W4_STOP", tp->t.device);
-        snd_pcm_drop( tp->pcm );
-        ev_io_stop( loop, &tp->io_watcher );
-        tp->timer_state = CT_W4_RESTART;
+    case LDT_W4_STOP:
+        tp->inject_capture = loopback_delay_inject_capture( tp );
+        warn("%s: LDT_W4_STOP (%s)", tp->t.device, tp->inject_capture ? "capture" : "playback");
+        pcm_drop( tp->inject_capture ? tp->pcm_c : tp->pcm_p );
+        if (tp->opts.start_sync_mode == LSM_LINK) {
+            /* the other stream is stopped too */
+            ev_io_stop( loop, &tp->io_watcher_c );
+            ev_io_stop( loop, &tp->io_watcher_p );
+        } else {
+            ev_io_stop( loop, tp->inject_capture ? &tp->io_watcher_c : &tp->io_watcher_p );
+        }
+        tp->timer_state = LDT_W4_RESTART;
         ev_timer_set( &tp->timer, tp->opts.restart_pause_time * 1e-3, 0);
         ev_timer_start( loop, &tp->timer );
         break;
 
-    case CT_W4_RESTART: {
+    case LDT_W4_RESTART: {
         int r;
-        warn("%s: CT_W4_RESTART", tp->t.device);
-        seq_check_jump_notify( &tp->seq );
-        snd_pcm_prepare(tp->pcm);
-        r = snd_pcm_start( tp->pcm );
+        warn("%s: LDT_W4_RESTART (%s)", tp->t.device, tp->inject_capture ? "capture" : "playback");
+        r = loopback_delay_restart( tp );
         if (r >= 0) {
-            ev_io_start( loop, &tp->io_watcher );
-            tp->timer_state = CT_W4_STOP;
+            if (tp->opts.start_sync_mode == LSM_LINK) {
+                ev_io_start( loop, &tp->io_watcher_c );
+                ev_io_start( loop, &tp->io_watcher_p );
+            } else {
+                ev_io_start( loop, tp->inject_capture ? &tp->io_watcher_c : &tp->io_watcher_p );
+            }
+            loopback_delay_recovered( tp );
+            tp->timer_state = LDT_W4_STOP;
             ev_timer_set( &tp->timer, tp->opts.restart_play_time * 1e-3, 0);
             ev_timer_start( loop, &tp->timer );
         } else {
-            err("%s: capture restart failure (%s)", tp->t.device, snd_strerror(r));
+            err("%s: loopback_delay %s restart failure (%s)", tp->t.device,
+                    tp->inject_capture ? "capture" : "playback", snd_strerror(r));
             ev_unloop(loop, EVUNLOOP_ALL);
         }
     } break;
     }
-#endif
 }
 
 
@@ -259,11 +542,17 @@ static int loopback_delay_close(struct test *t) {
     struct test_loopback_delay *tp = (struct test_loopback_delay *)t;
     int exit_status = tp->exit_status;
 
-    ev_io_stop(loop, &tp->io_watcher_c);
-    ev_io_stop(loop, &tp->io_watcher_p);
-    snd_pcm_close( tp->pcm_c );
-    snd_pcm_close( tp->pcm_p );
-
+    ev_timer_stop(tp->t.loop, &tp->timer);
+    ev_io_stop(tp->t.loop, &tp->io_watcher_c);
+    ev_io_stop(tp->t.loop, &tp->io_watcher_p);
+    pcm_close( tp->pcm_c );
+    pcm_close( tp->pcm_p );
+
+    seq_free( &tp->seq_c );
+    seq_free( &tp->seq_p );
+    if (tp->delay_series) fclose( tp->delay_series );
+    if (tp->bb) blackbox_destroy( tp->bb );
+    free( tp->period_planes );
     free( tp->periof_buff );
     free( tp );
     return exit_status;
@@ -271,9 +560,30 @@ static int loopback_delay_close(struct test *t) {
 
 
 
+static void loopback_delay_report(struct test *t) {
+    struct test_loopback_delay *tp = (struct test_loopback_delay *)t;
+    unsigned long long n = tp->delay_stats.n;
+
+    period_stats_report( &tp->stats_p, tp->t.device, "loopback_delay p" );
+    period_stats_report( &tp->stats_c, tp->t.device, "loopback_delay c" );
+    drift_report( &tp->drift_p, tp->t.device, "loopback_delay p" );
+    drift_report( &tp->drift_c, tp->t.device, "loopback_delay c" );
+    seq_classify_report( tp->seq_c.classify, tp->t.device, "loopback_delay c" );
+    recovery_report( &tp->recovery, tp->t.device, "loopback_delay" );
+    if (n)
+        printf("%s loopback_delay delay: n=%llu current=%d min=%d max=%d mean=%.2f stddev=%.2f changes=%u (frames)\n",
+                tp->t.device, n, tp->measured_delay, tp->delay_stats.min, tp->delay_stats.max,
+                tp->delay_stats.mean, (n > 1) ? sqrt( tp->delay_stats.m2 / (n - 1) ) : 0.,
+                tp->delay_changes);
+    else
+        printf("%s loopback_delay delay: not measured\n", tp->t.device);
+}
+
+
 const struct test_ops loopback_delay_ops = {
         .start = loopback_delay_start,
         .close = loopback_delay_close,
+        .report = loopback_delay_report,
 };
 
 /*
@@ -295,44 +605,63 @@ struct test *loopback_delay_create(struct alsa_config *config, struct loopback_d
     memcpy( tp->t.device, config->device, sizeof(tp->t.device) );
     tp->opts = *opts;
 
-    r = alsa_device_open( tp->t.config.device, &tp->t.config, NULL, &tp->pcm_p);
+    r = pcm_open( tp->t.config.device, &tp->t.config, NULL, &tp->pcm_p);
     if (r) goto failed1;
 
-    r = alsa_device_open( tp->t.config.device, &tp->t.config, &tp->pcm_c, NULL);
+    r = pcm_open( tp->t.config.device, &tp->t.config, &tp->pcm_c, NULL);
     if (r) goto failed1;
 
     if (opts->start_sync_mode == LSM_LINK) {
-        r = snd_pcm_link( tp->pcm_p, tp->pcm_c );
+        r = pcm_link( tp->pcm_p, tp->pcm_c );
         if (r) {
-            err("%s: snd_pcm_link failed: %s", tp->t.device, snd_strerror(r));
+            err("%s: pcm_link failed: %s", tp->t.device, snd_strerror(r));
             goto failed1;
         }
     }
 
-    seq_init( &tp->seq_c, tp->t.config.channels, tp->t.config.format );
-    seq_init( &tp->seq_p, tp->t.config.channels, tp->t.config.format );
-    tp->periof_buff = malloc( snd_pcm_frames_to_bytes( tp->pcm_c, tp->t.config.period ));
-    if (!tp->periof_buff) goto failed;
+    if (opts->delay_series_path) {
+        tp->delay_series = fopen( opts->delay_series_path, "w" );
+        if (!tp->delay_series) {
+            err("%s: can't create '%s'", tp->t.device, opts->delay_series_path);
+            goto failed;
+        }
+        /* one write every few minutes of measurements */
+        setvbuf( tp->delay_series, NULL, _IOFBF, 64 * 1024 );
+        fprintf( tp->delay_series, "# time(s) delay(frames)\n" );
+    }
 
-    r = snd_pcm_poll_descriptors_count(tp->pcm_c);
-    if (r != 1) {
-        err("loopback_delay_create: expect only 1 fd to monitor (snd_pcm_poll_descriptors_count)");
-        goto failed;
+    if (seq_init( &tp->seq_c, tp->t.config.channels, tp->t.config.format )) goto failed;
+    if (seq_init( &tp->seq_p, tp->t.config.channels, tp->t.config.format )) goto failed;
+    if (seq_classify_attach( &tp->seq_c )) goto failed;
+    test_seq_attach( &tp->t, &tp->seq_c );
+    drift_init( &tp->drift_p, tp->pcm_p, tp->t.config.rate, tp->t.config.period );
+    drift_init( &tp->drift_c, tp->pcm_c, tp->t.config.rate, tp->t.config.period );
+    recovery_init( &tp->recovery, tp->t.config.rate );
+    tp->t.recovery = &tp->recovery;
+    if (opts->blackbox.prefix) {
+        /* keep the generated frames too, to compare with what came back */
+        tp->bb = blackbox_create( &opts->blackbox, tp->t.config.format, tp->t.config.channels,
+                tp->t.config.rate, tp->t.config.period, 1 );
+        if (!tp->bb) goto failed;
     }
-    r = snd_pcm_poll_descriptors_count(tp->pcm_p);
-    if (r != 1) {
-        err("loopback_delay_create: expect only 1 fd to monitor (snd_pcm_poll_descriptors_count)");
-        goto failed;
+    if (!alsa_access_is_mmap( tp->t.config.access )) {
+        /* mmap access: the frames are generated and checked directly in the DMA rings */
+        tp->periof_buff = malloc( pcm_frames_to_bytes( tp->pcm_c, tp->t.config.period ));
+        if (!tp->periof_buff) goto failed;
+        if (alsa_access_is_planar( tp->t.config.access )) {
+            tp->period_planes = alsa_planes_split( &tp->t.config, tp->periof_buff, tp->t.config.period );
+            if (!tp->period_planes) goto failed;
+        }
     }
 
-    r = snd_pcm_poll_descriptors(tp->pcm_c, &tp->pollfd_c, 1);
+    r = pcm_poll_descriptor( tp->pcm_c, &tp->pollfd_c );
     if (r < 0) {
-        err("%s: snd_pcm_poll_descriptors (c) failed", tp->t.device);
+        err("%s: pcm_poll_descriptor (c) failed", tp->t.device);
         goto failed;
     }
-    r = snd_pcm_poll_descriptors(tp->pcm_p, &tp->pollfd_p, 1);
+    r = pcm_poll_descriptor( tp->pcm_p, &tp->pollfd_p );
     if (r < 0) {
-        err("%s: snd_pcm_poll_descriptors (p) failed", tp->t.device);
+        err("%s: pcm_poll_descriptor (p) failed", tp->t.device);
         goto failed;
     }
 
@@ -358,8 +687,13 @@ struct test *loopback_delay_create(struct alsa_config *config, struct loopback_d
     return &tp->t;
 
 failed:
-    if (tp->pcm_p) snd_pcm_close( tp->pcm_p );
-    if (tp->pcm_c) snd_pcm_close( tp->pcm_c );
+    if (tp->pcm_p) pcm_close( tp->pcm_p );
+    if (tp->pcm_c) pcm_close( tp->pcm_c );
+    seq_free( &tp->seq_c );
+    seq_free( &tp->seq_p );
+    if (tp->delay_series) fclose( tp->delay_series );
+    if (tp->bb) blackbox_destroy( tp->bb );
+    free(tp->period_planes);
     free(tp->periof_buff);
 failed1:
     free(tp);
@@ -15,7 +15,13 @@
 #include <ev.h>
 
 #include "test.h"
+#include "pcm.h"
 #include "seq.h"
+#include "classify.h"
+#include "hist.h"
+#include "drift.h"
+#include "blackbox.h"
+#include "recovery.h"
 
 struct loopback_delay_create_opts {
 
@@ -33,7 +39,7 @@ struct loopback_delay_create_opts {
         LSM_PREPARE_PLAYBACK_CAPTURE,
 
         /*
-         * use snd_pcm_link()
+         * use pcm_link()
          */
         LSM_LINK,
     } start_sync_mode;
@@ -46,6 +52,21 @@ struct loopback_delay_create_opts {
     int expected_delay;
 
     int xrun; /* if > 0, number of ms between every xrun emulation */
+    int restart_play_time;  /* if > 0, stop a stream after this number of ms */
+    int restart_pause_time; /* and restart it after this number of ms */
+
+    /* stream the xruns and the stops are injected on */
+    enum loopback_delay_inject_e {
+        LDI_BOTH = 0,       /* the playback and the capture alternately */
+        LDI_PLAYBACK,
+        LDI_CAPTURE,
+    } inject;
+
+    /* if not NULL, the delay measured at every period is written in this file */
+    const char *delay_series_path;
+
+    /* dump the audio around the errors (see blackbox.h) */
+    struct blackbox_opts blackbox;
 
 };
 
@@ -53,16 +74,49 @@ struct loopback_delay_create_opts {
 struct test_loopback_delay {
     struct test t;
 
-    snd_pcm_t *pcm_p;
-    snd_pcm_t *pcm_c;
+    struct pcm *pcm_p;
+    struct pcm *pcm_c;
     struct seq_info seq_p;
     struct seq_info seq_c;
     void *periof_buff;
+    void **period_planes;   /* non interleaved RW access: channel buffers of periof_buff */
+    struct period_stats stats_p;
+    struct period_stats stats_c;
+    struct drift drift_p;
+    struct drift drift_c;   /* also the playback clock relative to the capture one */
+    unsigned long long written_frames;
 
     int delay_detected; /* true we have detected the delay */
     int measured_delay; /* valid if delay_detected is true */
     int exit_status;
 
+    /*
+     * continuous delay tracking:
+     * the delay is measured again after every checked period, as the number of frames
+     * captured minus the number of the next frame expected.
+     */
+    unsigned long long captured_frames;
+    uint64_t start_ns;
+    unsigned delay_changes;
+    struct {
+        unsigned long long n;
+        double mean;
+        double m2;          /* sum of squared differences from the mean (Welford) */
+        int min, max;
+    } delay_stats;
+    FILE *delay_series;
+    struct blackbox *bb;
+
+    /*
+     * every recovery of a stream (injected or not) is timed until the first valid
+     * frame captured afterwards, and the delay measured then is logged against
+     * 'delay_before'. 'delay_rebase' is set when a stream position is lost or
+     * restarted: the next delay is a new measure and not a change
+     */
+    struct recovery recovery;
+    int delay_before;
+    int delay_rebase;
+
     struct pollfd pollfd_p;
     struct pollfd pollfd_c;
     struct ev_io io_watcher_p;
@@ -75,8 +129,10 @@ struct test_loopback_delay {
         LDT_IDLE = 0,
         LDT_W4_XRUN,
         LDT_W4_XRUN_END,
-
+        LDT_W4_STOP,
+        LDT_W4_RESTART,
     } timer_state;
+    int inject_capture; /* the event in progress is on the capture side */
 
 };
 
@@ -0,0 +1,165 @@
+/*
+ * Copyright (C) 2015 Arnaud Mouiche <arnaud.mouiche@invoxia.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "pcm.h"
+#include "log.h"
+
+
+int pcm_open( const char *device, struct alsa_config *config, struct pcm **capture, struct pcm **playback ) {
+    if (capture) *capture = NULL;
+    if (playback) *playback = NULL;
+
+    if (!strncmp( device, "file:", 5 ))
+        return pcm_file_open( device + 5, config, capture, playback );
+    if (!strncmp( device, "mem:", 4 ))
+        return pcm_mem_open( device + 4, config, capture, playback );
+    return pcm_alsa_open( device, config, capture, playback );
+}
+
+
+int pcm_init( struct pcm *pcm, const struct pcm_ops *ops, snd_pcm_stream_t stream, struct alsa_config *config ) {
+    pcm->ops = ops;
+    pcm->stream = stream;
+    pcm->config = *config;
+    pcm->buffer_size = (snd_pcm_uframes_t)config->period * config->buffer_period_count;
+    pcm->sample_bytes = snd_pcm_format_physical_width( config->format ) / 8;
+    pcm->frame_bytes = config->channels * pcm->sample_bytes;
+
+    if (ops->rw) {
+        size_t period_bytes = (size_t)config->period * pcm->frame_bytes;
+        if (alsa_access_is_planar( config->access )) {
+            pcm->bounce = malloc( period_bytes );
+            if (!pcm->bounce) return -ENOMEM;
+        }
+        if (alsa_access_is_mmap( config->access )) {
+            /* there is no DMA ring: the jobs work in a period buffer */
+            pcm->mmap_buff = malloc( period_bytes );
+            if (!pcm->mmap_buff) return -ENOMEM;
+            if (alsa_access_is_planar( config->access )) {
+                pcm->mmap_planes = alsa_planes_split( config, pcm->mmap_buff, config->period );
+                if (!pcm->mmap_planes) return -ENOMEM;
+            }
+        }
+    }
+    return 0;
+}
+
+void pcm_release( struct pcm *pcm ) {
+    free( pcm->mmap_planes );
+    free( pcm->mmap_buff );
+    free( pcm->bounce );
+}
+
+
+snd_pcm_sframes_t pcm_rw_transfer( struct pcm *pcm, void * const *planes, snd_pcm_uframes_t frames ) {
+    snd_pcm_uframes_t done = 0;
+
+    if (!alsa_access_is_planar( pcm->config.access ))
+        return pcm->ops->rw( pcm, planes[0], frames );
+
+    /* one period at a time through the interleaved bounce buffer */
+    while (done < frames) {
+        snd_pcm_uframes_t n = frames - done;
+        snd_pcm_sframes_t r;
+        void *p[ pcm->config.channels ];
+        unsigned ch;
+
+        if (n > pcm->config.period) n = pcm->config.period;
+        for (ch = 0; ch < pcm->config.channels; ch++)
+            p[ch] = (uint8_t *)planes[ch] + done * pcm->sample_bytes;
+
+        if (pcm->stream == SND_PCM_STREAM_PLAYBACK)
+            alsa_planes_interleave( pcm->bounce, (const void * const *)p, pcm->config.channels, pcm->sample_bytes, n );
+        r = pcm->ops->rw( pcm, pcm->bounce, n );
+        if (r <= 0) return done ? (snd_pcm_sframes_t)done : r;
+        if (pcm->stream == SND_PCM_STREAM_CAPTURE)
+            alsa_planes_deinterleave( p, pcm->bounce, pcm->config.channels, pcm->sample_bytes, r );
+        done += r;
+        if (r < n) break;
+    }
+    return done;
+}
+
+snd_pcm_sframes_t pcm_rw_mmap_transfer( struct pcm *pcm, snd_pcm_uframes_t frames, alsa_mmap_job job, void *data ) {
+    const int planar = alsa_access_is_planar( pcm->config.access );
+    void * const *planes = planar ? pcm->mmap_planes : &pcm->mmap_buff;
+    snd_pcm_uframes_t done = 0;
+
+    while (done < frames) {
+        snd_pcm_uframes_t n = frames - done;
+        snd_pcm_sframes_t r;
+
+        if (n > pcm->config.period) n = pcm->config.period;
+        if (pcm->stream == SND_PCM_STREAM_PLAYBACK) {
+            void *p[ planar ? pcm->config.channels : 1 ];
+            unsigned ch;
+
+            /* the frames generated by the job are all written, even over several calls */
+            if (!pcm->mmap_pending) {
+                job( data, planes, n );
+                pcm->mmap_pending = n;
+                pcm->mmap_pending_offset = 0;
+            } else if (n > pcm->mmap_pending) {
+                n = pcm->mmap_pending;
+            }
+            if (planar) {
+                for (ch = 0; ch < pcm->config.channels; ch++)
+                    p[ch] = (uint8_t *)planes[ch] + pcm->mmap_pending_offset * pcm->sample_bytes;
+            } else {
+                p[0] = (uint8_t *)planes[0] + pcm->mmap_pending_offset * pcm->frame_bytes;
+            }
+            r = pcm_rw_transfer( pcm, p, n );
+            if (r > 0) {
+                pcm->mmap_pending -= r;
+                pcm->mmap_pending_offset += r;
+            }
+        } else {
+            r = pcm_rw_transfer( pcm, planes, n );
+            if (r > 0) job( data, planes, r );
+        }
+        if (r <= 0) return done ? (snd_pcm_sframes_t)done : r;
+        done += r;
+        if (r < n) break;
+    }
+    return done;
+}
+
+
+int pcm_wakeup_lateness( struct pcm *pcm, snd_pcm_uframes_t period, unsigned rate, uint64_t *lateness_ns,
+        snd_pcm_uframes_t *headroom ) {
+    snd_pcm_uframes_t avail;
+    snd_htimestamp_t tstamp;
+
+    if (pcm_status( pcm, &avail, &tstamp ) < 0) return -1;
+    if (headroom) *headroom = (avail < pcm->buffer_size) ? pcm->buffer_size - avail : 0;
+    if (avail < period) return 1;
+    *lateness_ns = (uint64_t)(avail - period) * 1000000000ull / rate;
+    return 0;
+}
+
+
+long pcm_frames_lost( struct pcm *pcm, const struct pcm_position *before, const struct pcm_position *after ) {
+    double stopped;
+
+    /* the recovery did not stop the stream (-EAGAIN...) */
+    if (before->state == SND_PCM_STATE_RUNNING) return 0;
+    if ((before->state != SND_PCM_STATE_XRUN) || (after->state != SND_PCM_STATE_RUNNING)) return -1;
+    if (!(before->trigger.tv_sec || before->trigger.tv_nsec) || !(after->trigger.tv_sec || after->trigger.tv_nsec))
+        return -1;
+
+    /* from the xrun to the start */
+    stopped = (after->trigger.tv_sec - before->trigger.tv_sec) + (after->trigger.tv_nsec - before->trigger.tv_nsec) * 1e-9;
+    if (stopped < 0) return -1;
+    return (long)before->avail + lrint( stopped * pcm->config.rate );
+}
@@ -0,0 +1,172 @@
+/*
+ * Copyright (C) 2015 Arnaud Mouiche <arnaud.mouiche@invoxia.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ */
+
+#ifndef __pcm_h__
+#define __pcm_h__
+
+#include <poll.h>
+#include <stdint.h>
+#include <alsa/asoundlib.h>
+
+#include "alsa.h"
+
+/*
+ * I/O backends of the tests. The device name selects the backend:
+ *
+ *   file:PATH     raw interleaved frames read from (capture) or written to (playback)
+ *                 PATH, as fast as possible for regular files, at the pace of the
+ *                 reader/writer for pipes. A capture stops at the end of the file.
+ *                 A recording of 'capture -w' can be checked again this way.
+ *   mem:NAME[,latency=FRAMES]
+ *                 in-process loopback: the frames written by the playback are read by the
+ *                 capture opened with the same NAME, FRAMES later (silence before).
+ *                 Runs as fast as the tests go.
+ *   anything else is an ALSA PCM name.
+ *
+ * The calls follow the snd_pcm_* ones used by the tests, with the same return codes,
+ * plus -ENODATA from a transfer at the end of a file: the normal end of the test.
+ */
+
+struct pcm;
+
+/*
+ * position of the stream, taken around a recovery to know how many frames
+ * the interruption lost (see pcm_frames_lost())
+ */
+struct pcm_position {
+    snd_pcm_state_t state;
+    snd_pcm_uframes_t avail;        /* hw_ptr - appl_ptr: frames captured and not read yet */
+    snd_htimestamp_t trigger;       /* time of the last start, stop or xrun. zero if unknown */
+};
+
+struct pcm_ops {
+    void (*close)( struct pcm *pcm );
+
+    /* exactly one descriptor, ready when a period can be transferred */
+    int (*poll_descriptor)( struct pcm *pcm, struct pollfd *pfd );
+
+    /* RW access: planes[0] is the interleaved buffer, or one buffer per channel */
+    snd_pcm_sframes_t (*transfer)( struct pcm *pcm, void * const *planes, snd_pcm_uframes_t frames );
+    /* mmap access, see alsa_mmap_transfer() */
+    snd_pcm_sframes_t (*mmap_transfer)( struct pcm *pcm, snd_pcm_uframes_t frames, alsa_mmap_job job, void *data );
+
+    int (*prepare)( struct pcm *pcm );
+    int (*start)( struct pcm *pcm );
+    int (*drop)( struct pcm *pcm );
+    int (*recover)( struct pcm *pcm, int err );
+
+    /*
+     * frames available and time of the last position update (zero if unknown).
+     * return a negative value if the stream is not running
+     */
+    int (*status)( struct pcm *pcm, snd_pcm_uframes_t *avail, snd_htimestamp_t *tstamp );
+
+    /* position in any state. return a negative value if not available */
+    int (*position)( struct pcm *pcm, struct pcm_position *pos );
+
+    int (*link)( struct pcm *pcm, struct pcm *other );
+
+    /*
+     * backends working on interleaved buffers only: pcm_rw_transfer() and
+     * pcm_rw_mmap_transfer() convert the other access modes for them.
+     */
+    snd_pcm_sframes_t (*rw)( struct pcm *pcm, void *buff, snd_pcm_uframes_t frames );
+};
+
+struct pcm {
+    const struct pcm_ops *ops;
+    snd_pcm_stream_t stream;
+    struct alsa_config config;      /* as negotiated */
+    snd_pcm_uframes_t buffer_size;
+    unsigned sample_bytes;
+    unsigned frame_bytes;
+
+    /* rw backends: interleaved period for the planar access, period given to the mmap jobs */
+    void *bounce;
+    void *mmap_buff;
+    void **mmap_planes;
+    /* playback: frames of mmap_buff generated but not written yet (short write), from mmap_pending_offset */
+    snd_pcm_uframes_t mmap_pending;
+    snd_pcm_uframes_t mmap_pending_offset;
+};
+
+/*
+ * open 'device' for capture and/or playback, like alsa_device_open()
+ * return 0 on success
+ */
+int pcm_open( const char *device, struct alsa_config *config, struct pcm **capture, struct pcm **playback );
+
+static inline void pcm_close( struct pcm *pcm ) { pcm->ops->close( pcm ); }
+
+static inline int pcm_poll_descriptor( struct pcm *pcm, struct pollfd *pfd ) { return pcm->ops->poll_descriptor( pcm, pfd ); }
+
+static inline snd_pcm_sframes_t pcm_writei( struct pcm *pcm, const void *buff, snd_pcm_uframes_t frames ) {
+    void *planes[1] = { (void *)buff };
+    return pcm->ops->transfer( pcm, planes, frames );
+}
+static inline snd_pcm_sframes_t pcm_writen( struct pcm *pcm, void **planes, snd_pcm_uframes_t frames ) {
+    return pcm->ops->transfer( pcm, planes, frames );
+}
+static inline snd_pcm_sframes_t pcm_readi( struct pcm *pcm, void *buff, snd_pcm_uframes_t frames ) {
+    return pcm->ops->transfer( pcm, &buff, frames );
+}
+static inline snd_pcm_sframes_t pcm_readn( struct pcm *pcm, void **planes, snd_pcm_uframes_t frames ) {
+    return pcm->ops->transfer( pcm, planes, frames );
+}
+static inline snd_pcm_sframes_t pcm_mmap_transfer( struct pcm *pcm, snd_pcm_uframes_t frames, alsa_mmap_job job, void *data ) {
+    return pcm->ops->mmap_transfer( pcm, frames, job, data );
+}
+
+static inline int pcm_prepare( struct pcm *pcm ) { return pcm->ops->prepare( pcm ); }
+static inline int pcm_start( struct pcm *pcm ) { return pcm->ops->start( pcm ); }
+static inline int pcm_drop( struct pcm *pcm ) { return pcm->ops->drop( pcm ); }
+static inline int pcm_recover( struct pcm *pcm, int err ) { return pcm->ops->recover( pcm, err ); }
+static inline int pcm_link( struct pcm *pcm, struct pcm *other ) { return pcm->ops->link( pcm, other ); }
+static inline int pcm_status( struct pcm *pcm, snd_pcm_uframes_t *avail, snd_htimestamp_t *tstamp ) {
+    return pcm->ops->status( pcm, avail, tstamp );
+}
+
+static inline int pcm_get_position( struct pcm *pcm, struct pcm_position *pos ) {
+    return pcm->ops->position( pcm, pos );
+}
+
+static inline ssize_t pcm_frames_to_bytes( struct pcm *pcm, snd_pcm_sframes_t frames ) {
+    return frames * pcm->frame_bytes;
+}
+
+/*
+ * how late the wakeup is: the time to play/capture the frames available beyond one period.
+ * if not NULL, 'headroom' gets the frames left before an xrun: the frames still queued for
+ * a playback, the room left in the buffer for a capture.
+ * return -1 if not running or not available, 1 if less than a period is available (only
+ * the headroom is set)
+ */
+int pcm_wakeup_lateness( struct pcm *pcm, snd_pcm_uframes_t period, unsigned rate, uint64_t *lateness_ns,
+        snd_pcm_uframes_t *headroom );
+
+/*
+ * frames of a capture stream lost by a recovery, from its positions 'before' pcm_recover()
+ * and 'after' pcm_start(): the frames captured and not read when the stream stopped on
+ * the xrun, plus the frames gone while it was stopped. 0 if the stream was not stopped.
+ * return -1 if unknown
+ */
+long pcm_frames_lost( struct pcm *pcm, const struct pcm_position *before, const struct pcm_position *after );
+
+
+/* backends */
+int pcm_init( struct pcm *pcm, const struct pcm_ops *ops, snd_pcm_stream_t stream, struct alsa_config *config );
+void pcm_release( struct pcm *pcm );
+snd_pcm_sframes_t pcm_rw_transfer( struct pcm *pcm, void * const *planes, snd_pcm_uframes_t frames );
+snd_pcm_sframes_t pcm_rw_mmap_transfer( struct pcm *pcm, snd_pcm_uframes_t frames, alsa_mmap_job job, void *data );
+
+int pcm_alsa_open( const char *device, struct alsa_config *config, struct pcm **capture, struct pcm **playback );
+int pcm_file_open( const char *path, struct alsa_config *config, struct pcm **capture, struct pcm **playback );
+int pcm_mem_open( const char *spec, struct alsa_config *config, struct pcm **capture, struct pcm **playback );
+
+#endif //__pcm_h__
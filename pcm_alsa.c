@@ -0,0 +1,161 @@
+/*
+ * Copyright (C) 2015 Arnaud Mouiche <arnaud.mouiche@invoxia.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ */
+
+/*
+ * ALSA backend: the tests' calls go straight to alsa-lib
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "pcm.h"
+#include "log.h"
+
+struct pcm_alsa {
+    struct pcm pcm;
+    snd_pcm_t *handle;
+    int monotonic;      /* the status timestamps are on CLOCK_MONOTONIC, like the other backends */
+};
+
+#define HANDLE(pcm) (((struct pcm_alsa *)(pcm))->handle)
+
+
+static void alsa_close( struct pcm *pcm ) {
+    snd_pcm_close( HANDLE(pcm) );
+    pcm_release( pcm );
+    free( pcm );
+}
+
+static int alsa_poll_descriptor( struct pcm *pcm, struct pollfd *pfd ) {
+    int r = snd_pcm_poll_descriptors_count( HANDLE(pcm) );
+    if (r != 1) {
+        err("%s: expect only 1 fd to monitor (snd_pcm_poll_descriptors_count)", pcm->config.device);
+        return -EINVAL;
+    }
+    r = snd_pcm_poll_descriptors( HANDLE(pcm), pfd, 1 );
+    return (r < 0) ? r : 0;
+}
+
+static snd_pcm_sframes_t alsa_transfer( struct pcm *pcm, void * const *planes, snd_pcm_uframes_t frames ) {
+    if (alsa_access_is_planar( pcm->config.access )) {
+        if (pcm->stream == SND_PCM_STREAM_PLAYBACK)
+            return snd_pcm_writen( HANDLE(pcm), (void **)planes, frames );
+        return snd_pcm_readn( HANDLE(pcm), (void **)planes, frames );
+    }
+    if (pcm->stream == SND_PCM_STREAM_PLAYBACK)
+        return snd_pcm_writei( HANDLE(pcm), planes[0], frames );
+    return snd_pcm_readi( HANDLE(pcm), planes[0], frames );
+}
+
+static snd_pcm_sframes_t alsa_pcm_mmap_transfer( struct pcm *pcm, snd_pcm_uframes_t frames, alsa_mmap_job job, void *data ) {
+    return alsa_mmap_transfer( HANDLE(pcm), &pcm->config, frames, job, data );
+}
+
+static int alsa_prepare( struct pcm *pcm ) { return snd_pcm_prepare( HANDLE(pcm) ); }
+static int alsa_start( struct pcm *pcm ) { return snd_pcm_start( HANDLE(pcm) ); }
+static int alsa_drop( struct pcm *pcm ) { return snd_pcm_drop( HANDLE(pcm) ); }
+static int alsa_recover( struct pcm *pcm, int err ) { return snd_pcm_recover( HANDLE(pcm), err, 0 ); }
+static int alsa_link( struct pcm *pcm, struct pcm *other ) { return snd_pcm_link( HANDLE(pcm), HANDLE(other) ); }
+
+static int alsa_status( struct pcm *pcm, snd_pcm_uframes_t *avail, snd_htimestamp_t *tstamp ) {
+    snd_pcm_status_t *status;
+
+    snd_pcm_status_alloca( &status );
+    if (snd_pcm_status( HANDLE(pcm), status ) < 0) return -1;
+    if (snd_pcm_status_get_state( status ) != SND_PCM_STATE_RUNNING) return -1;
+
+    /* with the timestamps enabled (see alsa_device_open()), the time of the last pointer update */
+    *avail = snd_pcm_status_get_avail( status );
+    if (((struct pcm_alsa *)pcm)->monotonic) {
+        snd_pcm_status_get_htstamp( status, tstamp );
+    } else {
+        /* gettimeofday() based: not comparable with the monotonic clock of the callers */
+        tstamp->tv_sec = 0;
+        tstamp->tv_nsec = 0;
+    }
+    return 0;
+}
+
+static int alsa_position( struct pcm *pcm, struct pcm_position *pos ) {
+    snd_pcm_status_t *status;
+
+    snd_pcm_status_alloca( &status );
+    if (snd_pcm_status( HANDLE(pcm), status ) < 0) return -1;
+    pos->state = snd_pcm_status_get_state( status );
+    pos->avail = snd_pcm_status_get_avail( status );
+    snd_pcm_status_get_trigger_htstamp( status, &pos->trigger );
+    return 0;
+}
+
+static const struct pcm_ops alsa_ops = {
+    .close = alsa_close,
+    .poll_descriptor = alsa_poll_descriptor,
+    .transfer = alsa_transfer,
+    .mmap_transfer = alsa_pcm_mmap_transfer,
+    .prepare = alsa_prepare,
+    .start = alsa_start,
+    .drop = alsa_drop,
+    .recover = alsa_recover,
+    .status = alsa_status,
+    .position = alsa_position,
+    .link = alsa_link,
+};
+
+
+/* 1 if the timestamps of 'handle' are on the monotonic clock (alsa-lib >= 1.0.28) */
+static int alsa_tstamp_monotonic( snd_pcm_t *handle ) {
+#if SND_LIB_VERSION >= 0x01001c
+    snd_pcm_sw_params_t *sw_params;
+    snd_pcm_tstamp_type_t type;
+
+    snd_pcm_sw_params_alloca( &sw_params );
+    if (snd_pcm_sw_params_current( handle, sw_params ) < 0) return 0;
+    if (snd_pcm_sw_params_get_tstamp_type( sw_params, &type ) < 0) return 0;
+    return type == SND_PCM_TSTAMP_TYPE_MONOTONIC;
+#else
+    return 0;
+#endif
+}
+
+static struct pcm *alsa_wrap( snd_pcm_t *handle, snd_pcm_stream_t stream, struct alsa_config *config ) {
+    struct pcm_alsa *pa = calloc( 1, sizeof(*pa) );
+    snd_pcm_uframes_t period;
+
+    if (!pa || pcm_init( &pa->pcm, &alsa_ops, stream, config )) {
+        err("%s: out of memory", config->device);
+        free( pa );
+        return NULL;
+    }
+    pa->handle = handle;
+    pa->monotonic = alsa_tstamp_monotonic( handle );
+    snd_pcm_get_params( handle, &pa->pcm.buffer_size, &period );
+    return &pa->pcm;
+}
+
+int pcm_alsa_open( const char *device, struct alsa_config *config, struct pcm **capture, struct pcm **playback ) {
+    snd_pcm_t *c = NULL, *p = NULL;
+    int r;
+
+    r = alsa_device_open( device, config, capture ? &c : NULL, playback ? &p : NULL );
+    if (r) return r;
+
+    if (c && !(*capture = alsa_wrap( c, SND_PCM_STREAM_CAPTURE, config ))) goto failed;
+    if (p && !(*playback = alsa_wrap( p, SND_PCM_STREAM_PLAYBACK, config ))) goto failed;
+    return 0;
+
+failed:
+    if (capture && *capture) {
+        pcm_close( *capture );
+        *capture = NULL;
+    } else if (c) {
+        snd_pcm_close( c );
+    }
+    if (p) snd_pcm_close( p );
+    return -1;
+}
@@ -0,0 +1,144 @@
+/*
+ * Copyright (C) 2015 Arnaud Mouiche <arnaud.mouiche@invoxia.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ */
+
+/*
+ * file and pipe backend: raw interleaved frames
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+
+#include "pcm.h"
+#include "log.h"
+
+struct pcm_file {
+    struct pcm pcm;
+    int fd;
+    int ready_fd;   /* regular files: always ready eventfd, -1 otherwise */
+};
+
+#define FILE_PCM(pcm) ((struct pcm_file *)(pcm))
+
+
+static void file_close( struct pcm *pcm ) {
+    struct pcm_file *pf = FILE_PCM(pcm);
+    close( pf->fd );
+    if (pf->ready_fd >= 0) close( pf->ready_fd );
+    pcm_release( pcm );
+    free( pf );
+}
+
+static int file_poll_descriptor( struct pcm *pcm, struct pollfd *pfd ) {
+    struct pcm_file *pf = FILE_PCM(pcm);
+
+    if (pf->ready_fd >= 0) {
+        /* regular files can't be polled (epoll): the data is always there */
+        pfd->fd = pf->ready_fd;
+        pfd->events = POLLIN;
+    } else {
+        pfd->fd = pf->fd;
+        pfd->events = (pcm->stream == SND_PCM_STREAM_CAPTURE) ? POLLIN : POLLOUT;
+    }
+    pfd->revents = 0;
+    return 0;
+}
+
+static snd_pcm_sframes_t file_rw( struct pcm *pcm, void *buff, snd_pcm_uframes_t frames ) {
+    struct pcm_file *pf = FILE_PCM(pcm);
+    size_t bytes = frames * pcm->frame_bytes, done = 0;
+
+    while (done < bytes) {
+        ssize_t r;
+        if (pcm->stream == SND_PCM_STREAM_CAPTURE)
+            r = read( pf->fd, (uint8_t *)buff + done, bytes - done );
+        else
+            r = write( pf->fd, (const uint8_t *)buff + done, bytes - done );
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            err("%s: %s", pcm->config.device, strerror(errno));
+            return -EBADFD;
+        }
+        if (r == 0) break;  /* end of file */
+        done += r;
+    }
+    if (done < pcm->frame_bytes)
+        return -ENODATA;    /* end of file: stop the test */
+    return done / pcm->frame_bytes;
+}
+
+static int file_nop( struct pcm *pcm ) { return 0; }
+static int file_recover( struct pcm *pcm, int err ) { return err; }
+static int file_link( struct pcm *pcm, struct pcm *other ) { return 0; }
+static int file_status( struct pcm *pcm, snd_pcm_uframes_t *avail, snd_htimestamp_t *tstamp ) { return -1; }
+static int file_position( struct pcm *pcm, struct pcm_position *pos ) { return -1; }
+
+static const struct pcm_ops file_ops = {
+    .close = file_close,
+    .poll_descriptor = file_poll_descriptor,
+    .transfer = pcm_rw_transfer,
+    .mmap_transfer = pcm_rw_mmap_transfer,
+    .prepare = file_nop,
+    .start = file_nop,
+    .drop = file_nop,
+    .recover = file_recover,
+    .status = file_status,
+    .position = file_position,
+    .link = file_link,
+    .rw = file_rw,
+};
+
+
+static struct pcm *file_open( const char *path, snd_pcm_stream_t stream, struct alsa_config *config ) {
+    struct pcm_file *pf = calloc( 1, sizeof(*pf) );
+    struct stat st;
+
+    if (!pf) return NULL;
+    pf->ready_fd = -1;
+    if (stream == SND_PCM_STREAM_CAPTURE)
+        pf->fd = open( path, O_RDONLY );
+    else
+        pf->fd = open( path, O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+    if (pf->fd < 0) {
+        err("%s: can't open '%s': %s", config->device, path, strerror(errno));
+        free( pf );
+        return NULL;
+    }
+    if (!fstat( pf->fd, &st ) && S_ISREG( st.st_mode )) {
+        pf->ready_fd = eventfd( 1, EFD_CLOEXEC );
+        if (pf->ready_fd < 0) goto failed;
+    }
+    if (pcm_init( &pf->pcm, &file_ops, stream, config )) goto failed;
+    return &pf->pcm;
+
+failed:
+    err("%s: %s", config->device, strerror(errno));
+    pcm_release( &pf->pcm );
+    if (pf->ready_fd >= 0) close( pf->ready_fd );
+    close( pf->fd );
+    free( pf );
+    return NULL;
+}
+
+int pcm_file_open( const char *path, struct alsa_config *config, struct pcm **capture, struct pcm **playback ) {
+    if (capture && !(*capture = file_open( path, SND_PCM_STREAM_CAPTURE, config ))) return -1;
+    if (playback && !(*playback = file_open( path, SND_PCM_STREAM_PLAYBACK, config ))) {
+        if (capture) {
+            pcm_close( *capture );
+            *capture = NULL;
+        }
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,328 @@
+/*
+ * Copyright (C) 2015 Arnaud Mouiche <arnaud.mouiche@invoxia.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ */
+
+/*
+ * in-memory loopback backend.
+ *
+ * The playback and the capture opened with the same name share an interleaved
+ * ring, prefilled with 'latency' frames of silence. Each side has an eventfd
+ * used as a level triggered flag: readable when a period can be transferred.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/eventfd.h>
+
+#include "pcm.h"
+#include "log.h"
+
+struct mem_channel {
+    struct mem_channel *next;
+    char name[64];
+    int refcount;
+
+    pthread_mutex_t lock;
+    snd_pcm_format_t format;
+    unsigned channels;
+    unsigned frame_bytes;
+    snd_pcm_uframes_t period;
+    snd_pcm_uframes_t latency;
+    snd_pcm_uframes_t capacity;
+    snd_pcm_uframes_t head;         /* next frame written */
+    snd_pcm_uframes_t fill;         /* frames ready to be captured */
+    uint8_t *ring;
+
+    int opened[2];                  /* per stream */
+    int ready_fd[2];
+    int ready[2];
+};
+
+struct pcm_mem {
+    struct pcm pcm;
+    struct mem_channel *ch;
+};
+
+#define MEM_CHANNEL(pcm) (((struct pcm_mem *)(pcm))->ch)
+
+static struct mem_channel *channels = NULL;
+static pthread_mutex_t channels_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/* under ch->lock */
+static void ready_set( struct mem_channel *ch, snd_pcm_stream_t stream, int ready ) {
+    uint64_t v = 1;
+
+    if (ch->ready[stream] == ready) return;
+    if (ready) {
+        if (write( ch->ready_fd[stream], &v, sizeof(v) ) != sizeof(v)) return;
+    } else {
+        if (read( ch->ready_fd[stream], &v, sizeof(v) ) != sizeof(v)) return;
+    }
+    ch->ready[stream] = ready;
+}
+
+/* under ch->lock */
+static void ready_update( struct mem_channel *ch ) {
+    /* without a capture, the frames are just dropped: the playback is never stuck */
+    if (!ch->opened[SND_PCM_STREAM_CAPTURE]) ch->fill = 0;
+    ready_set( ch, SND_PCM_STREAM_PLAYBACK, ch->capacity - ch->fill >= ch->period );
+    ready_set( ch, SND_PCM_STREAM_CAPTURE, ch->fill >= ch->period );
+}
+
+/* under ch->lock */
+static void ring_reset( struct mem_channel *ch ) {
+    snd_pcm_format_set_silence( ch->format, ch->ring, ch->latency * ch->channels );
+    ch->head = ch->latency;
+    ch->fill = ch->latency;
+    ready_update( ch );
+}
+
+/* copy 'frames' frames between 'buff' and the ring, starting at 'pos' */
+static void ring_copy( struct mem_channel *ch, snd_pcm_uframes_t pos, uint8_t *buff, snd_pcm_uframes_t frames, int to_ring ) {
+    while (frames) {
+        snd_pcm_uframes_t n = ch->capacity - pos;
+        uint8_t *r = ch->ring + pos * ch->frame_bytes;
+        if (n > frames) n = frames;
+        if (to_ring)
+            memcpy( r, buff, n * ch->frame_bytes );
+        else
+            memcpy( buff, r, n * ch->frame_bytes );
+        buff += n * ch->frame_bytes;
+        frames -= n;
+        pos = 0;
+    }
+}
+
+
+static void channel_put( struct mem_channel *ch, snd_pcm_stream_t stream ) {
+    struct mem_channel **pp;
+
+    pthread_mutex_lock( &channels_lock );
+    pthread_mutex_lock( &ch->lock );
+    ch->opened[stream] = 0;
+    ready_update( ch );
+    pthread_mutex_unlock( &ch->lock );
+
+    if (--ch->refcount == 0) {
+        for (pp = &channels; *pp; pp = &(*pp)->next) {
+            if (*pp == ch) {
+                *pp = ch->next;
+                break;
+            }
+        }
+        close( ch->ready_fd[0] );
+        close( ch->ready_fd[1] );
+        pthread_mutex_destroy( &ch->lock );
+        free( ch->ring );
+        free( ch );
+    }
+    pthread_mutex_unlock( &channels_lock );
+}
+
+static struct mem_channel *channel_get( const char *name, snd_pcm_uframes_t latency, snd_pcm_stream_t stream, struct alsa_config *config, snd_pcm_uframes_t buffer_size ) {
+    unsigned frame_bytes = config->channels * snd_pcm_format_physical_width( config->format ) / 8;
+    struct mem_channel *ch;
+
+    pthread_mutex_lock( &channels_lock );
+    for (ch = channels; ch; ch = ch->next) {
+        if (!strcmp( ch->name, name )) break;
+    }
+    if (ch) {
+        if ((ch->format != config->format) || (ch->channels != config->channels) || (ch->period != config->period)) {
+            err("mem:%s: format, channels and period must be the same on both sides", name);
+            goto failed;
+        }
+        if (ch->opened[stream]) {
+            err("mem:%s: %s already opened", name, snd_pcm_stream_name( stream ));
+            goto failed;
+        }
+    } else {
+        ch = calloc( 1, sizeof(*ch) );
+        if (!ch) goto failed;
+        strncpy( ch->name, name, sizeof(ch->name)-1 );
+        pthread_mutex_init( &ch->lock, NULL );
+        ch->format = config->format;
+        ch->channels = config->channels;
+        ch->frame_bytes = frame_bytes;
+        ch->period = config->period;
+        ch->latency = latency;
+        ch->capacity = buffer_size + latency + config->period;
+        ch->ring = malloc( ch->capacity * frame_bytes );
+        ch->ready_fd[0] = eventfd( 0, EFD_CLOEXEC | EFD_NONBLOCK );
+        ch->ready_fd[1] = eventfd( 0, EFD_CLOEXEC | EFD_NONBLOCK );
+        if (!ch->ring || (ch->ready_fd[0] < 0) || (ch->ready_fd[1] < 0)) {
+            err("mem:%s: %s", name, strerror(errno));
+            if (ch->ready_fd[0] >= 0) close( ch->ready_fd[0] );
+            if (ch->ready_fd[1] >= 0) close( ch->ready_fd[1] );
+            free( ch->ring );
+            free( ch );
+            goto failed;
+        }
+        ch->next = channels;
+        channels = ch;
+    }
+    ch->refcount++;
+
+    pthread_mutex_lock( &ch->lock );
+    ch->opened[stream] = 1;
+    ring_reset( ch );
+    pthread_mutex_unlock( &ch->lock );
+    pthread_mutex_unlock( &channels_lock );
+    return ch;
+
+failed:
+    pthread_mutex_unlock( &channels_lock );
+    return NULL;
+}
+
+
+static void mem_close( struct pcm *pcm ) {
+    channel_put( MEM_CHANNEL(pcm), pcm->stream );
+    pcm_release( pcm );
+    free( pcm );
+}
+
+static int mem_poll_descriptor( struct pcm *pcm, struct pollfd *pfd ) {
+    pfd->fd = MEM_CHANNEL(pcm)->ready_fd[ pcm->stream ];
+    pfd->events = POLLIN;
+    pfd->revents = 0;
+    return 0;
+}
+
+static snd_pcm_sframes_t mem_rw( struct pcm *pcm, void *buff, snd_pcm_uframes_t frames ) {
+    struct mem_channel *ch = MEM_CHANNEL(pcm);
+    snd_pcm_uframes_t n;
+
+    pthread_mutex_lock( &ch->lock );
+    if (pcm->stream == SND_PCM_STREAM_PLAYBACK) {
+        n = ch->capacity - ch->fill;
+        if (n > frames) n = frames;
+        ring_copy( ch, ch->head, buff, n, 1 );
+        ch->head = (ch->head + n) % ch->capacity;
+        ch->fill += n;
+    } else {
+        n = ch->fill;
+        if (n > frames) n = frames;
+        ring_copy( ch, (ch->head + ch->capacity - ch->fill) % ch->capacity, buff, n, 0 );
+        ch->fill -= n;
+    }
+    ready_update( ch );
+    pthread_mutex_unlock( &ch->lock );
+
+    return n ? (snd_pcm_sframes_t)n : -EAGAIN;
+}
+
+static int mem_nop( struct pcm *pcm ) { return 0; }
+static int mem_recover( struct pcm *pcm, int err ) { return (err == -EAGAIN) ? 0 : err; }
+static int mem_link( struct pcm *pcm, struct pcm *other ) { return 0; }
+
+static int mem_drop( struct pcm *pcm ) {
+    struct mem_channel *ch = MEM_CHANNEL(pcm);
+
+    /* back to the initial latency, like a restart of both ends */
+    pthread_mutex_lock( &ch->lock );
+    ring_reset( ch );
+    pthread_mutex_unlock( &ch->lock );
+    return 0;
+}
+
+static int mem_status( struct pcm *pcm, snd_pcm_uframes_t *avail, snd_htimestamp_t *tstamp ) {
+    struct mem_channel *ch = MEM_CHANNEL(pcm);
+
+    pthread_mutex_lock( &ch->lock );
+    *avail = (pcm->stream == SND_PCM_STREAM_PLAYBACK) ? ch->capacity - ch->fill : ch->fill;
+    pthread_mutex_unlock( &ch->lock );
+    clock_gettime( CLOCK_MONOTONIC, tstamp );
+    return 0;
+}
+
+/* the ring never stops: nothing is lost by a recovery */
+static int mem_position( struct pcm *pcm, struct pcm_position *pos ) {
+    struct mem_channel *ch = MEM_CHANNEL(pcm);
+
+    pthread_mutex_lock( &ch->lock );
+    pos->avail = (pcm->stream == SND_PCM_STREAM_PLAYBACK) ? ch->capacity - ch->fill : ch->fill;
+    pthread_mutex_unlock( &ch->lock );
+    pos->state = SND_PCM_STATE_RUNNING;
+    memset( &pos->trigger, 0, sizeof(pos->trigger) );
+    return 0;
+}
+
+static const struct pcm_ops mem_ops = {
+    .close = mem_close,
+    .poll_descriptor = mem_poll_descriptor,
+    .transfer = pcm_rw_transfer,
+    .mmap_transfer = pcm_rw_mmap_transfer,
+    .prepare = mem_nop,
+    .start = mem_nop,
+    .drop = mem_drop,
+    .recover = mem_recover,
+    .status = mem_status,
+    .position = mem_position,
+    .link = mem_link,
+    .rw = mem_rw,
+};
+
+
+static struct pcm *mem_open( const char *name, snd_pcm_uframes_t latency, snd_pcm_stream_t stream, struct alsa_config *config ) {
+    struct pcm_mem *pm = calloc( 1, sizeof(*pm) );
+
+    if (!pm || pcm_init( &pm->pcm, &mem_ops, stream, config )) {
+        err("%s: out of memory", config->device);
+        if (pm) pcm_release( &pm->pcm );
+        free( pm );
+        return NULL;
+    }
+    pm->ch = channel_get( name, latency, stream, config, pm->pcm.buffer_size );
+    if (!pm->ch) {
+        pcm_release( &pm->pcm );
+        free( pm );
+        return NULL;
+    }
+    return &pm->pcm;
+}
+
+int pcm_mem_open( const char *spec, struct alsa_config *config, struct pcm **capture, struct pcm **playback ) {
+    char name[64];
+    const char *opt;
+    unsigned latency = 0;
+    size_t len;
+
+    opt = strchr( spec, ',' );
+    len = opt ? (size_t)(opt - spec) : strlen( spec );
+    if (!len || (len >= sizeof(name))) {
+        err("%s: invalid mem device name", config->device);
+        return -1;
+    }
+    memcpy( name, spec, len );
+    name[len] = '\0';
+    if (opt && (sscanf( opt, ",latency=%u", &latency ) != 1)) {
+        err("%s: invalid option '%s'", config->device, opt + 1);
+        return -1;
+    }
+    if (!config->period) {
+        err("%s: a period size is required", config->device);
+        return -1;
+    }
+
+    if (capture && !(*capture = mem_open( name, latency, SND_PCM_STREAM_CAPTURE, config ))) return -1;
+    if (playback && !(*playback = mem_open( name, latency, SND_PCM_STREAM_PLAYBACK, config ))) {
+        if (capture) {
+            pcm_close( *capture );
+            *capture = NULL;
+        }
+        return -1;
+    }
+    return 0;
+}
@@ -12,16 +12,64 @@
 #include "log.h"
 
 
+static void playback_mmap_fill( void *data, void * const *planes, snd_pcm_uframes_t count ) {
+    struct test_playback *tp = (struct test_playback *)data;
+    uint64_t t0 = hist_now_ns();
+    if (alsa_access_is_planar( tp->t.config.access ))
+        seq_fill_frames_planar( &tp->seq, planes, count );
+    else
+        seq_fill_frames( &tp->seq, planes[0], count );
+    tp->stats.seq_ns += hist_now_ns() - t0;
+}
+
+/*
+ * queue one period of the sequence.
+ * in RW access, 'refill' set to 0 writes the previous period again (after an xrun)
+ * in mmap access, the frames are always generated in the ring, since nothing was
+ * committed on failure.
+ *
+ * return the number of frames written or a negative error code
+ */
+static snd_pcm_sframes_t playback_write_period( struct test_playback *tp, int refill ) {
+    uint64_t t0 = hist_now_ns();
+    snd_pcm_sframes_t frames;
+
+    if (alsa_access_is_mmap( tp->t.config.access )) {
+        frames = pcm_mmap_transfer( tp->pcm, tp->t.config.period, playback_mmap_fill, tp );
+    } else {
+        if (refill) {
+            if (tp->period_planes)
+                seq_fill_frames_planar( &tp->seq, tp->period_planes, tp->t.config.period );
+            else
+                seq_fill_frames( &tp->seq, tp->periof_buff, tp->t.config.period );
+            tp->stats.seq_ns = hist_now_ns() - t0;
+        }
+        if (tp->period_planes)
+            frames = pcm_writen(tp->pcm, tp->period_planes, tp->t.config.period);
+        else
+            frames = pcm_writei(tp->pcm, tp->periof_buff, tp->t.config.period);
+    }
+    period_stats_record( &tp->stats, hist_now_ns() - t0 );
+    if (frames > 0) {
+        tp->frames_written += frames;
+        drift_rate_update( &tp->drift, tp->pcm, SND_PCM_STREAM_PLAYBACK, tp->frames_written );
+    }
+    return frames;
+}
+
+
 /*
  * feed the PCM with new samples
  */
 static void playback_io_job( struct ev_loop *loop, struct ev_io *w, int revents ) {
 
     struct test_playback *tp = (struct test_playback *)(w->data);
+    snd_pcm_sframes_t frames;
+
+    test_wakeup_record( &tp->t, tp->pcm, &tp->stats.wakeup );
 
     /* simply fill a first period */
-    seq_fill_frames( &tp->seq, tp->periof_buff, tp->t.config.period );
-    snd_pcm_sframes_t frames = snd_pcm_writei(tp->pcm, tp->periof_buff, tp->t.config.period);
+    frames = playback_write_period( tp, 1 );
 
     if (frames < 0) {
         warn("%s: playback write failed: %s", tp->t.device, snd_strerror(frames));
@@ -30,15 +78,17 @@ static void playback_io_job( struct ev_loop *loop, struct ev_io *w, int revents
             ev_unloop(loop, EVUNLOOP_ALL);
             return;
         }
-        snd_pcm_recover(tp->pcm, frames, 0);
+        test_xrun( &tp->t );
+        pcm_recover( tp->pcm, frames );
 
         /* write again the period to start the stream again */
-        frames = snd_pcm_writei(tp->pcm, tp->periof_buff, tp->t.config.period);
+        frames = playback_write_period( tp, 0 );
         if (frames < 0) {
             err("%s: playback write failed after recover: %s", tp->t.device, snd_strerror(frames));
             ev_unloop(loop, EVUNLOOP_ALL);
             return;
         }
+        recovery_start( &tp->recovery );
     } else if (frames != tp->t.config.period) {
         err("%s: playback write less than the expected period size: %ld / %u", tp->t.device, frames, tp->t.config.period);
 
@@ -65,6 +115,8 @@ static void playback_timer( struct ev_loop *loop, struct ev_timer *w, int revent
     case PT_W4_XRUN_END:
         warn("%s: PT_W4_XRUN_END", tp->t.device);
         ev_io_start( loop, &tp->io_watcher );
+        /* timed from here if the stream didn't xrun, else from its recovery by the io job */
+        recovery_start( &tp->recovery );
         tp->timer_state = PT_W4_XRUN;
         ev_timer_set( &tp->timer, tp->opts.xrun*1e-3, 0);
         ev_timer_start( loop, &tp->timer );
@@ -72,7 +124,7 @@ static void playback_timer( struct ev_loop *loop, struct ev_timer *w, int revent
 
     case PT_W4_STOP:
         warn("%s: PT_W4_STOP", tp->t.device);
-        snd_pcm_drop( tp->pcm );
+        pcm_drop( tp->pcm );
         ev_io_stop( loop, &tp->io_watcher );
         tp->timer_state = PT_W4_RESTART;
         ev_timer_set( &tp->timer, tp->opts.restart_pause_time * 1e-3, 0);
@@ -81,10 +133,11 @@ static void playback_timer( struct ev_loop *loop, struct ev_timer *w, int revent
 
     case PT_W4_RESTART: {
         warn("%s: PT_W4_RESTART", tp->t.device);
+        /* the stream startup counts in its recovery time */
+        recovery_start( &tp->recovery );
         /* simply fill a first period */
-        seq_fill_frames( &tp->seq, tp->periof_buff, tp->t.config.period );
-        snd_pcm_prepare(tp->pcm);
-        snd_pcm_sframes_t frames = snd_pcm_writei(tp->pcm, tp->periof_buff, tp->t.config.period);
+        pcm_prepare(tp->pcm);
+        snd_pcm_sframes_t frames = playback_write_period( tp, 1 );
         if (frames > 0) {
             ev_io_start( loop, &tp->io_watcher );
             tp->timer_state = PT_W4_STOP;
@@ -103,26 +156,25 @@ static int playback_start(struct test *t) {
     struct test_playback *tp = (struct test_playback *)t;
     /* simply fill a first period */
     dbg("%s: playback_start", tp->t.device);
-    seq_fill_frames( &tp->seq, tp->periof_buff, tp->t.config.period );
-    snd_pcm_sframes_t frames = snd_pcm_writei(tp->pcm, tp->periof_buff, tp->t.config.period);
+    snd_pcm_sframes_t frames = playback_write_period( tp, 1 );
 
     if (frames > 0) {
-        ev_io_start( loop, &tp->io_watcher );
+        ev_io_start( tp->t.loop, &tp->io_watcher );
         if (tp->opts.xrun) {
             dbg("%s: will simulate xrun every %d ms", tp->t.device, tp->opts.xrun);
             tp->timer_state = PT_W4_XRUN;
             ev_timer_set( &tp->timer, tp->opts.xrun * 1e-3, 0);
-            ev_timer_start( loop, &tp->timer );
+            ev_timer_start( tp->t.loop, &tp->timer );
         } else if (tp->opts.restart_play_time && tp->opts.restart_pause_time) {
             dbg("%s: will stop every %d ms during %d ms", tp->t.device, tp->opts.restart_play_time, tp->opts.restart_pause_time);
             tp->timer_state = PT_W4_STOP;
             ev_timer_set( &tp->timer, tp->opts.restart_play_time * 1e-3, 0);
-            ev_timer_start( loop, &tp->timer );
+            ev_timer_start( tp->t.loop, &tp->timer );
         }
 
     } else {
         err("%s: playback_start failure (%s)", tp->t.device, snd_strerror(frames));
-        ev_unloop(loop, EVUNLOOP_ALL);
+        ev_unloop(tp->t.loop, EVUNLOOP_ALL);
     }
 
 
@@ -132,10 +184,12 @@ static int playback_start(struct test *t) {
 static int playback_close(struct test *t) {
     struct test_playback *tp = (struct test_playback *)t;
 
-    ev_io_stop( loop, &tp->io_watcher );
-    ev_timer_stop( loop, &tp->timer );
-    snd_pcm_close( tp->pcm );
+    ev_io_stop( tp->t.loop, &tp->io_watcher );
+    ev_timer_stop( tp->t.loop, &tp->timer );
+    pcm_close( tp->pcm );
 
+    seq_free( &tp->seq );
+    free( tp->period_planes );
     free( tp->periof_buff );
     free( tp );
     return 0;
@@ -143,9 +197,18 @@ static int playback_close(struct test *t) {
 
 
 
+static void playback_report(struct test *t) {
+    struct test_playback *tp = (struct test_playback *)t;
+    period_stats_report( &tp->stats, tp->t.device, "playback" );
+    drift_report( &tp->drift, tp->t.device, "playback" );
+    recovery_report( &tp->recovery, tp->t.device, "playback" );
+}
+
+
 const struct test_ops playback_ops = {
         .start = playback_start,
         .close = playback_close,
+        .report = playback_report,
 };
 
 
@@ -164,22 +227,26 @@ struct test *playback_create(struct alsa_config *config, struct playback_create_
     memcpy( &tp->t.config, config, sizeof(*config));
     memcpy( tp->t.device, config->device, sizeof(tp->t.device) );
 
-    r = alsa_device_open( tp->t.config.device, &tp->t.config, NULL, &tp->pcm );
+    r = pcm_open( tp->t.config.device, &tp->t.config, NULL, &tp->pcm );
     if (r) goto failed1;
 
-    seq_init( &tp->seq, tp->t.config.channels, tp->t.config.format );
-    tp->periof_buff = malloc( snd_pcm_frames_to_bytes( tp->pcm, tp->t.config.period ));
-    if (!tp->periof_buff) goto failed;
-
-    r = snd_pcm_poll_descriptors_count(tp->pcm);
-    if (r != 1) {
-        err("playback_create: expect only 1 fd to monitor (snd_pcm_poll_descriptors_count)");
-        goto failed;
+    if (seq_init( &tp->seq, tp->t.config.channels, tp->t.config.format )) goto failed;
+    drift_init( &tp->drift, tp->pcm, tp->t.config.rate, tp->t.config.period );
+    recovery_init( &tp->recovery, tp->t.config.rate );
+    tp->t.recovery = &tp->recovery;
+    if (!alsa_access_is_mmap( tp->t.config.access )) {
+        /* mmap access: the frames are generated directly in the DMA ring */
+        tp->periof_buff = malloc( pcm_frames_to_bytes( tp->pcm, tp->t.config.period ));
+        if (!tp->periof_buff) goto failed;
+        if (alsa_access_is_planar( tp->t.config.access )) {
+            tp->period_planes = alsa_planes_split( &tp->t.config, tp->periof_buff, tp->t.config.period );
+            if (!tp->period_planes) goto failed;
+        }
     }
 
-    r = snd_pcm_poll_descriptors(tp->pcm, &tp->pollfd, 1);
+    r = pcm_poll_descriptor( tp->pcm, &tp->pollfd );
     if (r < 0) {
-        err("%s: snd_pcm_poll_descriptors failed", tp->t.device);
+        err("%s: pcm_poll_descriptor failed", tp->t.device);
         goto failed;
     }
 
@@ -197,7 +264,9 @@ struct test *playback_create(struct alsa_config *config, struct playback_create_
     return &tp->t;
 
 failed:
-    snd_pcm_close( tp->pcm );
+    pcm_close( tp->pcm );
+    seq_free( &tp->seq );
+    free(tp->period_planes);
     free(tp->periof_buff);
 failed1:
     free(tp);
@@ -14,7 +14,11 @@
 #include <ev.h>
 
 #include "test.h"
+#include "pcm.h"
 #include "seq.h"
+#include "hist.h"
+#include "drift.h"
+#include "recovery.h"
 
 struct playback_create_opts {
     int xrun;
@@ -26,9 +30,16 @@ struct playback_create_opts {
 
 struct test_playback {
     struct test t;
-    snd_pcm_t *pcm;
+    struct pcm *pcm;
     struct seq_info seq;
     void *periof_buff;
+    void **period_planes;   /* non interleaved RW access: channel buffers of periof_buff */
+    struct period_stats stats;
+    struct drift drift;
+    unsigned long long frames_written;
+
+    /* timed by the capture test checking the frames, if any (see test.peer_recovery) */
+    struct recovery recovery;
 
     struct pollfd pollfd;
     struct ev_io io_watcher;
@@ -0,0 +1,193 @@
+/*
+ * Copyright (C) 2015 Arnaud Mouiche <arnaud.mouiche@invoxia.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "record.h"
+#include "seq.h"
+#include "alsa.h"
+#include "log.h"
+
+
+static void record_slot_write( struct record *rec, struct record_slot *slot ) {
+    if (slot->dropped)
+        fprintf( rec->meta, "dropped %llu %llu\n", rec->position, slot->dropped );
+    if (slot->resync)
+        fprintf( rec->meta, "resync %llu %lu %u\n", rec->position, slot->resync_lost, slot->resync_tolerance );
+    else if (slot->jump)
+        fprintf( rec->meta, "jump %llu\n", rec->position );
+    if (fwrite( slot->buff, rec->frame_bytes, slot->frames, rec->data ) != slot->frames) {
+        if (!rec->write_error) err("record: write failed: %s", strerror(errno));
+        rec->write_error = 1;
+    }
+    rec->position += slot->frames;
+}
+
+static void *record_thread( void *arg ) {
+    struct record *rec = (struct record *)arg;
+
+    while (1) {
+        int stopping;
+        unsigned head;
+
+        while (sem_wait( &rec->ready ) && (errno == EINTR));
+        stopping = __atomic_load_n( &rec->stopping, __ATOMIC_ACQUIRE );
+
+        head = __atomic_load_n( &rec->head, __ATOMIC_ACQUIRE );
+        while (rec->tail != head) {
+            record_slot_write( rec, &rec->slots[ rec->tail % rec->slot_count ] );
+            __atomic_store_n( &rec->tail, rec->tail + 1, __ATOMIC_RELEASE );
+        }
+        if (stopping) break;
+    }
+    return NULL;
+}
+
+
+struct record *record_open( const char *path, snd_pcm_format_t format, unsigned channels,
+        unsigned rate, snd_pcm_uframes_t period, unsigned seconds ) {
+    struct record *rec = calloc( 1, sizeof(*rec) );
+    char meta_path[ 1024 ];
+    unsigned i;
+
+    if (!rec) return NULL;
+    rec->channels = channels;
+    rec->sample_bytes = snd_pcm_format_physical_width( format ) / 8;
+    rec->frame_bytes = channels * rec->sample_bytes;
+    rec->slot_frames = period;
+    rec->slot_count = (unsigned long long)rate * seconds / period;
+    if (rec->slot_count < 16) rec->slot_count = 16;
+
+    rec->data = fopen( path, "w" );
+    if (!rec->data) {
+        err("record: can't create '%s': %s", path, strerror(errno));
+        goto failed;
+    }
+    snprintf( meta_path, sizeof(meta_path), "%s.meta", path );
+    rec->meta = fopen( meta_path, "w" );
+    if (!rec->meta) {
+        err("record: can't create '%s': %s", meta_path, strerror(errno));
+        goto failed;
+    }
+    setvbuf( rec->data, NULL, _IOFBF, 1024 * 1024 );
+    fprintf( rec->meta, "format %s\nchannels %u\nrate %u\nperiod %lu\n",
+            snd_pcm_format_name( format ), channels, rate, (unsigned long)period );
+    if (seq_encoding != SEQ_ENCODING_SEQ)
+        fprintf( rec->meta, "encoding %s\n", seq_encoding_name( seq_encoding ) );
+
+    /* everything is allocated now: no allocation from the capture thread */
+    rec->slots = calloc( rec->slot_count, sizeof(*rec->slots) );
+    if (!rec->slots) goto failed;
+    for (i = 0; i < rec->slot_count; i++) {
+        rec->slots[i].buff = malloc( period * rec->frame_bytes );
+        if (!rec->slots[i].buff) {
+            err("record: out of memory");
+            goto failed;
+        }
+    }
+
+    sem_init( &rec->ready, 0, 0 );
+    if (pthread_create( &rec->thread, NULL, record_thread, rec )) {
+        err("record: can't create the writer thread");
+        sem_destroy( &rec->ready );
+        goto failed;
+    }
+    return rec;
+
+failed:
+    if (rec->slots) {
+        for (i = 0; i < rec->slot_count; i++) free( rec->slots[i].buff );
+        free( rec->slots );
+    }
+    if (rec->meta) fclose( rec->meta );
+    if (rec->data) fclose( rec->data );
+    free( rec );
+    return NULL;
+}
+
+
+void record_frames( struct record *rec, const void * const *planes, snd_pcm_uframes_t count, int planar ) {
+    struct record_slot *slot;
+
+    if (count > rec->slot_frames) count = rec->slot_frames;
+    if (rec->head - __atomic_load_n( &rec->tail, __ATOMIC_ACQUIRE ) >= rec->slot_count) {
+        /* the writer is late: don't wait for it */
+        rec->pending_dropped += count;
+        rec->dropped_total += count;
+        return;
+    }
+
+    slot = &rec->slots[ rec->head % rec->slot_count ];
+    if (planar)
+        alsa_planes_interleave( slot->buff, planes, rec->channels, rec->sample_bytes, count );
+    else
+        memcpy( slot->buff, planes[0], count * rec->frame_bytes );
+    slot->frames = count;
+    slot->jump = rec->pending_jump;
+    slot->resync = rec->pending_resync;
+    slot->resync_lost = rec->pending_resync_lost;
+    slot->resync_tolerance = rec->pending_resync_tolerance;
+    slot->dropped = rec->pending_dropped;
+    rec->pending_jump = 0;
+    rec->pending_resync = 0;
+    rec->pending_dropped = 0;
+
+    __atomic_store_n( &rec->head, rec->head + 1, __ATOMIC_RELEASE );
+    sem_post( &rec->ready );
+}
+
+
+void record_jump( struct record *rec ) {
+    rec->pending_jump = 1;
+    rec->pending_resync = 0;
+}
+
+
+void record_resync( struct record *rec, unsigned long lost, unsigned tolerance ) {
+    /* after a jump with no frame since, the checker has nothing to predict from: a plain jump */
+    if (rec->pending_jump) {
+        rec->pending_resync = 0;
+        return;
+    }
+    rec->pending_jump = 1;
+    rec->pending_resync = 1;
+    rec->pending_resync_lost = lost;
+    rec->pending_resync_tolerance = tolerance;
+}
+
+
+void record_close( struct record *rec ) {
+    unsigned i;
+
+    __atomic_store_n( &rec->stopping, 1, __ATOMIC_RELEASE );
+    sem_post( &rec->ready );
+    pthread_join( rec->thread, NULL );
+    sem_destroy( &rec->ready );
+
+    /* events after the last recorded frames */
+    if (rec->pending_dropped)
+        fprintf( rec->meta, "dropped %llu %llu\n", rec->position, rec->pending_dropped );
+    if (rec->pending_resync)
+        fprintf( rec->meta, "resync %llu %lu %u\n", rec->position, rec->pending_resync_lost, rec->pending_resync_tolerance );
+    else if (rec->pending_jump)
+        fprintf( rec->meta, "jump %llu\n", rec->position );
+    if (rec->dropped_total)
+        warn("record: %llu frames dropped from the recording (writer too slow)", rec->dropped_total);
+
+    if (fclose( rec->data ) && !rec->write_error)
+        err("record: write failed: %s", strerror(errno));
+    fclose( rec->meta );
+
+    for (i = 0; i < rec->slot_count; i++) free( rec->slots[i].buff );
+    free( rec->slots );
+    free( rec );
+}
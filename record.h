@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2015 Arnaud Mouiche <arnaud.mouiche@invoxia.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ */
+
+#ifndef __record_h__
+#define __record_h__
+
+#include <stdio.h>
+#include <semaphore.h>
+#include <pthread.h>
+#include <alsa/asoundlib.h>
+
+/*
+ * Recording of the captured frames, for an offline check with 'atest verify'.
+ *
+ * FILE holds the raw interleaved frames, FILE.meta the stream description and
+ * the events the online checker saw, one per line, the frame positions being
+ * counted from the start of FILE:
+ *     format S16_LE
+ *     channels 2
+ *     rate 48000
+ *     period 960
+ *     jump POS             seq_check_jump_notify() called before frame POS (xrun, restart)
+ *     resync POS LOST TOL  seq_check_resync( LOST, TOL ) called before frame POS
+ *     dropped POS FRAMES   FRAMES were not recorded before frame POS (writer too slow)
+ *
+ * The capture thread only copies the periods in a ring of preallocated slots, the
+ * files are written by a separate thread.
+ */
+
+struct record_slot {
+    unsigned frames;
+    unsigned jump;                  /* a jump occurred before those frames */
+    unsigned resync;                /* the jump was a seq_check_resync() */
+    unsigned long resync_lost;
+    unsigned resync_tolerance;
+    unsigned long long dropped;     /* frames not recorded before those frames */
+    void *buff;
+};
+
+struct record {
+    FILE *data;
+    FILE *meta;
+    unsigned channels;
+    unsigned sample_bytes;
+    unsigned frame_bytes;
+    snd_pcm_uframes_t slot_frames;
+
+    /* single producer / single consumer ring */
+    struct record_slot *slots;
+    unsigned slot_count;
+    unsigned head;                  /* next slot filled by the capture thread */
+    unsigned tail;                  /* next slot written by the writer thread */
+    sem_t ready;
+    int stopping;
+    pthread_t thread;
+
+    /* producer side */
+    unsigned pending_jump;
+    unsigned pending_resync;
+    unsigned long pending_resync_lost;
+    unsigned pending_resync_tolerance;
+    unsigned long long pending_dropped;
+    unsigned long long dropped_total;
+
+    /* writer side */
+    unsigned long long position;    /* frames written in the data file */
+    int write_error;
+};
+
+/*
+ * create 'path' and 'path'.meta and start the writer thread.
+ * the ring holds about 'seconds' of frames, in slots of 'period' frames.
+ * return NULL on failure
+ */
+struct record *record_open( const char *path, snd_pcm_format_t format, unsigned channels,
+        unsigned rate, snd_pcm_uframes_t period, unsigned seconds );
+
+/*
+ * queue 'count' frames (at most one period), from the capture thread.
+ * 'planes' holds one buffer per channel if 'planar' is set, one interleaved buffer otherwise
+ * if the ring is full, the frames are dropped and the drop is noted in the meta file.
+ */
+void record_frames( struct record *rec, const void * const *planes, snd_pcm_uframes_t count, int planar );
+
+/* note a call to seq_check_jump_notify(), from the capture thread */
+void record_jump( struct record *rec );
+
+/* note a call to seq_check_resync(), from the capture thread */
+void record_resync( struct record *rec, unsigned long lost, unsigned tolerance );
+
+/* write the pending frames, stop the writer thread and close the files */
+void record_close( struct record *rec );
+
+#endif //__record_h__
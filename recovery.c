@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2015 Arnaud Mouiche <arnaud.mouiche@invoxia.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "recovery.h"
+
+
+void recovery_init( struct recovery *r, unsigned rate ) {
+    memset( r, 0, sizeof(*r) );
+    r->rate = rate;
+}
+
+
+void recovery_start( struct recovery *r ) {
+    if (!__atomic_exchange_n( &r->recovered_ns, hist_now_ns(), __ATOMIC_RELAXED ))
+        __atomic_store_n( &r->events, r->events + 1, __ATOMIC_RELAXED );
+}
+
+
+uint64_t recovery_update( struct recovery *r, const struct seq_info *seq, unsigned frames ) {
+    uint64_t recovered = __atomic_load_n( &r->recovered_ns, __ATOMIC_RELAXED );
+    uint64_t now, first, latency;
+    unsigned run;
+
+    if (!recovered || (seq->state != VALID_FRAME) || !seq->valid_run)
+        return 0;
+
+    /*
+     * the last frame of the period was received about now. A run longer than the period
+     * started before it: only frames received after the recovery count
+     */
+    now = hist_now_ns();
+    run = (seq->valid_run < frames) ? seq->valid_run : frames;
+    first = now - (uint64_t)(run - 1) * 1000000000ull / r->rate;
+    latency = (first > recovered) ? first - recovered : 0;
+
+    /* the producer may have recovered again meanwhile: then this one is measured later */
+    if (!__atomic_compare_exchange_n( &r->recovered_ns, &recovered, 0, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED ))
+        return 0;
+    hist_record( &r->latency, latency );
+    /* 0 is reserved for "nothing measured" */
+    return latency ? latency : 1;
+}
+
+
+void recovery_report( struct recovery *r, const char *device, const char *name ) {
+    uint64_t n = __atomic_load_n( &r->latency.total, __ATOMIC_RELAXED );
+    unsigned events = __atomic_load_n( &r->events, __ATOMIC_RELAXED );
+
+    if (!events)
+        return;
+    if (!n) {
+        printf("%s %s recovery: not measured (%u events)\n", device, name, events);
+        return;
+    }
+    printf("%s %s recovery n=%llu/%u p50=%.2fms p99=%.2fms p99.9=%.2fms max=%.2fms\n",
+            device, name, (unsigned long long)n, events,
+            hist_percentile( &r->latency, 50 ) * 1e-6,
+            hist_percentile( &r->latency, 99 ) * 1e-6,
+            hist_percentile( &r->latency, 99.9 ) * 1e-6,
+            __atomic_load_n( &r->latency.max, __ATOMIC_RELAXED ) * 1e-6);
+}
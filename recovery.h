@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2015 Arnaud Mouiche <arnaud.mouiche@invoxia.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ */
+
+#ifndef __recovery_h__
+#define __recovery_h__
+
+#include <alsa/asoundlib.h>
+
+#include "hist.h"
+#include "seq.h"
+
+/*
+ * time a stream takes to carry the sequence again after an interruption (xrun,
+ * stop/restart): from the recovery (pcm_recover(), or pcm_prepare() and pcm_start())
+ * to the first valid frame seen by the checker afterwards.
+ *
+ * the checker is only read once per period, but seq_info.valid_run locates the first
+ * valid frame within the period: the frame is dated from the end of the period, at the
+ * nominal rate.
+ */
+struct recovery {
+    struct hist latency;    /* ns */
+    unsigned rate;
+
+    /* recoveries waiting for their first valid frame, measured or not (atomic) */
+    unsigned events;
+
+    /* time of the recovery in progress, 0 if none (atomic) */
+    uint64_t recovered_ns;
+};
+
+void recovery_init( struct recovery *r, unsigned rate );
+
+/*
+ * recovery_start() and recovery_update() can be called from different threads, when
+ * the stream is produced by one test and checked by another (see test.peer_recovery).
+ * the histogram has a single writer, the checker.
+ */
+
+/*
+ * the stream was just recovered: time it until its first valid frame.
+ * a recovery still in progress is restarted from now, without counting a new event
+ */
+void recovery_start( struct recovery *r );
+
+/*
+ * to be called after every period of 'frames' frames checked by 'seq'.
+ * return the recovery latency in ns if this period ends it, 0 otherwise
+ */
+uint64_t recovery_update( struct recovery *r, const struct seq_info *seq, unsigned frames );
+
+/* print p50/p99/p99.9/max of the recovery latency. nothing if the stream was never recovered */
+void recovery_report( struct recovery *r, const char *device, const char *name );
+
+#endif //__recovery_h__
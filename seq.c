@@ -10,58 +10,161 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <endian.h>
+#include <math.h>
 #include <alsa/asoundlib.h>
 
 #include "seq.h"
+#include "seq_simd.h"
+#include "classify.h"
 #include "log.h"
 
-unsigned seq_errors_total = 0;
-void (*seq_error_notify)(void) = NULL;
 unsigned seq_consecutive_invalid_frames_log = 1;
 unsigned seq_max_consecutive_invalid_frames_before_null_warning = 4;
+enum seq_encoding seq_encoding = SEQ_ENCODING_SEQ;
 
-#define FRAME_NUM_MASK   0x7FF
-#define FRAME_NUM_SHIFT  5
-#define CHANNEL_MASK     0x1F  /* up to 32 channels */
+/* biggest pattern table allocated by seq_init(). S16 always fits */
+#define PATTERN_MAX_BYTES  (1 << 20)
 
-void seq_init( struct seq_info *seq, unsigned channels, snd_pcm_format_t format )
-{
-    memset( seq, 0, sizeof(*seq));
-    seq->channels = channels;
-    seq->format = format;
-    seq->frame_num = 0;
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+
+
+/*
+ * sample accessors.
+ * get_*() return the significant bits of the sample, put_*() store them.
+ */
+typedef uint32_t (*sample_get_fn)( const uint8_t *sample );
+typedef void (*sample_put_fn)( uint8_t *sample, uint32_t v );
+
+static ALWAYS_INLINE uint32_t get_s16_le( const uint8_t *p ) { uint16_t v; memcpy( &v, p, 2 ); return le16toh( v ); }
+static ALWAYS_INLINE uint32_t get_s16_be( const uint8_t *p ) { uint16_t v; memcpy( &v, p, 2 ); return be16toh( v ); }
+static ALWAYS_INLINE uint32_t get_s24_le( const uint8_t *p ) { uint32_t v; memcpy( &v, p, 4 ); return le32toh( v ) & 0xFFFFFF; }
+static ALWAYS_INLINE uint32_t get_s24_be( const uint8_t *p ) { uint32_t v; memcpy( &v, p, 4 ); return be32toh( v ) & 0xFFFFFF; }
+static ALWAYS_INLINE uint32_t get_s24_3le( const uint8_t *p ) { return p[0] | (p[1] << 8) | (p[2] << 16); }
+static ALWAYS_INLINE uint32_t get_s24_3be( const uint8_t *p ) { return p[2] | (p[1] << 8) | (p[0] << 16); }
+static ALWAYS_INLINE uint32_t get_s32_le( const uint8_t *p ) { uint32_t v; memcpy( &v, p, 4 ); return le32toh( v ); }
+static ALWAYS_INLINE uint32_t get_s32_be( const uint8_t *p ) { uint32_t v; memcpy( &v, p, 4 ); return be32toh( v ); }
+
+static ALWAYS_INLINE void put_s16_le( uint8_t *p, uint32_t v ) { uint16_t x = htole16( v ); memcpy( p, &x, 2 ); }
+static ALWAYS_INLINE void put_s16_be( uint8_t *p, uint32_t v ) { uint16_t x = htobe16( v ); memcpy( p, &x, 2 ); }
+/* S24 in a 32 bits container: sign extended to the upper byte */
+static ALWAYS_INLINE void put_s24_le( uint8_t *p, uint32_t v ) { uint32_t x = htole32( (uint32_t)((int32_t)(v << 8) >> 8) ); memcpy( p, &x, 4 ); }
+static ALWAYS_INLINE void put_s24_be( uint8_t *p, uint32_t v ) { uint32_t x = htobe32( (uint32_t)((int32_t)(v << 8) >> 8) ); memcpy( p, &x, 4 ); }
+static ALWAYS_INLINE void put_s24_3le( uint8_t *p, uint32_t v ) { p[0] = v; p[1] = v >> 8; p[2] = v >> 16; }
+static ALWAYS_INLINE void put_s24_3be( uint8_t *p, uint32_t v ) { p[2] = v; p[1] = v >> 8; p[0] = v >> 16; }
+static ALWAYS_INLINE void put_s32_le( uint8_t *p, uint32_t v ) { uint32_t x = htole32( v ); memcpy( p, &x, 4 ); }
+static ALWAYS_INLINE void put_s32_be( uint8_t *p, uint32_t v ) { uint32_t x = htobe32( v ); memcpy( p, &x, 4 ); }
+
+/*
+ * FLOAT: the 24 bits value, sign extended, divided by 2^23.
+ * Every such value is exactly representable.
+ * Out of range samples are returned with bits above the 24 bits set: never valid.
+ */
+static ALWAYS_INLINE uint32_t float_to_value( uint32_t bits ) {
+    float f;
+    memcpy( &f, &bits, 4 );
+    if (!((f >= -1.0f) && (f < 1.0f))) return 0xFFFFFFFF;
+    return (uint32_t)(int32_t)lrintf( f * 8388608.0f ) & 0xFFFFFF;
+}
+static ALWAYS_INLINE uint32_t value_to_float( uint32_t v ) {
+    float f = (float)((int32_t)(v << 8) >> 8) / 8388608.0f;
+    uint32_t bits;
+    memcpy( &bits, &f, 4 );
+    return bits;
 }
+static ALWAYS_INLINE uint32_t get_float_le( const uint8_t *p ) { uint32_t v; memcpy( &v, p, 4 ); return float_to_value( le32toh( v ) ); }
+static ALWAYS_INLINE uint32_t get_float_be( const uint8_t *p ) { uint32_t v; memcpy( &v, p, 4 ); return float_to_value( be32toh( v ) ); }
+static ALWAYS_INLINE void put_float_le( uint8_t *p, uint32_t v ) { uint32_t x = htole32( value_to_float( v ) ); memcpy( p, &x, 4 ); }
+static ALWAYS_INLINE void put_float_be( uint8_t *p, uint32_t v ) { uint32_t x = htobe32( value_to_float( v ) ); memcpy( p, &x, 4 ); }
 
 
-void seq_reset( struct seq_info *seq )
-{
-    seq->frame_num = 0;
-    seq->state = NULL_FRAME;
-    seq->prev_state = NULL_FRAME;
+/*
+ * vectorized match of the frames following the expected sequence.
+ * only available for S16 in the host endianness
+ */
+typedef int (*fast_match_fn)( const void *buff, unsigned channels, unsigned frame_num, unsigned mask, int frame_count );
+
+static int fast_match_s16( const void *buff, unsigned channels, unsigned frame_num, unsigned mask, int frame_count ) {
+    return seq_simd_match_s16( (const int16_t *)buff, channels, frame_num, mask, frame_count );
 }
 
+/* planar version: match the samples of the channel 'ch' buffer */
+typedef int (*fast_plane_match_fn)( const void *plane, unsigned ch, unsigned frame_num, unsigned mask, int frame_count );
 
-void seq_fill_frames( struct seq_info *seq, void *buff, int frame_count ) {
-    int16_t *s16;
-
-    switch (seq->format) {
-    case SND_PCM_FORMAT_S16_LE:
-        s16 = (int16_t *)buff;
-        while (frame_count--) {
-            int ch;
-            for (ch = 0; ch < seq->channels; ch++) {
-                *s16++ = (ch & CHANNEL_MASK) | ((seq->frame_num & FRAME_NUM_MASK) << FRAME_NUM_SHIFT);
-            }
-            seq->frame_num++;
+static int fast_plane_match_s16( const void *plane, unsigned ch, unsigned frame_num, unsigned mask, int frame_count ) {
+    return seq_simd_match_s16_plane( (const int16_t *)plane, ch, frame_num, mask, frame_count );
+}
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define FAST_MATCH_S16_LE fast_match_s16
+#define FAST_MATCH_S16_BE NULL
+#define FAST_PLANE_MATCH_S16_LE fast_plane_match_s16
+#define FAST_PLANE_MATCH_S16_BE NULL
+#define FAST_MSB_S16_FORMAT SND_PCM_FORMAT_S16_LE
+#else
+#define FAST_MATCH_S16_LE NULL
+#define FAST_MATCH_S16_BE fast_match_s16
+#define FAST_PLANE_MATCH_S16_LE NULL
+#define FAST_PLANE_MATCH_S16_BE fast_plane_match_s16
+#define FAST_MSB_S16_FORMAT SND_PCM_FORMAT_S16_BE
+#endif
+
+
+
+/*
+ * generate the frames sample per sample.
+ * 'channels', 'bytes' and 'put' are constants in every specialized kernel
+ */
+static ALWAYS_INLINE void fill_frames_tmpl( struct seq_info *seq, void *buff, int frame_count,
+        unsigned channels, unsigned bytes, sample_put_fn put ) {
+    uint8_t *p = (uint8_t *)buff;
+
+    while (frame_count--) {
+        unsigned ch;
+        for (ch = 0; ch < channels; ch++) {
+            put( p, SEQ_SAMPLE( ch, seq->frame_num, seq->frame_num_mask ) );
+            p += bytes;
         }
-        break;
+        seq->frame_num++;
+    }
+}
 
-    default:
-        /* format not implemented yet */
-        break;
+
+/*
+ * planar version: each channel buffer is generated as one contiguous vector
+ */
+static ALWAYS_INLINE void fill_planes_tmpl( struct seq_info *seq, void * const *planes, int frame_count,
+        unsigned channels, unsigned bytes, sample_put_fn put ) {
+    unsigned ch;
+    int i;
+
+    for (ch = 0; ch < channels; ch++) {
+        uint8_t *p = (uint8_t *)planes[ch];
+        for (i = 0; i < frame_count; i++) {
+            put( p, SEQ_SAMPLE( ch, seq->frame_num + i, seq->frame_num_mask ) );
+            p += bytes;
+        }
+    }
+    seq->frame_num += frame_count;
+}
+
+
+/*
+ * planar version of the fast path: how many leading samples of a channel buffer
+ * follow the expected sequence (the bits above the counter are not compared)
+ */
+static ALWAYS_INLINE int plane_match_tmpl( const uint8_t *p, unsigned ch, unsigned frame_num, unsigned mask,
+        int frame_count, unsigned bytes, sample_get_fn get ) {
+    const uint32_t keep = CHANNEL_MASK | (mask << FRAME_NUM_SHIFT);
+    int i;
+    for (i = 0; i < frame_count; i++) {
+        if ((get( p ) & keep) != SEQ_SAMPLE( ch, frame_num + i, mask )) break;
+        p += bytes;
     }
+    return i;
 }
 
+
 /*
  * compare the frame with a Null frame (full of 0x00 or 0xFF)
  * return 1 if this is the case, 0 otherwise
@@ -75,60 +178,598 @@ static int is_null_frame( const void *frame, int byte_size ) {
     return 1;
 }
 
+/*
+ * same for the frame #idx of planar buffers
+ */
+static int is_null_planar_frame( const uint8_t * const *planes, int idx, unsigned channels, unsigned bytes ) {
+    unsigned ch;
+    for (ch = 0; ch < channels; ch++) {
+        if (!is_null_frame( planes[ch] + idx * bytes, bytes )) return 0;
+    }
+    return 1;
+}
+
+
+/* samples per line of a frame dump, and lines dumped per frame */
+#define LOG_FRAME_SAMPLES  16
+#define LOG_FRAME_LINES    2
+
+static inline const uint8_t *frame_sample( struct seq_info *seq, const void *frame,
+        const uint8_t * const *planes, int idx, unsigned ch ) {
+    if (frame) return (const uint8_t *)frame + ch * seq->kernel->sample_bytes;
+    return planes[ch] + idx * seq->kernel->sample_bytes;
+}
+
+/*
+ * summary of a frame too wide to be dumped: the runs of slots holding consecutive
+ * channels, as decoded from their tag and bank, relative to the expected frame counter
+ * (seq->slot_ref), or to the counter of the first slot when unknown.
+ * A slipped TDM frame takes one or two runs instead of hundreds of samples.
+ */
+static void log_slots( enum log_level level, struct seq_info *seq, const void *frame,
+        const uint8_t * const *planes, int idx ) {
+    const unsigned mask = seq->frame_num_mask;
+    const unsigned fn = (seq->slot_ref != SEQ_SLOT_REF_NONE) ? seq->slot_ref & mask :
+        (seq->kernel->get( frame_sample( seq, frame, planes, idx, 0 ) ) >> FRAME_NUM_SHIFT) & mask;
+    char line[200];
+    int pos, start = 0, first = 0, runs = 0, slot;
+
+    strcpy( line, "  slot:channel" );
+    pos = strlen(line);
+    for (slot = 0; slot <= (int)seq->channels; slot++) {
+        int decoded = 0;
+        if (slot < seq->channels) {
+            uint32_t v = seq->kernel->get( frame_sample( seq, frame, planes, idx, slot ) );
+            int bank = ((v >> FRAME_NUM_SHIFT) - fn) & mask;
+            /* a bank before the first slot one: channel of the previous frame */
+            if (bank > (int)mask / 2) bank -= mask + 1;
+            decoded = bank * (CHANNEL_MASK+1) + (int)(v & CHANNEL_MASK);
+            if (slot == 0) first = decoded;
+            if (decoded == first + slot - start) continue;
+        }
+        /* end of the run [start, slot) */
+        if (pos < sizeof(line) - 32) {
+            if (slot - start == 1)
+                pos += snprintf( line + pos, sizeof(line) - pos, " %d:%d", start, first );
+            else
+                pos += snprintf( line + pos, sizeof(line) - pos, " %d-%d:%d-%d", start, slot - 1, first, first + slot - 1 - start );
+        }
+        runs++;
+        start = slot;
+        first = decoded;
+    }
+    if (pos >= sizeof(line) - 32)
+        snprintf( line + pos, sizeof(line) - pos, " ... (%d runs)", runs );
+    log( level, "%s", line );
+}
 
 /*
  * log the frame content
+ * 'frame' points to an interleaved frame, or is NULL for the frame #idx of the planar buffers.
+ * wide frames are dumped LOG_FRAME_SAMPLES samples per line, and summarized by log_slots()
+ * when they don't fit in LOG_FRAME_LINES lines.
  */
-static void log_frame( enum log_level level, struct seq_info *seq, const void *frame ) {
-    const int16_t *s16 = (const int16_t *)frame;
-    int ch;
+static void log_frame( enum log_level level, struct seq_info *seq, const void *frame,
+        const uint8_t * const *planes, int idx ) {
+    int digits = (seq->kernel->width + 3) / 4;
+    uint32_t value_mask = (seq->kernel->width < 32) ? (1u << seq->kernel->width) - 1 : 0xFFFFFFFF;
+    unsigned ch, first;
     char line[16*10];
     int pos;
 
-    strcpy( line, "  "); /* indentation */
-    pos = strlen(line);
-    for (ch = 0; ch < seq->channels; ch++) {
-        if (pos < sizeof(line)-1)
-            pos += snprintf(line + pos, sizeof(line) - pos - 1, "%04x ", (unsigned)(*s16) & 0xFFFF);
-        s16++;
+    for (first = 0; (first < seq->channels) && (first < LOG_FRAME_SAMPLES * LOG_FRAME_LINES); first += LOG_FRAME_SAMPLES) {
+        if (seq->channels <= LOG_FRAME_SAMPLES)
+            strcpy( line, "  "); /* indentation */
+        else
+            sprintf( line, "  %3u: ", first );
+        pos = strlen(line);
+        for (ch = first; (ch < seq->channels) && (ch < first + LOG_FRAME_SAMPLES); ch++) {
+            const uint8_t *sample = frame_sample( seq, frame, planes, idx, ch );
+            if (pos < sizeof(line)-1)
+                pos += snprintf(line + pos, sizeof(line) - pos - 1, "%0*x ", digits, (unsigned)(seq->kernel->get( sample ) & value_mask));
+        }
+        log( level, "%s", line);
     }
-    log( level, "%s", line);
+    if (seq->channels > LOG_FRAME_SAMPLES * LOG_FRAME_LINES)
+        log_slots( level, seq, frame, planes, idx );
 }
 
 
-void seq_check_jump_notify( struct seq_info *seq ) {
-    seq->state = NULL_FRAME;
-    seq->frame_num = 0;
+/*
+ * channel slip by 'k' slots: the slot s of the frame holds the channel s + k of the frame
+ * 'frame_num', or the channel s + k - channels of the next frame.
+ * return 1 if the frame matches
+ */
+static int slip_match( struct seq_info *seq, const void *frame, const uint8_t * const *planes, int idx,
+        unsigned k, unsigned frame_num ) {
+    const unsigned mask = seq->frame_num_mask;
+    const uint32_t keep = CHANNEL_MASK | (mask << FRAME_NUM_SHIFT);
+    const uint32_t value_mask = (seq->kernel->width < 32) ? (1u << seq->kernel->width) - 1 : 0xFFFFFFFF;
+    unsigned s;
+
+    for (s = 0; s < seq->channels; s++) {
+        uint32_t v = seq->kernel->get( frame_sample( seq, frame, planes, idx, s ) );
+        unsigned ch = s + k;
+        uint32_t expected = (ch < seq->channels) ? SEQ_SAMPLE( ch, frame_num, mask ) :
+            SEQ_SAMPLE( ch - seq->channels, frame_num + 1, mask );
+        if ((v & ~value_mask) || ((v & keep) != expected)) return 0;
+    }
+    return 1;
 }
 
-int seq_check_frames( struct seq_info *seq, const void *buff, int frame_count ) {
-    const int16_t *s16;
-    s16 = (const int16_t *)buff;
+/*
+ * the frame is invalid with the current alignment of the channels: look for the slip
+ * explaining it, 0 being the channels back in their slots. The slot 0 sample gives the
+ * channel up to its bank: every bank is tried.
+ * return the slip, with the counter of the frame in 'frame_num', or -1
+ */
+static int slip_find( struct seq_info *seq, const void *frame, const uint8_t * const *planes, int idx,
+        unsigned *frame_num ) {
+    const uint32_t v0 = seq->kernel->get( frame_sample( seq, frame, planes, idx, 0 ) );
+    unsigned b, k;
+
+    for (b = 0; (k = (b << CHANNEL_BANK_SHIFT) | (v0 & CHANNEL_MASK)) < seq->channels; b++) {
+        unsigned f = ((v0 >> FRAME_NUM_SHIFT) - b) & seq->frame_num_mask;
+        /* the regular check already failed */
+        if (!k && !seq->rotation) continue;
+        if (slip_match( seq, frame, planes, idx, k, f )) {
+            *frame_num = f;
+            return k;
+        }
+    }
+    return -1;
+}
+
+/* end of the channel slip in progress, if any */
+static void slip_end( struct seq_info *seq ) {
+    if (!seq->rotation) return;
+    warn("channels back in their slots after %u frames slipped by %u slots", seq->rotation_frames, seq->rotation);
+    if (seq->classify) seq_classify_slip( seq->classify, seq->rotation, seq->rotation_frames );
+    seq->rotation = 0;
+    seq->rotation_frames = 0;
+}
+
+/*
+ * the channels slipped by 'k' slots (0: back in their slots) at the valid frame 'frame_num'.
+ * The slip is one error whatever its duration, the checker then follows the sequence
+ * in the new alignment. return the number of errors
+ */
+static int slip_change( struct seq_info *seq, unsigned k, unsigned frame_num, const void *frame,
+        const uint8_t * const *planes, int idx ) {
+    const unsigned mask = seq->frame_num_mask;
+    const unsigned delta = (frame_num - seq->frame_num) & mask;
+
+    slip_end( seq );
+    /* the samples lost or repeated by the slip move the counter by one frame at most */
+    if ((seq->state == VALID_FRAME) && ((delta == 1) || (delta == mask)))
+        seq->frame_num = frame_num;
+    if (!k) return 0;
+
+    err("channels slipped by %u slots at frame 0x%04x", k, frame_num);
+    if (seq->state == VALID_FRAME) log_frame( LOG_ERR, seq, frame, planes, idx );
+    seq->rotation = k;
+    seq->error_count++;
+    return 1;
+}
+
+
+/*
+ * first valid frame 'frame_num' after seq_check_resync(), with seq->frame_num frames
+ * received since the interruption: compare with the prediction.
+ * return the number of errors
+ */
+static int resync_check( struct seq_info *seq, unsigned frame_num ) {
+    const unsigned mask = seq->frame_num_mask;
+    int diff = (frame_num - seq->resync_expected - seq->frame_num) & mask;
+    long long lost;
+
+    seq->resync = 0;
+    if (diff > (int)mask / 2) diff -= mask + 1;
+    lost = (long long)seq->resync_lost + diff;
+    if ((unsigned)abs( diff ) <= seq->resync_tolerance) {
+        warn("resynchronized on frame 0x%04x: %lld frames lost by the interruption (%+d from the prediction)",
+                frame_num, lost, diff);
+        return 0;
+    }
+    err("frame 0x%04x received after the interruption instead of 0x%04x: %lld frames lost instead of %lu",
+            frame_num, (seq->resync_expected + seq->frame_num) & mask, lost, seq->resync_lost);
+    seq->error_count++;
+    return 1;
+}
+
+
+/*
+ * SEQ_ENCODING_WIDE.
+ * The frames are generated and checked as with the regular encoding, the MSB of the
+ * samples being ignored. The group word is then written in the MSB of the samples
+ * (sign bit for every format) by the generator, and read back by the checker which
+ * follows the counter of the channel 0 samples to know the position in the group.
+ * The generator ORs a per-word table in each group, and the checker reads the MSBs
+ * of the runs matched by its fast path at once, the frames it handles one by one
+ * being followed one by one.
+ */
+
+/* CRC-8, polynomial x^8 + x^2 + x + 1 */
+static uint8_t crc8_u32( uint32_t v ) {
+    uint8_t crc = 0;
+    int i, b;
+    for (i = 0; i < 4; i++) {
+        crc ^= (uint8_t)(v >> (8 * i));
+        for (b = 0; b < 8; b++)
+            crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+    }
+    return crc;
+}
+
+static uint64_t wide_word( uint32_t high ) {
+    return high | ((uint64_t)crc8_u32( high ) << SEQ_WIDE_HIGH_BITS);
+}
+
+static inline uint8_t *wide_sample( const struct seq_info *seq, const uint8_t *buff, const uint8_t * const *planes,
+        unsigned idx, unsigned ch ) {
+    const unsigned bytes = seq->kernel->sample_bytes;
+    if (planes) return (uint8_t *)planes[ch] + idx * bytes;
+    return (uint8_t *)buff + (idx * seq->channels + ch) * bytes;
+}
+
+/* the counter bits above the sample counter */
+static inline unsigned wide_counter_bits( const struct seq_info *seq ) {
+    return __builtin_popcount( seq->frame_num_mask );
+}
+
+static void wide_table_build( struct seq_info *seq, uint32_t high ) {
+    struct seq_wide_table *t = &seq->wide_table;
+    const unsigned bytes = seq->kernel->sample_bytes;
+    unsigned b;
+
+    t->valid = 1;
+    t->high = high;
+    t->word = wide_word( high );
+    t->ones = 0;
+    memset( t->image, 0, sizeof(t->image) );
+    for (b = 0; b < SEQ_WIDE_WORD_BITS; b++) {
+        if (!((t->word >> b) & 1)) continue;
+        t->frame[ t->ones ] = b / seq->channels;
+        t->ch[ t->ones ] = b % seq->channels;
+        t->ones++;
+        memcpy( t->image + b * bytes, seq->msb_bits, bytes );
+    }
+}
+
+/* the word of 'high' and where its ones go in a group, rebuilt only when 'high' changes */
+static inline const struct seq_wide_table *wide_table( struct seq_info *seq, uint32_t high ) {
+    if (!seq->wide_table.valid || (seq->wide_table.high != high)) wide_table_build( seq, high );
+    return &seq->wide_table;
+}
+
+static inline void wide_set_msb( const struct seq_info *seq, uint8_t *s ) {
+    unsigned k;
+    if (!seq->msb_or) {
+        /* float */
+        seq->kernel->put( s, seq->kernel->get( s ) | (1u << (seq->kernel->width - 1)) );
+        return;
+    }
+    for (k = 0; k < seq->kernel->sample_bytes; k++)
+        s[k] |= seq->msb_bits[k];
+}
+
+/* dst = src | image, over 'len' bytes (a multiple of 8) */
+static void wide_or_image( uint8_t *dst, const uint8_t *src, const uint8_t *image, unsigned len ) {
+    unsigned i;
+    for (i = 0; i < len; i += 8) {
+        uint64_t a, b;
+        memcpy( &a, src + i, 8 );
+        memcpy( &b, image + i, 8 );
+        a |= b;
+        memcpy( dst + i, &a, 8 );
+    }
+}
+
+/*
+ * write the group words in the 'frame_count' frames just generated from 'first',
+ * the generator position before the generation
+ */
+static void wide_fill( struct seq_info *seq, uint8_t *buff, uint8_t * const *planes, uint64_t first, int frame_count ) {
+    const unsigned group = seq->group_frames;
+    const unsigned counter_bits = wide_counter_bits( seq );
+    const uint64_t end = first + frame_count;
+    uint64_t pos;
+
+    for (pos = first & ~(uint64_t)(group - 1); pos < end; pos += group) {
+        const struct seq_wide_table *t = wide_table( seq, (uint32_t)(pos >> counter_bits) );
+        unsigned k;
+
+        if (!planes && seq->msb_or && (pos >= first) && (pos + group <= end)) {
+            /* whole interleaved group: the ones are in its first samples */
+            uint8_t *dst = buff + (pos - first) * seq->frame_byte_size;
+            wide_or_image( dst, dst, t->image, SEQ_WIDE_WORD_BITS * seq->kernel->sample_bytes );
+            continue;
+        }
+        for (k = 0; k < t->ones; k++) {
+            uint64_t f = pos + t->frame[k];
+            if ((f < first) || (f >= end)) continue;
+            wide_set_msb( seq, wide_sample( seq, buff, (const uint8_t * const *)planes, f - first, t->ch[k] ) );
+        }
+    }
+
+    /* frame_num wrapped */
+    if (seq->frame_num < (uint32_t)first) seq->frame_num_high++;
+}
+
+static inline uint64_t wide_position( const struct seq_info *seq ) {
+    return ((uint64_t)seq->frame_num_high << 32) | seq->frame_num;
+}
+
+static void wide_reset( struct seq_info *seq ) {
+    memset( &seq->wide, 0, sizeof(seq->wide) );
+}
+
+/* MSBs of 'count' (64 at most) interleaved samples: bit #k is the MSB of sample #k */
+static inline uint64_t wide_msbs( const struct seq_info *seq, const uint8_t *s, unsigned count ) {
+    const unsigned bytes = seq->kernel->sample_bytes;
+    uint64_t bits = 0;
+    unsigned k;
+
+    if (seq->msb_s16) return seq_simd_msb_s16( (const int16_t *)s, count );
+    s += seq->msb_byte;
+    for (k = 0; k < count; k++, s += bytes)
+        bits |= (uint64_t)(*s >> 7) << k;
+    return bits;
+}
+
+/*
+ * collect the MSBs of 'count' frames, the first one being the frame #in_group of the group:
+ * the samples of the word, then the padding which must stay zero
+ */
+static void wide_collect( struct seq_info *seq, const uint8_t *frame, const uint8_t * const *planes, int idx,
+        unsigned in_group, unsigned count ) {
+    struct seq_wide *w = &seq->wide;
+    const unsigned channels = seq->channels;
+    unsigned bit = in_group * channels;
+    const unsigned end = bit + count * channels;
+
+    if (planes) {
+        unsigned f, ch;
+        for (f = 0; f < count; f++) {
+            for (ch = 0; ch < channels; ch++, bit++) {
+                if (!(planes[ch][ (idx + f) * seq->kernel->sample_bytes + seq->msb_byte ] & 0x80)) continue;
+                if (bit < SEQ_WIDE_WORD_BITS)
+                    w->word |= 1ull << bit;
+                else
+                    w->extra = 1;
+            }
+        }
+        return;
+    }
 
-    int frame_byte_size = seq->channels * sizeof(int16_t);
-    unsigned current_frame_seq;
+    /* interleaved: sample #k of the frames is the bit #(in_group * channels + k) of the word */
+    while ((bit < end) && !w->extra) {
+        unsigned n = (end - bit < 64) ? end - bit : 64;
+        uint64_t msbs = wide_msbs( seq, frame, n );
+        if (bit < SEQ_WIDE_WORD_BITS) {
+            /* the samples above the word are padding */
+            unsigned word_bits = SEQ_WIDE_WORD_BITS - bit;
+            w->word |= (msbs << bit) & ((1ull << SEQ_WIDE_WORD_BITS) - 1);
+            if ((word_bits < 64) && (msbs >> word_bits)) w->extra = 1;
+        } else if (msbs) {
+            w->extra = 1;
+        }
+        frame += n * seq->kernel->sample_bytes;
+        bit += n;
+    }
+}
+
+/* end of the group at the frame 'n': check its word. return the number of errors */
+static int wide_group_end( struct seq_info *seq, unsigned n ) {
+    struct seq_wide *w = &seq->wide;
+    const unsigned group = seq->group_frames;
+    uint32_t high = (uint32_t)w->word;
+
+    w->collecting = 0;
+    if (w->extra || (w->word != wide_table( seq, high )->word)) {
+        err("corrupted frame counter in frames 0x%04x-0x%04x", n + 1 - group, n);
+        seq->error_count++;
+        w->locked = 0;
+        return 1;
+    }
+    if (w->locked && (high != w->high)) {
+        err("frame 0x%llx received instead of 0x%llx",
+                ((unsigned long long)high << wide_counter_bits( seq )) | n,
+                ((unsigned long long)w->high << wide_counter_bits( seq )) | n);
+        seq->error_count++;
+        w->high = high;
+        return 1;
+    }
+    w->high = high;
+    w->locked = 1;
+    return 0;
+}
+
+/*
+ * collect the group words of 'frame_count' frames following the sample counter from
+ * 'frame_num' (see struct wide_span).
+ * return the number of errors: corrupted words, or counter jumps only visible in the word
+ */
+static int wide_run( struct seq_info *seq, const uint8_t *frame, const uint8_t * const *planes, int idx,
+        unsigned frame_num, int frame_count ) {
+    struct seq_wide *w = &seq->wide;
+    const unsigned mask = seq->frame_num_mask;
+    const unsigned group = seq->group_frames;
+    int errors = 0, i = 0;
+
+    if (!w->synced || (frame_num != w->next)) {
+        /* the checker reports this jump: the counter bits above are unknown again */
+        w->locked = 0;
+        w->collecting = 0;
+    }
+    w->synced = 1;
+    w->next = (frame_num + frame_count) & mask;
+
+    while (i < frame_count) {
+        unsigned n = (frame_num + i) & mask;
+        unsigned in_group = n & (group - 1);
+        unsigned count = group - in_group;
+
+        if (count > frame_count - i) count = frame_count - i;
+        if (in_group == 0) {
+            w->collecting = 1;
+            w->word = 0;
+            w->extra = 0;
+        }
+        if (w->collecting) {
+            wide_collect( seq, planes ? NULL : frame + i * seq->frame_byte_size, planes, idx + i, in_group, count );
+            if (in_group + count == group) errors += wide_group_end( seq, n + count - 1 );
+        }
+        /* the counter wraps after this group */
+        if (n + count - 1 == mask) w->high++;
+        i += count;
+    }
+    return errors;
+}
+
+/*
+ * frames following the sample counter, collected by the checker and given to
+ * wide_run() at once
+ */
+struct wide_span {
+    const uint8_t *frame;   /* interleaved only */
+    int idx;
+    unsigned frame_num;
+    int count;
+};
+
+static int wide_span_flush( struct seq_info *seq, struct wide_span *span, const uint8_t * const *planes ) {
     int errors = 0;
+    if (span->count) errors = wide_run( seq, span->frame, planes, span->idx, span->frame_num, span->count );
+    span->count = 0;
+    return errors;
+}
 
-    while (frame_count--) {
+/* the 'count' frames from the frame #idx follow the counter from 'frame_num' */
+static inline int wide_span_add( struct seq_info *seq, struct wide_span *span, const uint8_t *frame,
+        const uint8_t * const *planes, int idx, unsigned frame_num, int count ) {
+    int errors = 0;
+
+    if (span->count && (((span->frame_num + span->count) & seq->frame_num_mask) == frame_num)) {
+        span->count += count;
+        return 0;
+    }
+    errors = wide_span_flush( seq, span, planes );
+    span->frame = frame;
+    span->idx = idx;
+    span->frame_num = frame_num;
+    span->count = count;
+    return errors;
+}
+
+/*
+ * the frame #idx, not matched by the fast path: follow the counter of its channel 0 sample
+ */
+static ALWAYS_INLINE int wide_frame_tmpl( struct seq_info *seq, struct wide_span *span, const uint8_t *frame,
+        const uint8_t * const *planes, int idx, unsigned bytes, sample_get_fn get, const int planar ) {
+    struct seq_wide *w = &seq->wide;
+    uint32_t v = get( planar ? planes[0] + idx * bytes : frame );
+    int errors;
+
+    if (!(v & CHANNEL_MASK))
+        return wide_span_add( seq, span, frame, planes, idx, (v >> FRAME_NUM_SHIFT) & seq->frame_num_mask, 1 );
+
+    /* not the channel 0 sample of a valid frame (0xFF null frame, slip...) */
+    errors = wide_span_flush( seq, span, planes );
+    w->synced = 0;
+    w->locked = 0;
+    w->collecting = 0;
+    return errors;
+}
+
+
+/*
+ * the sequence checker state machine.
+ * the frames are either interleaved in 'buff', or split in the 'planes' channel buffers
+ * if 'planar' is set.
+ * 'channels', 'bytes', 'width', 'get', 'fast', 'fast_plane' and 'planar' are constants
+ * in every specialized kernel
+ */
+static ALWAYS_INLINE int check_frames_tmpl( struct seq_info *seq, const void *buff, const uint8_t * const *planes,
+        int frame_count, unsigned channels, unsigned bytes, unsigned width,
+        sample_get_fn get, fast_match_fn fast, fast_plane_match_fn fast_plane, const int planar ) {
+    const uint8_t *frame = (const uint8_t *)buff;   /* interleaved only */
+    int idx = 0;                                    /* planar only: index of the frame */
+    const unsigned frame_byte_size = channels * bytes;
+    const unsigned mask = seq->frame_num_mask;
+    const uint32_t value_mask = (width < 32) ? (1u << width) - 1 : 0xFFFFFFFF;
+    unsigned current_frame_seq = 0;
+    struct wide_span span = { NULL, 0, 0, 0 };
+    const int wide = (seq->encoding == SEQ_ENCODING_WIDE);
+    int errors = 0;
+
+    while (frame_count > 0) {
         /* what kind of frame is it */
         enum seq_stat_e next_state;
-        if (is_null_frame( s16, frame_byte_size )) {
+
+        if ((fast || planar) && (seq->state == VALID_FRAME) && !seq->rotation) {
+            /*
+             * fast path: skip at once every frame following exactly the expected sequence.
+             * the state machine below only sees the first frame that doesn't match.
+             */
+            int n;
+            if (planar) {
+                /* each channel buffer is checked as one contiguous vector */
+                unsigned ch;
+                n = frame_count;
+                for (ch = 0; (ch < channels) && n; ch++) {
+                    if (fast_plane)
+                        n = fast_plane( planes[ch] + idx * bytes, ch, seq->frame_num, mask, n );
+                    else
+                        n = plane_match_tmpl( planes[ch] + idx * bytes, ch, seq->frame_num, mask, n, bytes, get );
+                }
+            } else {
+                n = fast( frame, channels, seq->frame_num, mask, frame_count );
+            }
+            if (n) {
+                if (wide) errors += wide_span_add( seq, &span, frame, planes, idx, seq->frame_num, n );
+                frame += n * frame_byte_size;
+                idx += n;
+                frame_count -= n;
+                seq->frame_num = (seq->frame_num + n) & mask;
+                seq->valid_run += n;
+                if (frame_count == 0) break;
+            }
+        }
+        frame_count--;
+        if (wide) errors += wide_frame_tmpl( seq, &span, frame, planes, idx, bytes, get, planar );
+
+        if (planar ? is_null_planar_frame( planes, idx, channels, bytes ) : is_null_frame( frame, frame_byte_size )) {
             next_state = NULL_FRAME;
+        } else if (seq->rotation) {
+            /* slipped channels: checked by slip_find() below */
+            next_state = INVALID_FRAME;
         } else {
-            int ch;
-            const int16_t *s = s16;
+            unsigned ch;
+            const uint8_t *s = planar ? planes[0] + idx * bytes : frame;
             /* check samples one by one */
             next_state = VALID_FRAME;
-            current_frame_seq = (*s16 >> FRAME_NUM_SHIFT) & FRAME_NUM_MASK;
-            for (ch=0; ch < seq->channels; ch++) {
-                if (((*s & CHANNEL_MASK) != ch) || (current_frame_seq != ((*s >> FRAME_NUM_SHIFT) & FRAME_NUM_MASK))) {
+            current_frame_seq = (get( s ) >> FRAME_NUM_SHIFT) & mask;
+            for (ch = 0; ch < channels; ch++) {
+                uint32_t v = get( planar ? planes[ch] + idx * bytes : s );
+                if ((v & ~value_mask) || ((v & CHANNEL_MASK) != (ch & CHANNEL_MASK)) ||
+                        (((current_frame_seq + (ch >> CHANNEL_BANK_SHIFT)) & mask) != ((v >> FRAME_NUM_SHIFT) & mask))) {
                     next_state = INVALID_FRAME;
                     break;
                 }
-                s++;
+                s += bytes;
             }
         }
 
+        if ((channels > 1) && (next_state == INVALID_FRAME)) {
+            const int k = slip_find( seq, planar ? NULL : frame, planes, idx, &current_frame_seq );
+            if (k >= 0) {
+                next_state = VALID_FRAME;
+                if (k != seq->rotation) errors += slip_change( seq, k, current_frame_seq, planar ? NULL : frame, planes, idx );
+            }
+        }
+        if (seq->rotation && (next_state == VALID_FRAME)) seq->rotation_frames++;
+
         if (seq->state == next_state) {
             switch (seq->state) {
             case NULL_FRAME:
@@ -139,15 +780,16 @@ int seq_check_frames( struct seq_info *seq, const void *buff, int frame_count )
             case INVALID_FRAME:
                 /* simply increase the record count of those frames */
                 seq->frame_num++;
+                if (seq->slot_ref != SEQ_SLOT_REF_NONE) seq->slot_ref++;
+                if (seq->classify) seq_classify_invalid( seq->classify, seq, planar ? NULL : frame, planes, idx );
                 if ((seq->frame_num <= seq_max_consecutive_invalid_frames_before_null_warning) && (seq->prev_state == VALID_FRAME)) {
-                    log_frame( LOG_WARN, seq, s16 );
+                    log_frame( LOG_WARN, seq, planar ? NULL : frame, planes, idx );
                 } else {
                     if (seq->frame_num <= (seq_consecutive_invalid_frames_log+1)) {
-                        log_frame( LOG_ERR, seq, s16 );
+                        log_frame( LOG_ERR, seq, planar ? NULL : frame, planes, idx );
                     }
                     errors++;
                     seq->error_count++;
-                    seq_errors_total++;
                 }
                 break;
             case VALID_FRAME:
@@ -156,48 +798,56 @@ int seq_check_frames( struct seq_info *seq, const void *buff, int frame_count )
                     err("frame 0x%04x received instead of 0x%04x", current_frame_seq, seq->frame_num);
                     errors++;
                     seq->error_count++;
-                    seq_errors_total++;
+                    if (seq->classify) {
+                        const uint8_t *next = !frame_count ? NULL : planar ? planes[0] + (idx + 1) * bytes : frame + frame_byte_size;
+                        seq_classify_jump( seq->classify, seq, current_frame_seq, next );
+                    }
                 }
-                seq->frame_num = (current_frame_seq + 1) & FRAME_NUM_MASK;
+                seq->frame_num = (current_frame_seq + 1) & mask;
+                seq->valid_run++;
                 break;
             }
         } else {
             switch (next_state) {
             case INVALID_FRAME:
+                seq->slot_ref = (seq->state == VALID_FRAME) ? seq->frame_num : SEQ_SLOT_REF_NONE;
+                if (seq->classify) seq_classify_invalid( seq->classify, seq, planar ? NULL : frame, planes, idx );
                 if (seq->state == VALID_FRAME) {
                     /* this may not be an error if the stream is stopped on remote side
                      * in this case we should receive only a short number of invalid frames
                      * followed by some null frames
                      */
                     warn("first invalid frame while expecting frame 0x%04x", seq->frame_num);
-                    log_frame( LOG_WARN, seq, s16 );
+                    log_frame( LOG_WARN, seq, planar ? NULL : frame, planes, idx );
                 } else {
                     err("invalid frame after %u null frames", seq->frame_num);
-                    log_frame( LOG_ERR, seq, s16 );
+                    log_frame( LOG_ERR, seq, planar ? NULL : frame, planes, idx );
                     errors++;
                     seq->error_count++;
-                    seq_errors_total++;
                 }
                 seq->frame_num = 1;
                 break;
 
-            case NULL_FRAME:
+            case NULL_FRAME: {
+                uint8_t first_byte = planar ? planes[0][idx * bytes] : frame[0];
+                if (seq->classify) seq_classify_null( seq->classify, seq );
                 if (seq->state == VALID_FRAME) {
-                    warn("Null frame (%02X) while expecting frame 0x%04x", (*s16 & 0xFF), seq->frame_num);
+                    warn("Null frame (%02X) while expecting frame 0x%04x", first_byte, seq->frame_num);
                 } else {
                     if (seq->frame_num > seq_max_consecutive_invalid_frames_before_null_warning) {
-                        err("Null frame (%02X) after %u invalid frames", (*s16 & 0xFF), seq->frame_num);
+                        err("Null frame (%02X) after %u invalid frames", first_byte, seq->frame_num);
                         errors++;
                         seq->error_count++;
-                        seq_errors_total++;
                     } else {
-                        warn("Null frame (%02X) after %u invalid frames", (*s16 & 0xFF), seq->frame_num);
+                        warn("Null frame (%02X) after %u invalid frames", first_byte, seq->frame_num);
                     }
                 }
                 seq->frame_num = 1;
-                break;
+            }   break;
 
             case VALID_FRAME:
+                if (seq->classify) seq_classify_valid( seq->classify, seq, current_frame_seq );
+                if (seq->resync) errors += resync_check( seq, current_frame_seq );
                 if (seq->state == NULL_FRAME) {
                     if (seq->frame_num > 0)
                         warn("Valid frame after %u null frames", seq->frame_num);
@@ -206,15 +856,304 @@ int seq_check_frames( struct seq_info *seq, const void *buff, int frame_count )
                 } else {
                     warn("Valid frame after %u invalid frames", seq->frame_num);
                 }
-                log_frame( LOG_WARN, seq, s16 );
-                seq->frame_num = (current_frame_seq + 1) & FRAME_NUM_MASK;
+                seq->slot_ref = current_frame_seq;
+                log_frame( LOG_WARN, seq, planar ? NULL : frame, planes, idx );
+                seq->frame_num = (current_frame_seq + 1) & mask;
+                seq->valid_run = 1;
                 break;
             }
             seq->prev_state = seq->state;
             seq->state = next_state;
         }
-        s16 += seq->channels;
+        frame += frame_byte_size;
+        idx++;
+    }
+    if (wide) errors += wide_span_flush( seq, &span, planes );
+    return errors;
+}
+
+
+/*
+ * specialized kernels: one generic (any channel count), one mono and one stereo
+ * instance per format, plus the generic planar one.
+ */
+#define SEQ_KERNELS( name, bytes, width, get, put, fast, fast_plane ) \
+    static void fill_##name( struct seq_info *seq, void *buff, int frame_count ) { \
+        fill_frames_tmpl( seq, buff, frame_count, seq->channels, bytes, put ); } \
+    static void fill_##name##_1ch( struct seq_info *seq, void *buff, int frame_count ) { \
+        fill_frames_tmpl( seq, buff, frame_count, 1, bytes, put ); } \
+    static void fill_##name##_2ch( struct seq_info *seq, void *buff, int frame_count ) { \
+        fill_frames_tmpl( seq, buff, frame_count, 2, bytes, put ); } \
+    static int check_##name( struct seq_info *seq, const void *buff, int frame_count ) { \
+        return check_frames_tmpl( seq, buff, NULL, frame_count, seq->channels, bytes, width, get, fast, NULL, 0 ); } \
+    static int check_##name##_1ch( struct seq_info *seq, const void *buff, int frame_count ) { \
+        return check_frames_tmpl( seq, buff, NULL, frame_count, 1, bytes, width, get, fast, NULL, 0 ); } \
+    static int check_##name##_2ch( struct seq_info *seq, const void *buff, int frame_count ) { \
+        return check_frames_tmpl( seq, buff, NULL, frame_count, 2, bytes, width, get, fast, NULL, 0 ); } \
+    static void fill_##name##_planar( struct seq_info *seq, void * const *planes, int frame_count ) { \
+        fill_planes_tmpl( seq, planes, frame_count, seq->channels, bytes, put ); } \
+    static int check_##name##_planar( struct seq_info *seq, const void * const *planes, int frame_count ) { \
+        return check_frames_tmpl( seq, NULL, (const uint8_t * const *)planes, frame_count, seq->channels, bytes, width, \
+            get, NULL, fast_plane, 1 ); } \
+    static uint32_t get_##name##_fn( const uint8_t *sample ) { return get( sample ); } \
+    static void put_##name##_fn( uint8_t *sample, uint32_t v ) { put( sample, v ); }
+
+#define SEQ_KERNEL_ENTRIES( format, name, bytes, width ) \
+    { format, 1, width, bytes, fill_##name##_1ch, check_##name##_1ch, \
+        fill_##name##_planar, check_##name##_planar, get_##name##_fn, put_##name##_fn }, \
+    { format, 2, width, bytes, fill_##name##_2ch, check_##name##_2ch, \
+        fill_##name##_planar, check_##name##_planar, get_##name##_fn, put_##name##_fn }, \
+    { format, 0, width, bytes, fill_##name, check_##name, \
+        fill_##name##_planar, check_##name##_planar, get_##name##_fn, put_##name##_fn }
+
+SEQ_KERNELS( s16_le, 2, 16, get_s16_le, put_s16_le, FAST_MATCH_S16_LE, FAST_PLANE_MATCH_S16_LE )
+SEQ_KERNELS( s16_be, 2, 16, get_s16_be, put_s16_be, FAST_MATCH_S16_BE, FAST_PLANE_MATCH_S16_BE )
+SEQ_KERNELS( s24_le, 4, 24, get_s24_le, put_s24_le, NULL, NULL )
+SEQ_KERNELS( s24_be, 4, 24, get_s24_be, put_s24_be, NULL, NULL )
+SEQ_KERNELS( s24_3le, 3, 24, get_s24_3le, put_s24_3le, NULL, NULL )
+SEQ_KERNELS( s24_3be, 3, 24, get_s24_3be, put_s24_3be, NULL, NULL )
+SEQ_KERNELS( s32_le, 4, 32, get_s32_le, put_s32_le, NULL, NULL )
+SEQ_KERNELS( s32_be, 4, 32, get_s32_be, put_s32_be, NULL, NULL )
+SEQ_KERNELS( float_le, 4, 24, get_float_le, put_float_le, NULL, NULL )
+SEQ_KERNELS( float_be, 4, 24, get_float_be, put_float_be, NULL, NULL )
+
+static const struct seq_kernel seq_kernels[] = {
+    SEQ_KERNEL_ENTRIES( SND_PCM_FORMAT_S16_LE, s16_le, 2, 16 ),
+    SEQ_KERNEL_ENTRIES( SND_PCM_FORMAT_S16_BE, s16_be, 2, 16 ),
+    SEQ_KERNEL_ENTRIES( SND_PCM_FORMAT_S24_LE, s24_le, 4, 24 ),
+    SEQ_KERNEL_ENTRIES( SND_PCM_FORMAT_S24_BE, s24_be, 4, 24 ),
+    SEQ_KERNEL_ENTRIES( SND_PCM_FORMAT_S24_3LE, s24_3le, 3, 24 ),
+    SEQ_KERNEL_ENTRIES( SND_PCM_FORMAT_S24_3BE, s24_3be, 3, 24 ),
+    SEQ_KERNEL_ENTRIES( SND_PCM_FORMAT_S32_LE, s32_le, 4, 32 ),
+    SEQ_KERNEL_ENTRIES( SND_PCM_FORMAT_S32_BE, s32_be, 4, 32 ),
+    SEQ_KERNEL_ENTRIES( SND_PCM_FORMAT_FLOAT_LE, float_le, 4, 24 ),
+    SEQ_KERNEL_ENTRIES( SND_PCM_FORMAT_FLOAT_BE, float_be, 4, 24 ),
+};
+
+static const struct seq_kernel *seq_kernel_find( snd_pcm_format_t format, unsigned channels ) {
+    const struct seq_kernel *generic = NULL;
+    int i;
+    for (i = 0; i < sizeof(seq_kernels)/sizeof(seq_kernels[0]); i++) {
+        const struct seq_kernel *k = &seq_kernels[i];
+        if (k->format != format) continue;
+        if (k->channels == channels) return k;
+        if (k->channels == 0) generic = k;
     }
-    if (errors && seq_error_notify) seq_error_notify();
+    return generic;
+}
+
+
+int seq_format_supported( snd_pcm_format_t format ) {
+    return seq_kernel_find( format, 0 ) != NULL;
+}
+
+
+const char *seq_encoding_name( enum seq_encoding encoding ) {
+    return (encoding == SEQ_ENCODING_WIDE) ? "wide" : "seq";
+}
+
+int seq_encoding_parse( const char *name, enum seq_encoding *encoding ) {
+    if (!strcmp( name, "seq" ))
+        *encoding = SEQ_ENCODING_SEQ;
+    else if (!strcmp( name, "wide" ))
+        *encoding = SEQ_ENCODING_WIDE;
+    else
+        return -1;
+    return 0;
+}
+
+
+int seq_init( struct seq_info *seq, unsigned channels, snd_pcm_format_t format )
+{
+    memset( seq, 0, sizeof(*seq));
+    seq->channels = channels;
+    seq->format = format;
+    seq->frame_num = 0;
+    seq_simd_init();
+
+    if ((channels == 0) || (channels > SEQ_MAX_CHANNELS)) {
+        err("seq_init: %u channels not supported (max %u)", channels, SEQ_MAX_CHANNELS);
+        return -1;
+    }
+    seq->kernel = seq_kernel_find( format, channels );
+    if (!seq->kernel) {
+        err("seq_init: format %s not supported", snd_pcm_format_name( format ));
+        return -1;
+    }
+    seq->encoding = seq_encoding;
+    seq->frame_num_mask = (1u << (seq->kernel->width - FRAME_NUM_SHIFT)) - 1;
+    seq->frame_byte_size = channels * seq->kernel->sample_bytes;
+    if (seq->encoding == SEQ_ENCODING_WIDE) {
+        /* the MSB carries the group word */
+        seq->frame_num_mask >>= 1;
+        seq->group_frames = 1;
+        while (seq->group_frames * channels < SEQ_WIDE_WORD_BITS)
+            seq->group_frames *= 2;
+        seq->msb_byte = (snd_pcm_format_big_endian( format ) == 1) ? 0 : seq->kernel->sample_bytes - 1;
+        seq->msb_or = (format != SND_PCM_FORMAT_FLOAT_LE) && (format != SND_PCM_FORMAT_FLOAT_BE);
+        if (seq->msb_or) {
+            /* the MSB of a sample whose other bits are clear, S24 being sign extended */
+            seq->kernel->put( seq->msb_bits, 1u << (seq->kernel->width - 1) );
+        }
+        seq->msb_s16 = (format == FAST_MSB_S16_FORMAT);
+    }
+
+    seq->pattern_frames = seq->frame_num_mask + 1;
+    if ((unsigned long long)seq->pattern_frames * seq->frame_byte_size <= PATTERN_MAX_BYTES) {
+        seq->pattern = malloc( seq->pattern_frames * seq->frame_byte_size );
+        if (seq->pattern) {
+            seq->kernel->fill( seq, seq->pattern, seq->pattern_frames );
+            seq->frame_num = 0;
+        } else {
+            warn("seq_init: no memory for the pattern table, generating frames one by one");
+        }
+    }
+    return 0;
+}
+
+
+void seq_free( struct seq_info *seq )
+{
+    free( seq->pattern );
+    seq->pattern = NULL;
+    free( seq->classify );
+    seq->classify = NULL;
+}
+
+
+void seq_reset( struct seq_info *seq )
+{
+    seq->frame_num = 0;
+    seq->frame_num_high = 0;
+    seq->state = NULL_FRAME;
+    seq->prev_state = NULL_FRAME;
+    seq->valid_run = 0;
+    seq->resync = 0;
+    wide_reset( seq );
+    slip_end( seq );
+    if (seq->classify) seq_classify_reset( seq->classify );
+}
+
+
+static void fill_frames( struct seq_info *seq, void *buff, int frame_count ) {
+    unsigned char *dst = (unsigned char *)buff;
+
+    if (!seq->pattern) {
+        seq->kernel->fill( seq, buff, frame_count );
+        return;
+    }
+
+    /* copy from the pattern table, wrapping at its end */
+    while (frame_count > 0) {
+        unsigned offset = seq->frame_num % seq->pattern_frames;
+        int n = seq->pattern_frames - offset;
+        if (n > frame_count) n = frame_count;
+        memcpy( dst, (const unsigned char *)seq->pattern + offset * seq->frame_byte_size, n * seq->frame_byte_size );
+        dst += n * seq->frame_byte_size;
+        seq->frame_num += n;
+        frame_count -= n;
+    }
+}
+
+
+void seq_check_jump_notify( struct seq_info *seq ) {
+    seq->state = NULL_FRAME;
+    seq->frame_num = 0;
+    seq->valid_run = 0;
+    seq->resync = 0;
+    wide_reset( seq );
+    slip_end( seq );
+    if (seq->classify) seq_classify_reset( seq->classify );
+}
+
+void seq_check_resync( struct seq_info *seq, unsigned long lost, unsigned tolerance ) {
+    const int valid = (seq->state == VALID_FRAME);
+    const unsigned expected = seq->frame_num;
+
+    seq_check_jump_notify( seq );
+    if (!valid) return;
+    seq->resync = 1;
+    seq->resync_expected = (expected + lost) & seq->frame_num_mask;
+    seq->resync_lost = lost;
+    seq->resync_tolerance = tolerance;
+}
+
+int seq_check_frames( struct seq_info *seq, const void *buff, int frame_count ) {
+    int errors = seq->kernel->check( seq, buff, frame_count );
+    if (errors && seq->error_notify) seq->error_notify( seq, errors, seq->error_notify_data );
+    return errors;
+}
+
+
+static void wide_fill_frames( struct seq_info *seq, uint8_t *buff, int frame_count ) {
+    uint64_t first = wide_position( seq );
+
+    fill_frames( seq, buff, frame_count );
+    wide_fill( seq, buff, NULL, first, frame_count );
+}
+
+/*
+ * same as wide_fill_frames(), the words being OR'ed in the whole groups while they
+ * are copied from the pattern table rather than in a second pass over the frames
+ */
+static void wide_fill_pattern( struct seq_info *seq, uint8_t *buff, int frame_count ) {
+    const unsigned group = seq->group_frames;
+    const unsigned group_bytes = group * seq->frame_byte_size;
+    const unsigned image_bytes = SEQ_WIDE_WORD_BITS * seq->kernel->sample_bytes;
+    const unsigned counter_bits = wide_counter_bits( seq );
+    int head = (group - (seq->frame_num & (group - 1))) & (group - 1);
+
+    /* up to the first group start */
+    if (head > frame_count) head = frame_count;
+    wide_fill_frames( seq, buff, head );
+    buff += head * seq->frame_byte_size;
+    frame_count -= head;
+
+    while (frame_count >= group) {
+        uint64_t pos = wide_position( seq );
+        const struct seq_wide_table *t = wide_table( seq, (uint32_t)(pos >> counter_bits) );
+        const uint8_t *src = (const uint8_t *)seq->pattern + (seq->frame_num % seq->pattern_frames) * seq->frame_byte_size;
+
+        wide_or_image( buff, src, t->image, image_bytes );
+        memcpy( buff + image_bytes, src + image_bytes, group_bytes - image_bytes );
+        buff += group_bytes;
+        frame_count -= group;
+        seq->frame_num += group;
+        /* frame_num wrapped */
+        if (seq->frame_num < (uint32_t)pos) seq->frame_num_high++;
+    }
+    wide_fill_frames( seq, buff, frame_count );
+}
+
+void seq_fill_frames( struct seq_info *seq, void *buff, int frame_count ) {
+    if (seq->encoding != SEQ_ENCODING_WIDE)
+        fill_frames( seq, buff, frame_count );
+    else if (seq->pattern && seq->msb_or)
+        wide_fill_pattern( seq, buff, frame_count );
+    else
+        wide_fill_frames( seq, buff, frame_count );
+}
+
+void seq_fill_frames_planar( struct seq_info *seq, void * const *planes, int frame_count ) {
+    uint64_t first = wide_position( seq );
+
+    /* a mono stream has the same layout in both modes: use the pattern table */
+    if (seq->channels == 1) {
+        seq_fill_frames( seq, planes[0], frame_count );
+        return;
+    }
+    seq->kernel->fill_planar( seq, planes, frame_count );
+    if (seq->encoding == SEQ_ENCODING_WIDE)
+        wide_fill( seq, NULL, (uint8_t * const *)planes, first, frame_count );
+}
+
+int seq_check_frames_planar( struct seq_info *seq, const void * const *planes, int frame_count ) {
+    int errors;
+
+    if (seq->channels == 1)
+        return seq_check_frames( seq, planes[0], frame_count );
+
+    errors = seq->kernel->check_planar( seq, planes, frame_count );
+    if (errors && seq->error_notify) seq->error_notify( seq, errors, seq->error_notify_data );
     return errors;
 }
@@ -12,11 +12,7 @@
 #ifndef __seq_h__
 #define __seq_h__
 
-/* total number of sequence errors detected among every sequence checkers */
-extern unsigned seq_errors_total;
-
-/* if not NULL, called when a new error is detected */
-extern void (*seq_error_notify)(void);
+#include <stdint.h>
 
 /*
  * In case there is a serie of consecutives invalid frames,
@@ -26,16 +22,128 @@ extern void (*seq_error_notify)(void);
 extern unsigned seq_consecutive_invalid_frames_log;
 
 
+/*
+ * sample encoding used by seq_init():
+ *
+ * SEQ_ENCODING_SEQ   each sample holds the channel tag and the frame counter, which
+ *                    wraps every 2048 frames in S16. A jump by a multiple of that is not seen.
+ * SEQ_ENCODING_WIDE  the counter is one bit narrower, and the MSB of every sample is one
+ *                    bit of a 40 bits word spread over a group of consecutive frames:
+ *                    the counter bits above the sample counter (32 bits) and their CRC-8.
+ *                    The group is as long as needed to hold the word: 64 frames in mono,
+ *                    32 in stereo... one frame from 40 channels, the remaining bits of the
+ *                    group being zeros. A jump by a multiple of the counter wrap, or a
+ *                    corrupted word is detected at the end of the group.
+ */
+enum seq_encoding {
+    SEQ_ENCODING_SEQ,
+    SEQ_ENCODING_WIDE,
+};
+
+extern enum seq_encoding seq_encoding;
+
+/* "seq" or "wide" */
+const char *seq_encoding_name( enum seq_encoding encoding );
+/* return 0 on success, -1 if the name is unknown */
+int seq_encoding_parse( const char *name, enum seq_encoding *encoding );
+
+#define SEQ_WIDE_HIGH_BITS  32
+#define SEQ_WIDE_WORD_BITS  (SEQ_WIDE_HIGH_BITS + 8)
+
+
+/*
+ * S16 layout. wider formats keep the channel tag in the low bits and
+ * use their extra bits for a longer frame counter (see seq_info.frame_num_mask)
+ */
+#define FRAME_NUM_MASK   0x7FF
+#define FRAME_NUM_SHIFT  5
+#define CHANNEL_MASK     0x1F  /* channel tag */
+
+/*
+ * TDM links carry more channels than the tag can hold: the channels are split in
+ * banks of CHANNEL_MASK+1, and the counter of the bank #b samples is the frame
+ * counter + b. A slip by a multiple of the bank size then still breaks the frame.
+ */
+#define CHANNEL_BANK_SHIFT  5
+#define SEQ_MAX_CHANNELS    256
+#define SEQ_SLOT_REF_NONE   (~0u)
+
+/* expected value of the sample of channel 'ch' in the frame #frame_num */
+#define SEQ_SAMPLE( ch, frame_num, mask ) \
+    (((ch) & CHANNEL_MASK) | ((((frame_num) + ((ch) >> CHANNEL_BANK_SHIFT)) & (mask)) << FRAME_NUM_SHIFT))
+
 enum seq_stat_e {
     NULL_FRAME = 0,
     INVALID_FRAME,
     VALID_FRAME,
-} state;
+};
+
+
+struct seq_info;
+struct seq_classify;
+
+/*
+ * generator and checker, specialized for one format (and some channel counts)
+ * selected by seq_init()
+ */
+struct seq_kernel {
+    snd_pcm_format_t format;
+    unsigned channels;      /* 0: any channel count */
+    unsigned width;         /* number of significant bits of a sample */
+    unsigned sample_bytes;  /* physical size of a sample */
+
+    void (*fill)( struct seq_info *seq, void *buff, int frame_count );
+    int (*check)( struct seq_info *seq, const void *buff, int frame_count );
+
+    /* non interleaved buffers: one buffer per channel */
+    void (*fill_planar)( struct seq_info *seq, void * const *planes, int frame_count );
+    int (*check_planar)( struct seq_info *seq, const void * const *planes, int frame_count );
+
+    /* return the 'width' significant bits of the sample, or store them */
+    uint32_t (*get)( const uint8_t *sample );
+    void (*put)( uint8_t *sample, uint32_t v );
+};
+
+
+/* checker of the SEQ_ENCODING_WIDE word */
+struct seq_wide {
+    unsigned synced;        /* 'next' is known */
+    unsigned next;          /* expected counter of the next frame */
+    unsigned collecting;    /* the group started with the frames received */
+    unsigned locked;        /* 'high' is known */
+    uint32_t high;          /* expected counter bits above the sample counter */
+    uint64_t word;          /* word of the current group */
+    unsigned extra;         /* a padding bit of the group is set */
+};
+
+/*
+ * the SEQ_ENCODING_WIDE word of one value of the counter bits above the sample
+ * counter, which only changes every frame_num_mask+1 frames
+ */
+struct seq_wide_table {
+    unsigned valid;
+    uint32_t high;
+    uint64_t word;
+    /* samples of the group carrying a one: frame in the group and channel */
+    unsigned ones;
+    uint8_t frame[ SEQ_WIDE_WORD_BITS ];
+    uint8_t ch[ SEQ_WIDE_WORD_BITS ];
+    /* integer formats: bytes OR'ed in the first SEQ_WIDE_WORD_BITS interleaved samples of a group */
+    uint8_t image[ SEQ_WIDE_WORD_BITS * 4 ];
+};
 
 
 struct seq_info {
     unsigned channels;
     snd_pcm_format_t format;
+    const struct seq_kernel *kernel;
+    enum seq_encoding encoding;
+
+    /*
+     * FRAME_NUM_MASK for S16, (1 << (width - FRAME_NUM_SHIFT)) - 1 otherwise.
+     * one bit less with SEQ_ENCODING_WIDE
+     */
+    unsigned frame_num_mask;
 
     /*
      * fill:
@@ -51,15 +159,101 @@ struct seq_info {
     enum seq_stat_e state;
     enum seq_stat_e prev_state;
     unsigned error_count;
+
+    /*
+     * check: frames received in a row in the VALID_FRAME state, up to the last one
+     * checked (only meaningful in this state)
+     */
+    unsigned valid_run;
+
+    /*
+     * frame counter expected for the frame being logged, to decode the channels
+     * found in the slots of wide frames. SEQ_SLOT_REF_NONE if unknown
+     */
+    unsigned slot_ref;
+
+    /*
+     * channel slip the checker is locked on: the slot s of the received frames holds
+     * the channel s + rotation of the expected frame, or the channel s + rotation - channels
+     * of the next one, as if 'rotation' samples of the stream were lost.
+     * 0 when the channels are in their slots. 'rotation_frames' counts the slipped frames
+     */
+    unsigned rotation;
+    unsigned rotation_frames;
+
+    /*
+     * set by seq_check_resync(): the first valid frame is expected to be the frame
+     * #resync_expected + the number of frames received meanwhile, give or take
+     * 'resync_tolerance', 'resync_lost' frames being lost by the interruption
+     */
+    unsigned resync;
+    unsigned resync_expected;
+    unsigned long resync_lost;
+    unsigned resync_tolerance;
+
+    /* if not NULL, the anomalies are classified (see classify.h) */
+    struct seq_classify *classify;
+
+    /*
+     * if not NULL, called by the checker with the number of new errors detected.
+     * cleared by seq_init()
+     */
+    void (*error_notify)( struct seq_info *seq, unsigned errors, void *data );
+    void *error_notify_data;
+
+    /*
+     * the sequence repeats every frame_num_mask+1 frames.
+     * 'pattern' holds those frames once for all so seq_fill_frames() is only a copy.
+     * NULL if not available (pattern too large for wide formats, allocation failure)
+     */
+    void *pattern;
+    unsigned pattern_frames;
+    unsigned frame_byte_size;
+
+    /*
+     * SEQ_ENCODING_WIDE: frames per group, byte holding the MSB in a sample,
+     * generator counter bits above frame_num, and checker state.
+     * msb_bits holds the bits set in a sample by its MSB, when setting it is a plain
+     * OR (integer formats, msb_or set), and msb_s16 tells the MSBs can be read by
+     * seq_simd_msb_s16()
+     */
+    unsigned group_frames;
+    unsigned msb_byte;
+    unsigned msb_or;
+    uint8_t msb_bits[ 4 ];
+    unsigned msb_s16;
+    unsigned frame_num_high;
+    struct seq_wide wide;
+    struct seq_wide_table wide_table;
 };
 
 
-void seq_init( struct seq_info *seq, unsigned channels, snd_pcm_format_t format );
+/*
+ * return 1 if a generator and a checker exist for this format
+ */
+int seq_format_supported( snd_pcm_format_t format );
+
+/*
+ * seq_init() selects the kernel matching the format and the channel count,
+ * and allocates the pattern table used by seq_fill_frames(). The encoding is
+ * the current 'seq_encoding'.
+ * return 0 on success, -1 if the format or the channel count (1 to SEQ_MAX_CHANNELS)
+ * is not supported
+ *
+ * seq_free() releases the table. the seq_info can still be used after seq_free() but the
+ * frames are then generated sample per sample.
+ */
+int seq_init( struct seq_info *seq, unsigned channels, snd_pcm_format_t format );
+void seq_free( struct seq_info *seq );
 void seq_reset( struct seq_info *seq );
 
 /*
  * each sample of the frame sequence #N has the expected value
- * (channel & 15) | (N << 4), with channel starting from zero for the first sample of the frame
+ * (channel & CHANNEL_MASK) | (((N + bank) & frame_num_mask) << FRAME_NUM_SHIFT), with channel starting
+ * from zero for the first sample of the frame, and bank = channel >> CHANNEL_BANK_SHIFT
+ * (always 0 up to 32 channels). See SEQ_SAMPLE().
+ * The value is stored on the 16 bits (S16), 24 bits (S24, S24_3, FLOAT) or 32 bits (S32)
+ * of the sample. FLOAT samples hold the signed 24 bits value divided by 2^23.
  *
  * seq_fill_frames() generates 'frame_count' frames with this expected sequence
  *
@@ -67,6 +261,9 @@ void seq_reset( struct seq_info *seq );
  *    - frames filled with 0x00 or 0xFF are not consider as errors. only a warning is
  *      printed with the number of such frames detected.
  *    - if one sample is different frome 0x00 or 0xFF in a frame, every other samples of the frames must be valid
+ *    - after a channel slip, the checker locks on the new alignment: the slip is one error,
+ *      the following frames are checked in their slipped slots, until the channels
+ *      return to their slots or slip again (see seq_info.rotation)
  *
  *
  *    - return 0 when no error is detected
@@ -77,6 +274,13 @@ void seq_reset( struct seq_info *seq );
 void seq_fill_frames( struct seq_info *seq, void *buff, int frame_count );
 int seq_check_frames( struct seq_info *seq, const void *buff, int frame_count );
 
+/*
+ * same for non interleaved buffers: planes[ch] holds the 'frame_count' samples of channel 'ch'.
+ * The errors reported are the same as for the interleaved frames.
+ */
+void seq_fill_frames_planar( struct seq_info *seq, void * const *planes, int frame_count );
+int seq_check_frames_planar( struct seq_info *seq, const void * const *planes, int frame_count );
+
 /*
  * when a xrun or a stream start/stop is detected, we are sure to have a sequence number jump
  * and it should not be consider as an error.
@@ -85,5 +289,14 @@ int seq_check_frames( struct seq_info *seq, const void *buff, int frame_count );
  */
 void seq_check_jump_notify( struct seq_info *seq );
 
+/*
+ * same, when the interruption is known to have lost 'lost' frames of the sequence
+ * (see pcm_frames_lost()): the first valid frame received after it is checked against
+ * this prediction. The frames actually lost are logged, and the frames lost (or repeated)
+ * beyond 'tolerance' are an error.
+ * Without a valid frame before the interruption, there is nothing to predict.
+ */
+void seq_check_resync( struct seq_info *seq, unsigned long lost, unsigned tolerance );
+
 
 #endif //__seq_h__
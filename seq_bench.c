@@ -0,0 +1,341 @@
+/*
+ * Copyright (C) 2015 Arnaud Mouiche <arnaud.mouiche@invoxia.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ */
+
+/*
+ * seq_bench: measure the cost of the sequence generator and checker.
+ *
+ * every combination of encoding, channels, period, format is measured with:
+ *   fill        seq_fill_frames() using the pattern table
+ *   fill_loop   seq_fill_frames() sample per sample (the same seq_info after seq_free())
+ *   check       seq_check_frames() on a buffer with
+ *                 clean    the expected sequence
+ *                 sparse   one corrupted sample every N frames
+ *                 invalid  nothing but garbage
+ *                 null     nothing but silence (null frame detection only)
+ *
+ * each measure is repeated, the best and the median are reported.
+ * --csv gives one line per measure, to compare the releases.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+#include <alsa/asoundlib.h>
+
+#include "seq.h"
+#include "seq_simd.h"
+#include "log.h"
+
+
+enum scenario {
+    SCENARIO_CLEAN,
+    SCENARIO_SPARSE,
+    SCENARIO_INVALID,
+    SCENARIO_NULL,
+};
+
+static const char *scenario_names[] = { "clean", "sparse", "invalid", "null" };
+
+struct bench_opts {
+    int iterations;
+    int repeat;
+    int sparse;         /* frames between two errors in the sparse scenario */
+    int csv;
+};
+
+struct bench_result {
+    double best;        /* ns per frame */
+    double median;
+};
+
+
+static double now( void ) {
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int cmp_double( const void *a, const void *b ) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void result_set( struct bench_result *res, double *ns, int repeat ) {
+    qsort( ns, repeat, sizeof(*ns), cmp_double );
+    res->best = ns[0];
+    res->median = ns[ repeat / 2 ];
+}
+
+
+static void bench_fill( struct seq_info *seq, void *buff, int period, const struct bench_opts *opts, struct bench_result *res ) {
+    double ns[ opts->repeat ];
+    int i, r;
+
+    /* warmup */
+    for (i = 0; i < 16; i++)
+        seq_fill_frames( seq, buff, period );
+
+    for (r = 0; r < opts->repeat; r++) {
+        double t0 = now();
+        for (i = 0; i < opts->iterations; i++)
+            seq_fill_frames( seq, buff, period );
+        ns[r] = (now() - t0) * 1e9 / ((double)opts->iterations * period);
+    }
+    result_set( res, ns, opts->repeat );
+}
+
+/*
+ * the checker is put back in the same state before every period,
+ * so that every period is seen as the continuation of the previous one.
+ * The wide encoding state starts over: its counter is locked again by the
+ * first group of every period.
+ */
+static void bench_check( struct seq_info *seq, const void *buff, int period, unsigned first_frame,
+        const struct bench_opts *opts, struct bench_result *res ) {
+    const struct seq_wide wide = seq->wide;
+    double ns[ opts->repeat ];
+    int i, r;
+
+    seq->state = seq->prev_state = VALID_FRAME;
+    for (i = 0; i < 16; i++) {
+        seq->frame_num = first_frame;
+        seq->wide = wide;
+        seq_check_frames( seq, buff, period );
+    }
+
+    for (r = 0; r < opts->repeat; r++) {
+        double t0 = now();
+        for (i = 0; i < opts->iterations; i++) {
+            seq->state = seq->prev_state = VALID_FRAME;
+            seq->frame_num = first_frame;
+            seq->wide = wide;
+            seq_check_frames( seq, buff, period );
+        }
+        ns[r] = (now() - t0) * 1e9 / ((double)opts->iterations * period);
+    }
+    result_set( res, ns, opts->repeat );
+}
+
+
+/* fill 'buff' with the data of 'scenario', starting from frame #first_frame */
+static void scenario_prepare( enum scenario scenario, struct seq_info *gen, void *buff, int period,
+        unsigned first_frame, const struct bench_opts *opts ) {
+    const unsigned frame_bytes = gen->channels * gen->kernel->sample_bytes;
+    uint8_t *b = (uint8_t *)buff;
+    int i;
+
+    switch (scenario) {
+    case SCENARIO_CLEAN:
+    case SCENARIO_SPARSE:
+        gen->frame_num = first_frame;
+        seq_fill_frames( gen, buff, period );
+        if (scenario == SCENARIO_SPARSE) {
+            /* a wrong bit in the first byte of the sample makes the frame invalid */
+            for (i = opts->sparse / 2; i < period; i += opts->sparse)
+                b[ i * frame_bytes + (i % gen->channels) * gen->kernel->sample_bytes ] ^= 0x01;
+        }
+        break;
+    case SCENARIO_INVALID:
+        /* never 0x00 or 0xFF: no frame is seen as a null frame */
+        for (i = 0; i < period * frame_bytes; i++)
+            b[i] = 1 + rand() % 254;
+        break;
+    case SCENARIO_NULL:
+        memset( buff, 0, period * frame_bytes );
+        break;
+    }
+}
+
+
+static void print_header( const struct bench_opts *opts ) {
+    if (opts->csv)
+        printf("version,simd,kernel,scenario,format,channels,period,ns_per_frame_best,ns_per_frame_median,mframes_per_s,encoding\n");
+    else
+        printf("%-4s %-10s %-8s %-10s %8s %8s %12s %12s %10s\n",
+                "enc", "kernel", "scenario", "format", "channels", "period", "best ns/fr", "median ns/fr", "Mframes/s");
+}
+
+static void print_result( const struct bench_opts *opts, const char *kernel, const char *scenario,
+        snd_pcm_format_t format, int channels, int period, const struct bench_result *res ) {
+    if (opts->csv)
+        printf("%s,%s,%s,%s,%s,%d,%d,%.3f,%.3f,%.3f,%s\n", PACKAGE_VERSION, seq_simd_name(), kernel, scenario,
+                snd_pcm_format_name( format ), channels, period, res->best, res->median, 1e3 / res->best,
+                seq_encoding_name( seq_encoding ));
+    else
+        printf("%-4s %-10s %-8s %-10s %8d %8d %12.2f %12.2f %10.1f\n", seq_encoding_name( seq_encoding ), kernel, scenario,
+                snd_pcm_format_name( format ), channels, period, res->best, res->median, 1e3 / res->best);
+}
+
+
+static int bench_one( snd_pcm_format_t format, int channels, int period, const struct bench_opts *opts ) {
+    struct seq_info gen, chk, loop;
+    struct bench_result res;
+    enum scenario s;
+    void *buff;
+    /* frame #0 is a null frame in mono: start a bit after */
+    const unsigned first_frame = 1;
+
+    if (seq_init( &gen, channels, format )) return -1;
+    buff = malloc( (size_t)period * gen.channels * gen.kernel->sample_bytes );
+    if (!buff || seq_init( &chk, channels, format ) || seq_init( &loop, channels, format )) {
+        printf("out of memory\n");
+        exit(1);
+    }
+    seq_free( &loop ); /* no pattern table: sample per sample generation */
+
+    bench_fill( &gen, buff, period, opts, &res );
+    print_result( opts, "fill", "-", format, channels, period, &res );
+    bench_fill( &loop, buff, period, opts, &res );
+    print_result( opts, "fill_loop", "-", format, channels, period, &res );
+
+    for (s = SCENARIO_CLEAN; s <= SCENARIO_NULL; s++) {
+        scenario_prepare( s, &gen, buff, period, first_frame, opts );
+        bench_check( &chk, buff, period, first_frame, opts, &res );
+        print_result( opts, "check", scenario_names[s], format, channels, period, &res );
+    }
+
+    seq_free( &gen );
+    seq_free( &chk );
+    free( buff );
+    return 0;
+}
+
+
+static void usage( void ) {
+    puts(
+        "usage: seq_bench OPTIONS\n"
+        "-c, --channels=#[,#...]  channels to bench (default 1,2,8,32)\n"
+        "-p, --period=FRAMES[,...] period sizes in number of frames (default 64,960)\n"
+        "-f, --format=FMT[,...]   sample formats (default S16_LE,S32_LE)\n"
+        "-e, --encoding=ENC[,...] sample encodings, seq and/or wide (default seq)\n"
+        "-n, --iterations=N       number of periods processed per measure (default 2000)\n"
+        "-r, --repeat=N           number of measures, the best and the median are reported (default 5)\n"
+        "-s, --sparse=N           one error every N frames in the sparse scenario (default 100)\n"
+        "    --csv                machine readable output\n"
+        );
+    exit(1);
+}
+
+static const struct option options[] = {
+    { "channels", 1, NULL, 'c' },
+    { "period", 1, NULL, 'p' },
+    { "format", 1, NULL, 'f' },
+    { "encoding", 1, NULL, 'e' },
+    { "iterations", 1, NULL, 'n' },
+    { "repeat", 1, NULL, 'r' },
+    { "sparse", 1, NULL, 's' },
+    { "csv", 0, NULL, 'C' },
+    { NULL, 0, NULL, 0 }
+};
+
+/* split a comma separated list in at most 'max' integers. return the count */
+static int int_list_parse( const char *arg, int *values, int max ) {
+    char list[128];
+    char *tok, *saveptr;
+    int n = 0;
+
+    strncpy( list, arg, sizeof(list)-1 );
+    list[ sizeof(list)-1 ] = '\0';
+    for (tok = strtok_r( list, ",", &saveptr ); tok && (n < max); tok = strtok_r( NULL, ",", &saveptr )) {
+        values[n] = atoi(tok);
+        if (values[n] <= 0) usage();
+        n++;
+    }
+    return n;
+}
+
+int main( int argc, char * const argv[] ) {
+    struct bench_opts opts = {
+        .iterations = 2000,
+        .repeat = 5,
+        .sparse = 100,
+        .csv = 0,
+    };
+    const char *opt_channels = "1,2,8,32";
+    const char *opt_periods = "64,960";
+    const char *opt_formats = "S16_LE,S32_LE";
+    const char *opt_encodings = "seq";
+    int channels[16], periods[16];
+    int channels_count, periods_count;
+    int result, opt_index, c, p;
+    char formats_list[128], encodings_list[64];
+    char *tok, *saveptr, *enc, *enc_saveptr;
+
+    while (1) {
+        if ((result = getopt_long( argc, argv, "c:p:f:e:n:r:s:", options, &opt_index )) == EOF) break;
+        switch (result) {
+        case 'c':
+            opt_channels = optarg;
+            break;
+        case 'p':
+            opt_periods = optarg;
+            break;
+        case 'f':
+            opt_formats = optarg;
+            break;
+        case 'e':
+            opt_encodings = optarg;
+            break;
+        case 'n':
+            opts.iterations = atoi(optarg);
+            break;
+        case 'r':
+            opts.repeat = atoi(optarg);
+            break;
+        case 's':
+            opts.sparse = atoi(optarg);
+            break;
+        case 'C':
+            opts.csv = 1;
+            break;
+        default:
+            usage();
+            break;
+        }
+    }
+    if ((opts.iterations <= 0) || (opts.repeat <= 0) || (opts.sparse <= 0)) usage();
+    channels_count = int_list_parse( opt_channels, channels, 16 );
+    periods_count = int_list_parse( opt_periods, periods, 16 );
+
+    /* the errors of the checker would be the only thing measured */
+    log_level_enable( LOG_ERR, 0 );
+    log_level_enable( LOG_WARN, 0 );
+    log_level_enable( LOG_DBG, 0 );
+
+    print_header( &opts );
+
+    strncpy( encodings_list, opt_encodings, sizeof(encodings_list)-1 );
+    encodings_list[ sizeof(encodings_list)-1 ] = '\0';
+    for (enc = strtok_r( encodings_list, ",", &enc_saveptr ); enc; enc = strtok_r( NULL, ",", &enc_saveptr )) {
+        if (seq_encoding_parse( enc, &seq_encoding )) {
+            fprintf(stderr, "unknown encoding '%s'\n", enc);
+            return 1;
+        }
+        strncpy( formats_list, opt_formats, sizeof(formats_list)-1 );
+        formats_list[ sizeof(formats_list)-1 ] = '\0';
+        for (tok = strtok_r( formats_list, ",", &saveptr ); tok; tok = strtok_r( NULL, ",", &saveptr )) {
+            snd_pcm_format_t format = snd_pcm_format_value( tok );
+            if (!seq_format_supported( format )) {
+                fprintf(stderr, "unsupported format '%s'\n", tok);
+                return 1;
+            }
+            for (c = 0; c < channels_count; c++) {
+                for (p = 0; p < periods_count; p++) {
+                    if (bench_one( format, channels[c], periods[p], &opts )) {
+                        fprintf(stderr, "can't bench %s with %d channels\n", tok, channels[c]);
+                        return 1;
+                    }
+                }
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,269 @@
+/*
+ * Copyright (C) 2015 Arnaud Mouiche <arnaud.mouiche@invoxia.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ */
+
+/*
+ * Vectorized fast path of the sequence checker.
+ *
+ * The expected S16 sequence is periodic: sample #k of a block of W frames
+ * starting at frame #N is
+ *     tmpl[k] + ((N << FRAME_NUM_SHIFT) mod 2^16)
+ * where tmpl[] is the block starting at frame #0, since the frame number is
+ * stored in the upper bits of the sample and wraps exactly with the 16 bits
+ * arithmetic.
+ * W is chosen so that a block is a multiple of 16 samples. The whole period
+ * is then compared against tmpl[] + offset, one vector at a time, the offset
+ * being increased by W << FRAME_NUM_SHIFT after each block.
+ * Only the bits of 'keep' are compared: with a frame counter narrower than
+ * the sample, the bits above it are ignored (wide encoding, see seq.h).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <alsa/asoundlib.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SEQ_SIMD_X86
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define SEQ_SIMD_NEON
+#endif
+
+#include "seq.h"
+#include "seq_simd.h"
+
+/* a block is always a multiple of this number of samples */
+#define BLOCK_ALIGN 16
+
+/*
+ * compare 'blocks' blocks of 'len' samples with the template.
+ * return the number of leading blocks fully matching.
+ */
+typedef int (*match_blocks_fn)( const int16_t *buff, const uint16_t *tmpl, int len, int blocks, uint16_t step, uint16_t keep );
+
+static int match_blocks_c( const int16_t *buff, const uint16_t *tmpl, int len, int blocks, uint16_t step, uint16_t keep ) {
+    uint16_t offset = 0;
+    int b, i;
+    for (b = 0; b < blocks; b++) {
+        uint16_t diff = 0;
+        for (i = 0; i < len; i++)
+            diff |= (uint16_t)buff[i] ^ (uint16_t)(tmpl[i] + offset);
+        if (diff & keep) break;
+        buff += len;
+        offset += step;
+    }
+    return b;
+}
+
+#ifdef SEQ_SIMD_X86
+__attribute__((target("sse2")))
+static int match_blocks_sse2( const int16_t *buff, const uint16_t *tmpl, int len, int blocks, uint16_t step, uint16_t keep ) {
+    __m128i offset = _mm_setzero_si128();
+    __m128i inc = _mm_set1_epi16( step );
+    __m128i mask = _mm_set1_epi16( keep );
+    int b, i;
+    for (b = 0; b < blocks; b++) {
+        __m128i diff = _mm_setzero_si128();
+        for (i = 0; i < len; i += 8) {
+            __m128i v = _mm_loadu_si128( (const __m128i *)(buff + i) );
+            __m128i t = _mm_add_epi16( _mm_load_si128( (const __m128i *)(tmpl + i) ), offset );
+            diff = _mm_or_si128( diff, _mm_xor_si128( v, t ) );
+        }
+        diff = _mm_and_si128( diff, mask );
+        if (_mm_movemask_epi8( _mm_cmpeq_epi8( diff, _mm_setzero_si128() ) ) != 0xFFFF) break;
+        buff += len;
+        offset = _mm_add_epi16( offset, inc );
+    }
+    return b;
+}
+
+__attribute__((target("avx2")))
+static int match_blocks_avx2( const int16_t *buff, const uint16_t *tmpl, int len, int blocks, uint16_t step, uint16_t keep ) {
+    __m256i offset = _mm256_setzero_si256();
+    __m256i inc = _mm256_set1_epi16( step );
+    __m256i mask = _mm256_set1_epi16( keep );
+    int b, i;
+    for (b = 0; b < blocks; b++) {
+        __m256i diff = _mm256_setzero_si256();
+        for (i = 0; i < len; i += 16) {
+            __m256i v = _mm256_loadu_si256( (const __m256i *)(buff + i) );
+            __m256i t = _mm256_add_epi16( _mm256_load_si256( (const __m256i *)(tmpl + i) ), offset );
+            diff = _mm256_or_si256( diff, _mm256_xor_si256( v, t ) );
+        }
+        if (!_mm256_testz_si256( diff, mask )) break;
+        buff += len;
+        offset = _mm256_add_epi16( offset, inc );
+    }
+    return b;
+}
+#endif
+
+#ifdef SEQ_SIMD_NEON
+static int match_blocks_neon( const int16_t *buff, const uint16_t *tmpl, int len, int blocks, uint16_t step, uint16_t keep ) {
+    uint16x8_t offset = vdupq_n_u16( 0 );
+    uint16x8_t inc = vdupq_n_u16( step );
+    uint16x8_t mask = vdupq_n_u16( keep );
+    int b, i;
+    for (b = 0; b < blocks; b++) {
+        uint16x8_t diff = vdupq_n_u16( 0 );
+        uint64x2_t d;
+        for (i = 0; i < len; i += 8) {
+            uint16x8_t v = vld1q_u16( (const uint16_t *)(buff + i) );
+            uint16x8_t t = vaddq_u16( vld1q_u16( tmpl + i ), offset );
+            diff = vorrq_u16( diff, veorq_u16( v, t ) );
+        }
+        d = vreinterpretq_u64_u16( vandq_u16( diff, mask ) );
+        if (vgetq_lane_u64( d, 0 ) | vgetq_lane_u64( d, 1 )) break;
+        buff += len;
+        offset = vaddq_u16( offset, inc );
+    }
+    return b;
+}
+#endif
+
+
+
+/* MSBs of 'count' samples, see seq_simd_msb_s16() */
+typedef uint64_t (*msb_fn)( const int16_t *buff, int count );
+
+static uint64_t msb_c( const int16_t *buff, int count ) {
+    uint64_t bits = 0;
+    int i;
+    for (i = 0; i < count; i++)
+        bits |= (uint64_t)((uint16_t)buff[i] >> 15) << i;
+    return bits;
+}
+
+#ifdef SEQ_SIMD_X86
+__attribute__((target("sse2")))
+static uint64_t msb_sse2( const int16_t *buff, int count ) {
+    uint64_t bits = 0;
+    int i;
+    /* the signed saturation keeps the sign of each sample in its byte */
+    for (i = 0; i + 16 <= count; i += 16) {
+        __m128i a = _mm_loadu_si128( (const __m128i *)(buff + i) );
+        __m128i b = _mm_loadu_si128( (const __m128i *)(buff + i + 8) );
+        bits |= (uint64_t)(uint16_t)_mm_movemask_epi8( _mm_packs_epi16( a, b ) ) << i;
+    }
+    if (i < count) bits |= msb_c( buff + i, count - i ) << i;
+    return bits;
+}
+#endif
+
+
+static match_blocks_fn match_blocks = match_blocks_c;
+static const char *match_blocks_name = "c";
+static msb_fn msb = msb_c;
+
+void seq_simd_init( void ) {
+    static int initialized = 0;
+    if (initialized) return;
+    initialized = 1;
+
+#ifdef SEQ_SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports( "sse2" ))
+        msb = msb_sse2;
+    if (__builtin_cpu_supports( "avx2" )) {
+        match_blocks = match_blocks_avx2;
+        match_blocks_name = "avx2";
+    } else if (__builtin_cpu_supports( "sse2" )) {
+        match_blocks = match_blocks_sse2;
+        match_blocks_name = "sse2";
+    }
+#endif
+#ifdef SEQ_SIMD_NEON
+    /* NEON availability is decided at build time (always there on aarch64) */
+    match_blocks = match_blocks_neon;
+    match_blocks_name = "neon";
+#endif
+}
+
+const char *seq_simd_name( void ) {
+    return match_blocks_name;
+}
+
+
+static inline uint16_t expected_sample( unsigned ch, unsigned frame_num, unsigned mask ) {
+    return SEQ_SAMPLE( ch, frame_num, mask );
+}
+
+static inline uint16_t keep_bits( unsigned mask ) {
+    return CHANNEL_MASK | (mask << FRAME_NUM_SHIFT);
+}
+
+static int frame_match( const int16_t *frame, unsigned channels, unsigned first_ch, unsigned frame_num, unsigned mask ) {
+    const uint16_t keep = keep_bits( mask );
+    unsigned ch;
+    for (ch = 0; ch < channels; ch++) {
+        if (((uint16_t)frame[ch] ^ expected_sample( first_ch + ch, frame_num, mask )) & keep) return 0;
+    }
+    return 1;
+}
+
+static unsigned gcd( unsigned a, unsigned b ) {
+    while (b) {
+        unsigned t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+/*
+ * 'channels' interleaved channels, the first one being tagged 'first_ch'
+ */
+static int match_s16( const int16_t *buff, unsigned channels, unsigned first_ch, unsigned frame_num, unsigned mask, int frame_count ) {
+    uint16_t tmpl[ BLOCK_ALIGN * SEQ_MAX_CHANNELS ] __attribute__((aligned(32)));
+    unsigned block_frames, len, k;
+    int n;
+
+    /* don't bother building the template if the first frame is already wrong */
+    if ((frame_count <= 0) || !frame_match( buff, channels, first_ch, frame_num, mask )) return 0;
+
+    block_frames = BLOCK_ALIGN / gcd( channels, BLOCK_ALIGN );
+    len = block_frames * channels;
+    for (k = 0; k < len; k++)
+        tmpl[k] = expected_sample( first_ch + k % channels, frame_num + k / channels, mask );
+
+    n = match_blocks( buff, tmpl, len, frame_count / block_frames, block_frames << FRAME_NUM_SHIFT, keep_bits( mask ) ) * block_frames;
+
+    /* remaining frames, or the frames of the block where a mismatch was found */
+    while ((n < frame_count) && frame_match( buff + n * channels, channels, first_ch, frame_num + n, mask ))
+        n++;
+    return n;
+}
+
+int seq_simd_match_s16( const int16_t *buff, unsigned channels, unsigned frame_num, unsigned mask, int frame_count ) {
+    if ((channels == 0) || (channels > SEQ_MAX_CHANNELS)) return 0;
+
+    if (channels == 1) {
+        /*
+         * mono frames #0 (0x0000) and #0x7F8 (0xFF00, with a 11 bits counter) may be
+         * NULL frames for the checker. stop just before the next one.
+         */
+        unsigned fn = frame_num & mask;
+        unsigned to_zero = (0 - fn) & mask;
+        unsigned to_ff00 = ((0xFF00 >> FRAME_NUM_SHIFT) - fn) & mask;
+        int before_null = (to_zero < to_ff00) ? to_zero : to_ff00;
+        if (frame_count > before_null) frame_count = before_null;
+    }
+
+    return match_s16( buff, channels, 0, frame_num, mask, frame_count );
+}
+
+int seq_simd_match_s16_plane( const int16_t *plane, unsigned ch, unsigned frame_num, unsigned mask, int frame_count ) {
+    if (ch >= SEQ_MAX_CHANNELS) return 0;
+    return match_s16( plane, 1, ch, frame_num, mask, frame_count );
+}
+
+uint64_t seq_simd_msb_s16( const int16_t *buff, int count ) {
+    return msb( buff, count );
+}
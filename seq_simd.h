@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2015 Arnaud Mouiche <arnaud.mouiche@invoxia.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ */
+
+#ifndef __seq_simd_h__
+#define __seq_simd_h__
+
+#include <stdint.h>
+
+/*
+ * select the best vector implementation available on the running CPU
+ * (AVX2, SSE2 on x86, NEON on ARM, plain C otherwise).
+ * Can be called several times, the selection is only done once.
+ */
+void seq_simd_init( void );
+
+/* name of the selected implementation ("avx2", "sse2", "neon" or "c") */
+const char *seq_simd_name( void );
+
+/*
+ * return how many leading frames of 'buff' match the S16 sequence starting at 'frame_num':
+ *   sample[ch] of frame #N == SEQ_SAMPLE( ch, N, mask )
+ * 'mask' is the frame counter mask (seq_info.frame_num_mask). The sample bits above
+ * the counter are not compared.
+ *
+ * Frames which may be seen as NULL frames by the checker (mono stream, frames #0 and #0x7F8)
+ * are never matched, so the caller can give the first non matching frame to the
+ * regular state machine.
+ */
+int seq_simd_match_s16( const int16_t *buff, unsigned channels, unsigned frame_num, unsigned mask, int frame_count );
+
+/*
+ * planar version: return how many leading samples of the buffer of channel 'ch'
+ * match the expected sequence starting at 'frame_num'.
+ * A frame is only NULL if every channel is, so there is no special case here:
+ * mono streams must use seq_simd_match_s16().
+ */
+int seq_simd_match_s16_plane( const int16_t *plane, unsigned ch, unsigned frame_num, unsigned mask, int frame_count );
+
+/*
+ * return the MSBs of the 'count' (64 at most) samples of 'buff': bit #k is the
+ * MSB of sample #k. Used by the wide encoding (see seq.h)
+ */
+uint64_t seq_simd_msb_s16( const int16_t *buff, int count );
+
+#endif //__seq_simd_h__
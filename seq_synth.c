@@ -0,0 +1,286 @@
+/*
+ * Copyright (C) 2015 Arnaud Mouiche <arnaud.mouiche@invoxia.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ */
+
+/*
+ * seq_synth: stress the sequence checker with a synthesized faulty stream.
+ *
+ * The stream is generated in memory, then checked twice:
+ *   - fault by fault, to tell if each injected fault was reported as an error,
+ *     only noticed (the checker left the valid state: null or invalid frames
+ *     tolerated by design), or missed. The online classification of the
+ *     anomalies (see classify.h) is printed too, to compare with the faults,
+ *   - period by period, to measure the checker throughput under this error rate.
+ *
+ * With -o FILE, the stream is also written in FILE and FILE.meta (see 'atest verify'),
+ * and the ground truth in FILE.faults: one "POSITION CLASS LEN ARG" line per fault.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+#include <alsa/asoundlib.h>
+
+#include "seq.h"
+#include "synth.h"
+#include "classify.h"
+#include "log.h"
+
+
+struct events {
+    struct synth_event *ev;
+    unsigned count;
+    unsigned size;
+};
+
+struct class_stats {
+    unsigned injected;
+    unsigned errors;        /* reported as errors */
+    unsigned noticed;       /* only seen as null or invalid frames */
+    unsigned missed;
+};
+
+
+static double now( void ) {
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void on_event( void *data, const struct synth_event *ev ) {
+    struct events *e = (struct events *)data;
+    if (e->count == e->size) {
+        unsigned size = e->size ? e->size * 2 : 1024;
+        struct synth_event *p = realloc( e->ev, size * sizeof(*p) );
+        if (!p) {
+            printf("out of memory\n");
+            exit(1);
+        }
+        e->ev = p;
+        e->size = size;
+    }
+    e->ev[ e->count++ ] = *ev;
+}
+
+
+static int write_stream( const char *path, const void *buff, size_t bytes, snd_pcm_format_t format,
+        unsigned channels, unsigned rate, unsigned period, const struct events *e ) {
+    char meta_path[1024];
+    FILE *f;
+    unsigned i;
+
+    f = fopen( path, "w" );
+    if (!f || (fwrite( buff, 1, bytes, f ) != bytes)) goto failed;
+    fclose( f );
+
+    snprintf( meta_path, sizeof(meta_path), "%s.meta", path );
+    f = fopen( meta_path, "w" );
+    if (!f) goto failed;
+    fprintf( f, "format %s\nchannels %u\nrate %u\nperiod %u\n", snd_pcm_format_name( format ), channels, rate, period );
+    fclose( f );
+
+    snprintf( meta_path, sizeof(meta_path), "%s.faults", path );
+    f = fopen( meta_path, "w" );
+    if (!f) goto failed;
+    for (i = 0; i < e->count; i++)
+        fprintf( f, "%llu %s %u %u\n", e->ev[i].pos, synth_fault_name( e->ev[i].fault ), e->ev[i].len, e->ev[i].arg );
+    fclose( f );
+    return 0;
+
+failed:
+    if (f) fclose( f );
+    printf("can't write '%s'\n", path);
+    return -1;
+}
+
+
+/*
+ * check the stream fault by fault: the frames altered by each fault, plus the next
+ * one (where a jump is seen) are checked one at a time
+ */
+static void check_faults( struct seq_info *chk, const uint8_t *buff, unsigned long long total, unsigned frame_bytes,
+        const struct events *e, struct class_stats *stats ) {
+    unsigned long long pos = 0;
+    unsigned i;
+
+    for (i = 0; i < e->count; i++) {
+        const struct synth_event *ev = &e->ev[i];
+        unsigned long long end = ev->pos + ev->frames + 1;
+        int errors = 0, noticed = 0;
+
+        /* nothing after the fault to see it */
+        if (end > total) break;
+        if ((i + 1 < e->count) && (end > e->ev[i+1].pos)) end = e->ev[i+1].pos;
+
+        if (ev->pos > pos) seq_check_frames( chk, buff + pos * frame_bytes, ev->pos - pos );
+        for (pos = ev->pos; pos < end; pos++) {
+            errors += seq_check_frames( chk, buff + pos * frame_bytes, 1 );
+            if (chk->state != VALID_FRAME) noticed = 1;
+        }
+
+        stats[ ev->fault ].injected++;
+        if (errors)
+            stats[ ev->fault ].errors++;
+        else if (noticed)
+            stats[ ev->fault ].noticed++;
+        else
+            stats[ ev->fault ].missed++;
+    }
+}
+
+
+static void usage( void ) {
+    puts(
+        "usage: seq_synth OPTIONS\n"
+        "-c, --channels=#         channels (default 2)\n"
+        "-f, --format=FORMAT      sample format (default S16_LE)\n"
+        "-p, --period=FRAMES      period size in number of frames (default 960)\n"
+        "-n, --frames=N           frames generated (default 4800000)\n"
+        "-F, --faults=LIST        mean frames between two faults of each class, as\n"
+        "                         CLASS=N[,CLASS=N...] among drop,dup,rotate,slip,gap,flip,truncate\n"
+        "                         (default 20000 for every class)\n"
+        "-l, --max-len=FRAMES     longest fault (default 16)\n"
+        "-s, --seed=N             random seed (default 1)\n"
+        "-r, --rate=#             sample rate written in FILE.meta (default 48000)\n"
+        "-o, --output=FILE        write the stream in FILE, FILE.meta and the faults in FILE.faults\n"
+        );
+    exit(1);
+}
+
+static const struct option options[] = {
+    { "channels", 1, NULL, 'c' },
+    { "format", 1, NULL, 'f' },
+    { "period", 1, NULL, 'p' },
+    { "frames", 1, NULL, 'n' },
+    { "faults", 1, NULL, 'F' },
+    { "max-len", 1, NULL, 'l' },
+    { "seed", 1, NULL, 's' },
+    { "rate", 1, NULL, 'r' },
+    { "output", 1, NULL, 'o' },
+    { NULL, 0, NULL, 0 }
+};
+
+int main( int argc, char * const argv[] ) {
+    struct synth_opts opts = { .max_len = 16, .seed = 1 };
+    snd_pcm_format_t format = SND_PCM_FORMAT_S16_LE;
+    unsigned channels = 2, period = 960, rate = 48000;
+    unsigned long long frames = 4800000, total = 0, pos;
+    const char *output = NULL;
+    struct class_stats stats[ SYNTH_FAULT_COUNT ];
+    struct events events = { NULL, 0, 0 };
+    struct synth synth;
+    struct seq_info chk;
+    struct seq_classify *classify;
+    unsigned long long errors = 0, missed = 0;
+    double t0, t_synth, t_check;
+    uint8_t *buff;
+    int result, opt_index, f;
+
+    for (f = 0; f < SYNTH_FAULT_COUNT; f++)
+        opts.interval[f] = 20000;
+
+    while (1) {
+        if ((result = getopt_long( argc, argv, "c:f:p:n:F:l:s:r:o:", options, &opt_index )) == EOF) break;
+        switch (result) {
+        case 'c':
+            channels = atoi(optarg);
+            break;
+        case 'f':
+            format = snd_pcm_format_value( optarg );
+            break;
+        case 'p':
+            period = atoi(optarg);
+            break;
+        case 'n':
+            frames = strtoull( optarg, NULL, 0 );
+            break;
+        case 'F':
+            memset( opts.interval, 0, sizeof(opts.interval) );
+            if (synth_opts_parse( &opts, optarg )) usage();
+            break;
+        case 'l':
+            opts.max_len = atoi(optarg);
+            break;
+        case 's':
+            opts.seed = atoi(optarg);
+            break;
+        case 'r':
+            rate = atoi(optarg);
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        default:
+            usage();
+            break;
+        }
+    }
+    if (!channels || !period || !frames || !opts.max_len) usage();
+
+    /* the checker logs would be the only thing measured */
+    log_level_enable( LOG_ERR, 0 );
+    log_level_enable( LOG_WARN, 0 );
+    log_level_enable( LOG_DBG, 0 );
+
+    if (synth_init( &synth, channels, format, &opts, on_event, &events )) {
+        printf("unsupported format\n");
+        return 1;
+    }
+    buff = malloc( (frames + period) * synth.frame_bytes );
+    if (!buff) {
+        printf("out of memory\n");
+        return 1;
+    }
+
+    t0 = now();
+    while (total < frames)
+        total += synth_period( &synth, buff + total * synth.frame_bytes, period );
+    t_synth = now() - t0;
+
+    if (output && write_stream( output, buff, total * synth.frame_bytes, format, channels, rate, period, &events ))
+        return 1;
+
+    memset( stats, 0, sizeof(stats) );
+    seq_init( &chk, channels, format );
+    if (seq_classify_attach( &chk )) {
+        printf("out of memory\n");
+        return 1;
+    }
+    check_faults( &chk, buff, total, synth.frame_bytes, &events, stats );
+    classify = chk.classify;
+    chk.classify = NULL;
+
+    /* throughput, as in the tests: one period at a time */
+    seq_reset( &chk );
+    t0 = now();
+    for (pos = 0; pos < total; pos += period) {
+        unsigned n = (total - pos < period) ? total - pos : period;
+        errors += seq_check_frames( &chk, buff + pos * synth.frame_bytes, n );
+    }
+    t_check = now() - t0;
+
+    printf("%-10s %10s %10s %10s %10s\n", "fault", "injected", "errors", "noticed", "missed");
+    for (f = 0; f < SYNTH_FAULT_COUNT; f++) {
+        printf("%-10s %10u %10u %10u %10u\n", synth_fault_name( f ),
+                stats[f].injected, stats[f].errors, stats[f].noticed, stats[f].missed);
+        missed += stats[f].missed;
+    }
+    seq_classify_report( classify, "synth", "classified" );
+    printf("%llu frames, %u faults, %llu errors\n", total, events.count, errors);
+    printf("synth: %.1f Mframes/s (%.0f MB/s)\n", total / t_synth * 1e-6, total * synth.frame_bytes / t_synth * 1e-6);
+    printf("check: %.1f Mframes/s (%.2f ns/frame)\n", total / t_check * 1e-6, t_check * 1e9 / total);
+
+    seq_free( &chk );
+    free( classify );
+    synth_free( &synth );
+    free( events.ev );
+    free( buff );
+    return missed ? 1 : 0;
+}
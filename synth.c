@@ -0,0 +1,247 @@
+/*
+ * Copyright (C) 2015 Arnaud Mouiche <arnaud.mouiche@invoxia.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "synth.h"
+
+static const char *fault_names[ SYNTH_FAULT_COUNT ] = {
+    [SYNTH_DROP] = "drop",
+    [SYNTH_DUP] = "dup",
+    [SYNTH_ROTATE] = "rotate",
+    [SYNTH_SLIP] = "slip",
+    [SYNTH_GAP] = "gap",
+    [SYNTH_FLIP] = "flip",
+    [SYNTH_TRUNCATE] = "truncate",
+};
+
+const char *synth_fault_name( enum synth_fault fault ) {
+    return ((unsigned)fault < SYNTH_FAULT_COUNT) ? fault_names[fault] : "?";
+}
+
+int synth_fault_value( const char *name ) {
+    int f;
+    for (f = 0; f < SYNTH_FAULT_COUNT; f++) {
+        if (!strcmp( name, fault_names[f] )) return f;
+    }
+    return -1;
+}
+
+int synth_opts_parse( struct synth_opts *opts, const char *arg ) {
+    char list[256];
+    char *tok, *saveptr;
+
+    strncpy( list, arg, sizeof(list)-1 );
+    list[ sizeof(list)-1 ] = '\0';
+    for (tok = strtok_r( list, ",", &saveptr ); tok; tok = strtok_r( NULL, ",", &saveptr )) {
+        char *eq = strchr( tok, '=' );
+        int f;
+        if (!eq) return -1;
+        *eq = '\0';
+        f = synth_fault_value( tok );
+        if (f < 0) return -1;
+        opts->interval[f] = strtoul( eq + 1, NULL, 0 );
+    }
+    return 0;
+}
+
+
+/* xorshift64*: fast enough to never show in the profile */
+static uint64_t rng_next( struct synth *s ) {
+    s->rng ^= s->rng >> 12;
+    s->rng ^= s->rng << 25;
+    s->rng ^= s->rng >> 27;
+    return s->rng * 0x2545F4914F6CDD1Dull;
+}
+
+static unsigned rng_below( struct synth *s, unsigned n ) {
+    return (unsigned)((rng_next( s ) >> 32) % n);
+}
+
+/* uniform in ]0, 1] */
+static double rng_unit( struct synth *s ) {
+    return ((rng_next( s ) >> 11) + 1) * (1.0 / 9007199254740992.0);
+}
+
+
+static void schedule( struct synth *s ) {
+    double d;
+    if (s->rate_total <= 0) {
+        s->next_fault = ~0ull;
+        return;
+    }
+    /* poisson process: exponential interval */
+    d = -log( rng_unit( s ) ) / s->rate_total;
+    s->next_fault = s->pos + 1 + (unsigned long long)d;
+}
+
+static enum synth_fault pick( struct synth *s ) {
+    double r = rng_unit( s ) * s->rate_total;
+    int f, last = 0;
+    for (f = 0; f < SYNTH_FAULT_COUNT; f++) {
+        if (!s->opts.interval[f]) continue;
+        last = f;
+        r -= 1.0 / s->opts.interval[f];
+        if (r <= 0) break;
+    }
+    return (f < SYNTH_FAULT_COUNT) ? f : last;
+}
+
+
+int synth_init( struct synth *s, unsigned channels, snd_pcm_format_t format, const struct synth_opts *opts,
+        synth_event_fn event, void *event_data ) {
+    int f;
+
+    memset( s, 0, sizeof(*s) );
+    if (seq_init( &s->gen, channels, format )) return -1;
+    s->opts = *opts;
+    if (!s->opts.max_len) s->opts.max_len = 1;
+    /* nothing to rotate or slip in mono */
+    if (channels < 2) s->opts.interval[SYNTH_ROTATE] = s->opts.interval[SYNTH_SLIP] = 0;
+    s->frame_bytes = channels * s->gen.kernel->sample_bytes;
+    s->rng = opts->seed * 0x9E3779B97F4A7C15ull + 1;
+    s->event = event;
+    s->event_data = event_data;
+
+    for (f = 0; f < SYNTH_FAULT_COUNT; f++) {
+        if (s->opts.interval[f]) s->rate_total += 1.0 / s->opts.interval[f];
+    }
+    /* frame #0 is a null frame in mono: start a bit after, as a running stream */
+    s->gen.frame_num = 1;
+    schedule( s );
+    return 0;
+}
+
+void synth_free( struct synth *s ) {
+    seq_free( &s->gen );
+}
+
+
+static void rotate_frames( struct synth *s, uint8_t *b, unsigned frames, unsigned by ) {
+    const unsigned bytes = s->gen.kernel->sample_bytes;
+    const unsigned shift = by * bytes;
+    uint8_t tmp[ s->frame_bytes ];
+
+    while (frames--) {
+        memcpy( tmp, b, s->frame_bytes );
+        memcpy( b, tmp + shift, s->frame_bytes - shift );
+        memcpy( b + s->frame_bytes - shift, tmp, shift );
+        b += s->frame_bytes;
+    }
+}
+
+/*
+ * generate 'frames' frames starting 'by' samples late in the stream: the samples
+ * of the next frame fill the end of the last one
+ */
+static void slip_frames( struct synth *s, uint8_t *b, unsigned frames, unsigned by ) {
+    const unsigned shift = by * s->gen.kernel->sample_bytes;
+    const unsigned bytes = frames * s->frame_bytes;
+    uint8_t next[ s->frame_bytes ];
+
+    seq_fill_frames( &s->gen, b, frames );
+    seq_fill_frames( &s->gen, next, 1 );
+    memmove( b, b + shift, bytes - shift );
+    memcpy( b + bytes - shift, next, shift );
+}
+
+/* invert one significant bit of a random sample of the frame. return the bit index in the frame */
+static unsigned flip_frame( struct synth *s, uint8_t *frame ) {
+    const unsigned bytes = s->gen.kernel->sample_bytes;
+    while (1) {
+        unsigned bit = rng_below( s, s->frame_bytes * 8 );
+        uint8_t *sample = frame + (bit / 8) / bytes * bytes;
+        uint32_t before = s->gen.kernel->get( sample );
+        frame[ bit / 8 ] ^= 1 << (bit % 8);
+        /* padding bits are ignored by the checker: try again */
+        if (s->gen.kernel->get( sample ) != before) return bit;
+        frame[ bit / 8 ] ^= 1 << (bit % 8);
+    }
+}
+
+int synth_period( struct synth *s, void *buff, int frame_count ) {
+    const unsigned mask = s->gen.frame_num_mask;
+    uint8_t *b = (uint8_t *)buff;
+    int done = 0;
+
+    while (done < frame_count) {
+        struct synth_event ev;
+        unsigned left = frame_count - done;
+        uint8_t *p = b + done * s->frame_bytes;
+
+        if (s->next_fault > s->pos) {
+            unsigned long long n = s->next_fault - s->pos;
+            if (n > left) n = left;
+            seq_fill_frames( &s->gen, p, n );
+            done += n;
+            s->pos += n;
+            continue;
+        }
+
+        ev.pos = s->pos;
+        ev.fault = pick( s );
+        ev.len = 1 + rng_below( s, s->opts.max_len );
+        ev.arg = 0;
+        ev.frames = 0;
+        switch (ev.fault) {
+        case SYNTH_DROP:
+            s->gen.frame_num = (s->gen.frame_num + ev.len) & mask;
+            break;
+        case SYNTH_DUP:
+            if (ev.len > s->pos) ev.len = s->pos;
+            if (ev.len > left) ev.len = left;
+            s->gen.frame_num = (s->gen.frame_num - ev.len) & mask;
+            seq_fill_frames( &s->gen, p, ev.len );
+            ev.frames = ev.len;
+            break;
+        case SYNTH_ROTATE: {
+            if (ev.len > left) ev.len = left;
+            ev.arg = 1 + rng_below( s, s->gen.channels - 1 );
+            seq_fill_frames( &s->gen, p, ev.len );
+            rotate_frames( s, p, ev.len, ev.arg );
+            ev.frames = ev.len;
+        }   break;
+        case SYNTH_SLIP:
+            if (ev.len > left) ev.len = left;
+            ev.arg = 1 + rng_below( s, s->gen.channels - 1 );
+            slip_frames( s, p, ev.len, ev.arg );
+            ev.frames = ev.len;
+            break;
+        case SYNTH_GAP:
+            if (ev.len > left) ev.len = left;
+            ev.arg = rng_below( s, 2 ) ? 0xFF : 0x00;
+            memset( p, ev.arg, ev.len * s->frame_bytes );
+            s->gen.frame_num = (s->gen.frame_num + ev.len) & mask;
+            ev.frames = ev.len;
+            break;
+        case SYNTH_FLIP:
+            ev.len = 1;
+            seq_fill_frames( &s->gen, p, 1 );
+            ev.arg = flip_frame( s, p );
+            ev.frames = 1;
+            break;
+        case SYNTH_TRUNCATE:
+        default:
+            ev.fault = SYNTH_TRUNCATE;
+            ev.len = left;
+            s->gen.frame_num = (s->gen.frame_num + ev.len) & mask;
+            break;
+        }
+        done += ev.frames;
+        s->pos += ev.frames;
+        s->count[ ev.fault ]++;
+        schedule( s );
+        if (s->event) s->event( s->event_data, &ev );
+        if (ev.fault == SYNTH_TRUNCATE) break;
+    }
+    return done;
+}
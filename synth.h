@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2015 Arnaud Mouiche <arnaud.mouiche@invoxia.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ */
+
+#ifndef __synth_h__
+#define __synth_h__
+
+#include <alsa/asoundlib.h>
+
+#include "seq.h"
+
+/*
+ * synthesizer of faulty sequence streams, to stress the checker.
+ *
+ * The clean frames come from the pattern table of seq_fill_frames(), so the
+ * stream is produced at memory speed. Faults are injected at random positions
+ * and each of them is reported to the event callback (the ground truth).
+ */
+
+enum synth_fault {
+    SYNTH_DROP,         /* 'len' frames of the sequence are missing */
+    SYNTH_DUP,          /* the last 'len' frames are sent again */
+    SYNTH_ROTATE,       /* 'len' frames with the channels rotated by 'arg' */
+    SYNTH_SLIP,         /* 'len' frames starting 'arg' samples late: the channels slip */
+    SYNTH_GAP,          /* 'len' frames replaced by 'arg' bytes (0x00 or 0xFF) */
+    SYNTH_FLIP,         /* bit #arg of one frame is inverted */
+    SYNTH_TRUNCATE,     /* the period ends early: its 'len' last frames are missing */
+    SYNTH_FAULT_COUNT,
+};
+
+/* "drop", "dup", "rotate", "slip", "gap", "flip", "truncate" */
+const char *synth_fault_name( enum synth_fault fault );
+/* return -1 if unknown */
+int synth_fault_value( const char *name );
+
+struct synth_event {
+    unsigned long long pos;     /* position of the fault in the output stream */
+    enum synth_fault fault;
+    unsigned len;
+    unsigned arg;
+    unsigned frames;            /* frames of the output stream altered, from 'pos' */
+};
+
+typedef void (*synth_event_fn)( void *data, const struct synth_event *ev );
+
+struct synth_opts {
+    /* mean number of frames between two faults of each class. 0: disabled */
+    unsigned interval[ SYNTH_FAULT_COUNT ];
+    unsigned max_len;           /* faults last 1 to max_len frames */
+    unsigned seed;
+};
+
+/*
+ * parse a "CLASS=FRAMES[,CLASS=FRAMES...]" list into opts->interval.
+ * return 0 on success, -1 on error
+ */
+int synth_opts_parse( struct synth_opts *opts, const char *arg );
+
+struct synth {
+    struct seq_info gen;
+    struct synth_opts opts;
+    unsigned frame_bytes;
+
+    double rate_total;          /* faults per frame, every class included */
+    uint64_t rng;
+    unsigned long long pos;
+    unsigned long long next_fault;
+    unsigned long long count[ SYNTH_FAULT_COUNT ];
+
+    synth_event_fn event;
+    void *event_data;
+};
+
+/* return 0 on success, -1 if the format is not supported */
+int synth_init( struct synth *s, unsigned channels, snd_pcm_format_t format, const struct synth_opts *opts,
+        synth_event_fn event, void *event_data );
+void synth_free( struct synth *s );
+
+/*
+ * produce a period of at most 'frame_count' interleaved frames.
+ * return the number of frames produced: less than 'frame_count' after a SYNTH_TRUNCATE fault
+ */
+int synth_period( struct synth *s, void *buff, int frame_count );
+
+#endif //__synth_h__
@@ -0,0 +1,170 @@
+/*
+ * Copyright (C) 2015 Arnaud Mouiche <arnaud.mouiche@invoxia.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE     /* pthread_setaffinity_np */
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "test.h"
+#include "log.h"
+
+
+static unsigned seq_errors_total = 0;
+
+
+static void test_seq_error( struct seq_info *seq, unsigned errors, void *data ) {
+    struct test *t = (struct test *)data;
+
+    __atomic_add_fetch( &t->seq_errors, errors, __ATOMIC_RELAXED );
+    __atomic_add_fetch( &seq_errors_total, errors, __ATOMIC_RELAXED );
+    if (t->error_notify) t->error_notify( t, t->error_notify_data );
+}
+
+void test_seq_attach( struct test *t, struct seq_info *seq ) {
+    seq->error_notify = test_seq_error;
+    seq->error_notify_data = t;
+}
+
+unsigned test_seq_errors_total( void ) {
+    return __atomic_load_n( &seq_errors_total, __ATOMIC_RELAXED );
+}
+
+
+void test_wakeup_record( struct test *t, struct pcm *pcm, struct hist *wakeup ) {
+    snd_pcm_uframes_t headroom;
+    uint64_t lateness;
+    int r;
+
+    r = pcm_wakeup_lateness( pcm, t->config.period, t->config.rate, &lateness, &headroom );
+    if (r < 0) return;
+    if (r == 0) hist_record( wakeup, lateness );
+    if (headroom < __atomic_load_n( &t->headroom, __ATOMIC_RELAXED ))
+        __atomic_store_n( &t->headroom, headroom, __ATOMIC_RELAXED );
+}
+
+
+int test_priority_set( const char *priority ) {
+    struct sched_param param;
+    int policy, p;
+
+    if (sscanf(priority, "fifo,%d", &p )==1) {
+        policy = SCHED_FIFO;
+    } else if (sscanf(priority, "rr,%d", &p )==1) {
+        policy = SCHED_RR;
+    } else if (sscanf(priority, "other,%d", &p )==1) {
+        policy = SCHED_OTHER;
+    } else {
+        return -1;
+    }
+
+    dbg("priority: %s", priority);
+    param.sched_priority = p;
+    if (pthread_setschedparam( pthread_self(), policy, &param ))
+        err("pthread_setschedparam");
+    return 0;
+}
+
+
+/* stop request from test_close() */
+static void on_stop( struct ev_loop *loop, struct ev_async *w, int revents ) {
+    ev_unloop( loop, EVUNLOOP_ALL );
+}
+
+/* the test thread loop stopped by itself: stop everything */
+static void on_thread_exit( struct ev_loop *loop, struct ev_async *w, int revents ) {
+    struct test *t = (struct test *)(w->data);
+    dbg("%s: %s thread stopped", t->device, t->name);
+    ev_unloop( loop, EVUNLOOP_ALL );
+}
+
+static void *test_thread( void *arg ) {
+    struct test *t = (struct test *)arg;
+
+    if (t->thread_opts.cpu >= 0) {
+        cpu_set_t cpus;
+        CPU_ZERO( &cpus );
+        CPU_SET( t->thread_opts.cpu, &cpus );
+        if (pthread_setaffinity_np( pthread_self(), sizeof(cpus), &cpus ))
+            err("%s: can't pin %s thread on CPU %d", t->device, t->name, t->thread_opts.cpu);
+    }
+    if (t->thread_opts.priority[0] && test_priority_set( t->thread_opts.priority ))
+        err("%s: invalid priority '%s'", t->device, t->thread_opts.priority);
+
+    ev_run( t->loop, 0 );
+
+    if (!__atomic_load_n( &t->stopping, __ATOMIC_ACQUIRE ))
+        ev_async_send( t->main_loop, &t->exit_watcher );
+    return NULL;
+}
+
+
+int test_start( struct test *t, struct ev_loop *main_loop ) {
+    int r;
+
+    t->main_loop = main_loop;
+    t->headroom = UINT_MAX;
+    if (!t->thread_opts.threaded) {
+        t->loop = main_loop;
+        return t->ops->start( t );
+    }
+
+    t->loop = ev_loop_new( EVFLAG_AUTO );
+    if (!t->loop) {
+        err("%s: can't create the %s event loop", t->device, t->name);
+        return -1;
+    }
+    ev_async_init( &t->stop_watcher, on_stop );
+    ev_async_start( t->loop, &t->stop_watcher );
+    ev_async_init( &t->exit_watcher, on_thread_exit );
+    t->exit_watcher.data = t;
+    ev_async_start( main_loop, &t->exit_watcher );
+
+    /* the thread doesn't exist yet: the watchers can be started from here */
+    r = t->ops->start( t );
+    if (r < 0) return r;
+
+    r = pthread_create( &t->thread, NULL, test_thread, t );
+    if (r) {
+        err("%s: can't create the %s thread: %s", t->device, t->name, strerror(r));
+        ev_async_stop( main_loop, &t->exit_watcher );
+        t->thread_opts.threaded = 0;    /* nothing to join in test_close() */
+        return -1;
+    }
+    return 0;
+}
+
+
+void test_stop( struct test *t ) {
+    if (!t->thread_opts.threaded || !t->loop || t->stopping) return;
+    __atomic_store_n( &t->stopping, 1, __ATOMIC_RELEASE );
+    ev_async_send( t->loop, &t->stop_watcher );
+    pthread_join( t->thread, NULL );
+    ev_async_stop( t->main_loop, &t->exit_watcher );
+    ev_async_stop( t->loop, &t->stop_watcher );
+}
+
+
+int test_close( struct test *t ) {
+    struct ev_loop *thread_loop = NULL;
+
+    test_stop( t );
+    if (t->thread_opts.threaded && t->loop) thread_loop = t->loop;
+
+    /* the test is freed by its close operation */
+    int r = t->ops->close( t );
+
+    if (thread_loop) ev_loop_destroy( thread_loop );
+    return r;
+}
@@ -10,9 +10,13 @@
 #ifndef __test_h__
 #define __test_h__
 
-#include "alsa.h"
+#include <pthread.h>
+#include <ev.h>
 
-extern struct ev_loop *loop; /* this is the event loop */
+#include "alsa.h"
+#include "pcm.h"
+#include "hist.h"
+#include "seq.h"
 
 struct test;
 
@@ -21,8 +25,27 @@ struct test_ops {
 
     /* stop and return the test exit status */
     int (*close)(struct test *t);
+
+    /* print the test statistics. optional, can be called from any thread */
+    void (*report)(struct test *t);
 };
 
+
+/*
+ * how a test is executed
+ */
+struct test_thread_opts {
+    /* run the test in its own thread, with its own event loop */
+    int threaded;
+
+    /* CPU the thread is pinned to, -1 for any */
+    int cpu;
+
+    /* thread scheduling priority, same syntax as alsa_config.priority. empty: inherited */
+    char priority[32];
+};
+
+
 /*
  * base class for all tests
  */
@@ -32,7 +55,94 @@ struct test {
     struct alsa_config config;
 
     const struct test_ops *ops;
+
+    /* the event loop the test watchers run in (set by test_start()) */
+    struct ev_loop *loop;
+
+    struct test_thread_opts thread_opts;
+    pthread_t thread;
+    struct ev_loop *main_loop;
+    struct ev_async stop_watcher;   /* in 'loop': stop the test thread */
+    struct ev_async exit_watcher;   /* in 'main_loop': the test thread stopped by itself */
+    int stopping;
+
+    /* sequence errors detected by this test (atomic) */
+    unsigned seq_errors;
+
+    /* xruns (and other errors) the streams of the test were recovered from (atomic) */
+    unsigned xruns;
+
+    /*
+     * lowest number of frames left before an xrun seen at the io job wakeups, among
+     * the streams of the test (atomic). UINT_MAX if never measured
+     */
+    unsigned headroom;
+
+    /* if not NULL, called when new sequence errors are detected, from the test thread */
+    void (*error_notify)( struct test *t, void *data );
+    void *error_notify_data;
+
+    /* restarts and xrun recoveries of the test stream (see recovery.h). NULL if not timed */
+    struct recovery *recovery;
+
+    /*
+     * if not NULL, the recoveries of the test producing the frames checked by this test,
+     * in the same process: they are timed by the checker of this test
+     */
+    struct recovery *peer_recovery;
 };
 
 
+/*
+ * route the errors of a sequence checker of the test to the test counters.
+ * to be called after seq_init()
+ */
+void test_seq_attach( struct test *t, struct seq_info *seq );
+
+/* total number of sequence errors detected among every tests */
+unsigned test_seq_errors_total( void );
+
+/*
+ * to be called by the io job of a stream of the test when it wakes up: record its
+ * lateness in 'wakeup', and the headroom left before an xrun
+ */
+void test_wakeup_record( struct test *t, struct pcm *pcm, struct hist *wakeup );
+
+/* a stream of the test was recovered after an xrun */
+static inline void test_xrun( struct test *t ) {
+    __atomic_add_fetch( &t->xruns, 1, __ATOMIC_RELAXED );
+}
+
+
+/*
+ * start the test.
+ * a non threaded test runs in 'main_loop'.
+ * a threaded test runs its own event loop in a dedicated thread. If this loop stops
+ * by itself (fatal test error), 'main_loop' is stopped too.
+ *
+ * return 0 on success
+ */
+int test_start( struct test *t, struct ev_loop *main_loop );
+
+/*
+ * stop and join the test thread if any: its counters are final from there.
+ * nothing to do for a non threaded test, once 'main_loop' is stopped
+ */
+void test_stop( struct test *t );
+
+/*
+ * stop the test thread if any, and close the test.
+ * return the test exit status
+ */
+int test_close( struct test *t );
+
+
+/*
+ * change the scheduling priority of the calling thread.
+ * 'priority' is 'fifo,N', 'rr,N' or 'other,N'
+ * return 0 on success, -1 if invalid
+ */
+int test_priority_set( const char *priority );
+
+
 #endif //__test_h__
@@ -0,0 +1,201 @@
+/*
+ * Copyright (C) 2015 Arnaud Mouiche <arnaud.mouiche@invoxia.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+
+#include "tune.h"
+#include "log.h"
+
+
+static const unsigned tune_default_periods[] = { 64, 128, 256, 512, 1024 };
+static const unsigned tune_default_counts[] = { 2, 3, 4 };
+
+void tune_opts_init( struct tune_opts *opts ) {
+    memset( opts, 0, sizeof(*opts) );
+    opts->soak = 10;
+    memcpy( opts->periods, tune_default_periods, sizeof(tune_default_periods) );
+    opts->n_periods = sizeof(tune_default_periods) / sizeof(tune_default_periods[0]);
+    memcpy( opts->counts, tune_default_counts, sizeof(tune_default_counts) );
+    opts->n_counts = sizeof(tune_default_counts) / sizeof(tune_default_counts[0]);
+    opts->thresholds[0] = 0;
+    opts->n_thresholds = 1;
+}
+
+
+int tune_list_parse( const char *s, unsigned *values, unsigned *n ) {
+    char *end;
+
+    *n = 0;
+    do {
+        unsigned long v = strtoul( s, &end, 10 );
+        if ((end == s) || (*n == TUNE_MAX_VALUES) || (v > UINT_MAX)) return -1;
+        values[ (*n)++ ] = v;
+        s = end + 1;
+    } while (*end == ',');
+    return (*end == '\0') ? 0 : -1;
+}
+
+
+/*
+ * the CPU load threads: spin until told to stop
+ */
+static int tune_load_stop;
+
+static void *tune_load_thread( void *arg ) {
+    volatile unsigned long spins = 0;
+    while (!__atomic_load_n( &tune_load_stop, __ATOMIC_RELAXED ))
+        spins++;
+    return NULL;
+}
+
+
+/* start threshold actually used by the point */
+static unsigned tune_threshold( const struct tune_point *p ) {
+    return p->start_threshold ? p->start_threshold : (p->buffer_period_count - 1) * p->period;
+}
+
+/*
+ * from the lowest latency (buffer size) to the highest. Then the lowest start threshold
+ * first, and the smallest period: the one with the largest margin for the same buffer
+ */
+static int tune_point_cmp( const void *a, const void *b ) {
+    const struct tune_point *pa = (const struct tune_point *)a, *pb = (const struct tune_point *)b;
+    unsigned la = pa->period * pa->buffer_period_count, lb = pb->period * pb->buffer_period_count;
+
+    if (la != lb) return (la < lb) ? -1 : 1;
+    if (tune_threshold( pa ) != tune_threshold( pb )) return (tune_threshold( pa ) < tune_threshold( pb )) ? -1 : 1;
+    if (pa->period != pb->period) return (pa->period < pb->period) ? -1 : 1;
+    return 0;
+}
+
+/*
+ * every combination of the options, without the duplicates (the default start threshold
+ * is also one of the explicit ones), sorted. return the number of points, -1 on error
+ */
+static int tune_points( struct tune_opts *opts, struct tune_point **points ) {
+    struct tune_point *pts;
+    unsigned i, j, k, n = 0;
+
+    pts = calloc( opts->n_periods * opts->n_counts * opts->n_thresholds, sizeof(*pts) );
+    if (!pts) return -1;
+    for (i = 0; i < opts->n_periods; i++) {
+        for (j = 0; j < opts->n_counts; j++) {
+            for (k = 0; k < opts->n_thresholds; k++) {
+                struct tune_point *p = &pts[n];
+                unsigned m;
+
+                if (!opts->periods[i] || !opts->counts[j] || (opts->thresholds[k] > opts->counts[j])) continue;
+                p->period = opts->periods[i];
+                p->buffer_period_count = opts->counts[j];
+                p->start_threshold = opts->thresholds[k] * opts->periods[i];
+                for (m = 0; m < n; m++) {
+                    if (!tune_point_cmp( p, &pts[m] )) break;
+                }
+                if (m == n) n++;
+            }
+        }
+    }
+    qsort( pts, n, sizeof(*pts), tune_point_cmp );
+    *points = pts;
+    return n;
+}
+
+
+int tune_sweep( struct tune_opts *opts, unsigned rate, tune_run_fn run, void *data ) {
+    struct tune_point *points = NULL;
+    const struct tune_point *best = NULL;
+    pthread_t *load = NULL;
+    unsigned i, loaded = 0;
+    int n, r;
+
+    n = tune_points( opts, &points );
+    if (n <= 0) {
+        printf("tune: no configuration to try\n");
+        free( points );
+        return 1;
+    }
+
+    if (opts->load_threads) {
+        load = calloc( opts->load_threads, sizeof(*load) );
+        if (!load) {
+            err("out of memory");
+            free( points );
+            return 1;
+        }
+        __atomic_store_n( &tune_load_stop, 0, __ATOMIC_RELAXED );
+        for (loaded = 0; loaded < opts->load_threads; loaded++) {
+            r = pthread_create( &load[loaded], NULL, tune_load_thread, NULL );
+            if (r) {
+                err("can't create a load thread: %s", strerror(r));
+                break;
+            }
+        }
+    }
+
+    printf("tune: %d configurations, %u s each, %u load threads\n", n, opts->soak, loaded);
+    printf("tune: %7s %5s %9s %11s %6s %6s %13s\n",
+            "period", "count", "threshold", "buffer(ms)", "xruns", "errors", "headroom(ms)");
+    for (i = 0; i < n; i++) {
+        const struct tune_point *p = &points[i];
+        struct tune_result res;
+        char headroom[16];
+        int ok;
+
+        memset( &res, 0, sizeof(res) );
+        res.rate = rate;
+        res.headroom = UINT_MAX;
+        if (run( p, opts->soak, &res, data ) < 0) {
+            printf("tune: interrupted\n");
+            break;
+        }
+        if (!res.opened) {
+            printf("tune: %7u %5u %9u %11.2f  refused by the device\n", p->period, p->buffer_period_count,
+                    tune_threshold( p ), p->period * p->buffer_period_count * 1e3 / rate);
+            continue;
+        }
+        if (res.headroom == UINT_MAX)
+            strcpy( headroom, "-" );
+        else
+            snprintf( headroom, sizeof(headroom), "%.2f", res.headroom * 1e3 / res.rate );
+        ok = !res.failed && !res.xruns && !res.seq_errors && (res.headroom != UINT_MAX) &&
+                ((unsigned long long)res.headroom * 1000000 >= (unsigned long long)opts->min_headroom_us * res.rate);
+        printf("tune: %7u %5u %9u %11.2f %6u %6u %13s%s%s%s\n", p->period, p->buffer_period_count,
+                tune_threshold( p ), p->period * p->buffer_period_count * 1e3 / rate,
+                res.xruns, res.seq_errors, headroom,
+                (res.period != p->period) ? "  (period changed by the device)" : "",
+                res.failed ? "  test failed" : "", ok ? "  ok" : "");
+        fflush( stdout );
+        if (ok && !best) {
+            best = p;
+            if (!opts->all) break;
+        }
+    }
+
+    if (load) {
+        __atomic_store_n( &tune_load_stop, 1, __ATOMIC_RELAXED );
+        while (loaded) pthread_join( load[--loaded], NULL );
+        free( load );
+    }
+
+    if (best) {
+        printf("tune: smallest xrun free configuration: %.2f ms\n",
+                best->period * best->buffer_period_count * 1e3 / rate);
+        printf("period=%u\n", best->period);
+        printf("buffer_period_count=%u\n", best->buffer_period_count);
+        printf("start_threshold=%u\n", tune_threshold( best ));
+    } else {
+        printf("tune: no xrun free configuration found\n");
+    }
+    free( points );
+    return best ? 0 : 2;
+}
@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2015 Arnaud Mouiche <arnaud.mouiche@invoxia.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ */
+
+#ifndef __tune_h__
+#define __tune_h__
+
+/*
+ * atest [OPTIONS] tune [TUNE OPTIONS] TEST...
+ * run the tests with every combination of period size, buffer period count and playback
+ * start threshold, each one for a while, from the lowest latency to the highest, to find
+ * the smallest configuration without xrun.
+ */
+
+#define TUNE_MAX_VALUES     16
+
+struct tune_opts {
+    unsigned soak;          /* seconds each configuration runs */
+
+    unsigned periods[ TUNE_MAX_VALUES ];
+    unsigned n_periods;
+    unsigned counts[ TUNE_MAX_VALUES ];     /* buffer_period_count */
+    unsigned n_counts;
+    /* playback start thresholds, in periods. 0 for the default (buffer_period_count-1) */
+    unsigned thresholds[ TUNE_MAX_VALUES ];
+    unsigned n_thresholds;
+
+    unsigned min_headroom_us;   /* an xrun free configuration must also keep this margin */
+    unsigned load_threads;      /* busy threads run meanwhile, as an extra CPU load */
+    int all;                    /* don't stop at the first configuration found */
+};
+
+/* the configuration of a run */
+struct tune_point {
+    unsigned period;
+    unsigned buffer_period_count;
+    unsigned start_threshold;   /* frames, 0 for the default */
+};
+
+/* what happened during a run */
+struct tune_result {
+    int opened;             /* 0 if the devices refused the configuration */
+    unsigned period;        /* as negotiated */
+    unsigned rate;
+    unsigned xruns;
+    unsigned seq_errors;
+    unsigned headroom;      /* lowest frames left before an xrun, UINT_MAX if not measured */
+    int failed;             /* a test failed, or stopped before the end of the run */
+};
+
+/*
+ * run the tests with the configuration 'p' for 'seconds' and fill 'res'.
+ * return 0, or -1 to stop the sweep (interrupted)
+ */
+typedef int (*tune_run_fn)( const struct tune_point *p, unsigned seconds, struct tune_result *res, void *data );
+
+/* set the default values of the sweep */
+void tune_opts_init( struct tune_opts *opts );
+
+/*
+ * parse a comma separated list of numbers in 'values'
+ * return 0 on success, -1 if invalid or too long
+ */
+int tune_list_parse( const char *s, unsigned *values, unsigned *n );
+
+/*
+ * sweep the configurations and print the results.
+ * return the process exit status: 0 if an xrun free configuration was found
+ */
+int tune_sweep( struct tune_opts *opts, unsigned rate, tune_run_fn run, void *data );
+
+#endif //__tune_h__
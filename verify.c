@@ -0,0 +1,417 @@
+/*
+ * Copyright (C) 2015 Arnaud Mouiche <arnaud.mouiche@invoxia.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ */
+
+/*
+ * Offline check of a recording.
+ *
+ * The file is split in chunks checked in parallel, each one by a checker starting
+ * in its initial state (no frame received yet). The real state at the start of a
+ * chunk is only known once the previous chunk is checked, so the chunks are then
+ * stitched in order: the real checker is run on the head of the chunk together with
+ * a fresh one, until both reach the same state. From there, both would see the same
+ * frames in the same state, so the rest of the parallel result is exact. This
+ * usually takes a few frames (first valid frame received).
+ *
+ * The logs of the parallel pass are muted. The chunks with errors are checked again
+ * in order with the logs enabled, so the output is what the online checker printed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <alsa/asoundlib.h>
+
+#include "verify.h"
+#include "seq.h"
+#include "seq_simd.h"
+#include "hist.h"
+#include "log.h"
+
+/* minimal chunk size, in periods */
+#define VERIFY_CHUNK_MIN_PERIODS    64
+/* number of chunks per thread, for load balancing */
+#define VERIFY_CHUNKS_PER_THREAD    8
+
+struct verify_event {
+    unsigned long long pos;
+    unsigned long long dropped;     /* 0 for a jump */
+    unsigned resync;                /* the jump was a seq_check_resync() */
+    unsigned long resync_lost;
+    unsigned resync_tolerance;
+};
+
+/* the part of seq_info that drives the checker */
+struct verify_state {
+    enum seq_stat_e state;
+    enum seq_stat_e prev_state;
+    unsigned frame_num;
+    unsigned rotation;
+    unsigned rotation_frames;
+    unsigned resync;
+    unsigned resync_expected;
+    unsigned long resync_lost;
+    unsigned resync_tolerance;
+    struct seq_wide wide;
+};
+
+struct verify_chunk {
+    unsigned long long start, end;  /* frames */
+    unsigned long long errors;
+    struct verify_state entry;      /* real state at the start, known after stitching */
+    struct verify_state exit;
+};
+
+struct verify {
+    snd_pcm_format_t format;
+    unsigned channels;
+    unsigned rate;
+    unsigned period;
+    unsigned frame_bytes;
+
+    const uint8_t *frames;
+    unsigned long long frame_count;
+
+    struct verify_event *events;
+    unsigned event_count;
+
+    struct verify_chunk *chunks;
+    unsigned chunk_count;
+    unsigned next_chunk;            /* shared by the worker threads */
+};
+
+
+static void state_save( const struct seq_info *seq, struct verify_state *s ) {
+    s->state = seq->state;
+    s->prev_state = seq->prev_state;
+    s->frame_num = seq->frame_num;
+    s->rotation = seq->rotation;
+    s->rotation_frames = seq->rotation_frames;
+    s->resync = seq->resync;
+    s->resync_expected = seq->resync_expected;
+    s->resync_lost = seq->resync_lost;
+    s->resync_tolerance = seq->resync_tolerance;
+    s->wide = seq->wide;
+}
+
+static void state_load( struct seq_info *seq, const struct verify_state *s ) {
+    seq->state = s->state;
+    seq->prev_state = s->prev_state;
+    seq->frame_num = s->frame_num;
+    seq->rotation = s->rotation;
+    seq->rotation_frames = s->rotation_frames;
+    seq->resync = s->resync;
+    seq->resync_expected = s->resync_expected;
+    seq->resync_lost = s->resync_lost;
+    seq->resync_tolerance = s->resync_tolerance;
+    seq->wide = s->wide;
+}
+
+static int wide_equal( const struct seq_wide *a, const struct seq_wide *b ) {
+    return (a->synced == b->synced) && (a->next == b->next) && (a->collecting == b->collecting) &&
+        (a->locked == b->locked) && (a->high == b->high) && (a->word == b->word) && (a->extra == b->extra);
+}
+
+static int state_equal( const struct seq_info *a, const struct seq_info *b ) {
+    return (a->state == b->state) && (a->prev_state == b->prev_state) && (a->frame_num == b->frame_num) &&
+        (a->rotation == b->rotation) && (a->rotation_frames == b->rotation_frames) &&
+        (a->resync == b->resync) && (!a->resync || ((a->resync_expected == b->resync_expected) &&
+            (a->resync_lost == b->resync_lost) && (a->resync_tolerance == b->resync_tolerance))) &&
+        wide_equal( &a->wide, &b->wide );
+}
+
+
+/* first event at or after 'pos' */
+static unsigned event_find( struct verify *v, unsigned long long pos ) {
+    unsigned lo = 0, hi = v->event_count;
+    while (lo < hi) {
+        unsigned mid = (lo + hi) / 2;
+        if (v->events[mid].pos < pos) lo = mid + 1; else hi = mid;
+    }
+    return lo;
+}
+
+/*
+ * check the frames [pos, pos + count) after applying the events at 'pos'.
+ * stop before the next event, or at the next period boundary.
+ * return the number of frames checked, and add the errors to '*errors'
+ */
+static unsigned long long verify_step( struct verify *v, struct seq_info *seq, unsigned long long pos,
+        unsigned long long count, unsigned *event, unsigned long long *errors ) {
+    unsigned long long n = v->period - (pos % v->period);
+
+    while ((*event < v->event_count) && (v->events[ *event ].pos == pos)) {
+        const struct verify_event *e = &v->events[ *event ];
+        /* xrun/restart, or frames missing from the recording: the checker was resynchronized */
+        if (e->resync)
+            seq_check_resync( seq, e->resync_lost, e->resync_tolerance );
+        else
+            seq_check_jump_notify( seq );
+        (*event)++;
+    }
+    if ((*event < v->event_count) && (v->events[ *event ].pos - pos < n))
+        n = v->events[ *event ].pos - pos;
+    if (n > count) n = count;
+
+    *errors += seq_check_frames( seq, v->frames + pos * v->frame_bytes, n );
+    return n;
+}
+
+static void verify_range( struct verify *v, struct seq_info *seq, unsigned long long start, unsigned long long end,
+        unsigned long long *errors ) {
+    unsigned event = event_find( v, start );
+    while (start < end)
+        start += verify_step( v, seq, start, end - start, &event, errors );
+}
+
+
+static int verify_seq_init( struct verify *v, struct seq_info *seq ) {
+    if (seq_init( seq, v->channels, v->format )) return -1;
+    seq_free( seq );    /* no generation */
+    return 0;
+}
+
+/* parallel pass: check the chunks from the initial state */
+static void *verify_thread( void *arg ) {
+    struct verify *v = (struct verify *)arg;
+    struct seq_info seq;
+
+    if (verify_seq_init( v, &seq )) return NULL;
+    while (1) {
+        unsigned c = __atomic_fetch_add( &v->next_chunk, 1, __ATOMIC_RELAXED );
+        struct verify_chunk *chunk;
+        if (c >= v->chunk_count) break;
+        chunk = &v->chunks[c];
+        seq_reset( &seq );
+        verify_range( v, &seq, chunk->start, chunk->end, &chunk->errors );
+        state_save( &seq, &chunk->exit );
+    }
+    return NULL;
+}
+
+/*
+ * fix the result of 'chunk' now that its real entry state is known.
+ */
+static void verify_stitch( struct verify *v, struct verify_chunk *chunk ) {
+    struct seq_info real, fresh;
+    unsigned long long pos = chunk->start;
+    unsigned long long real_errors = 0, fresh_errors = 0;
+    unsigned real_event, fresh_event;
+
+    verify_seq_init( v, &real );
+    verify_seq_init( v, &fresh );
+    state_load( &real, &chunk->entry );
+    real_event = fresh_event = event_find( v, pos );
+
+    while (!state_equal( &real, &fresh )) {
+        unsigned long long n;
+        if (pos == chunk->end) {
+            /* never converged: the real checker did the whole chunk */
+            chunk->errors = real_errors;
+            state_save( &real, &chunk->exit );
+            return;
+        }
+        n = verify_step( v, &real, pos, chunk->end - pos, &real_event, &real_errors );
+        verify_step( v, &fresh, pos, chunk->end - pos, &fresh_event, &fresh_errors );
+        pos += n;
+    }
+    chunk->errors = chunk->errors - fresh_errors + real_errors;
+}
+
+
+static int verify_meta_read( struct verify *v, const char *path ) {
+    char meta_path[ 1024 ];
+    char line[ 256 ];
+    FILE *f;
+
+    snprintf( meta_path, sizeof(meta_path), "%s.meta", path );
+    f = fopen( meta_path, "r" );
+    if (!f) {
+        printf("can't open '%s': %s\n", meta_path, strerror(errno));
+        return -1;
+    }
+    v->format = SND_PCM_FORMAT_UNKNOWN;
+    while (fgets( line, sizeof(line), f )) {
+        char name[ 64 ];
+        unsigned long long a, b;
+        unsigned long lost;
+        unsigned tolerance;
+        int resync = 0;
+        if (sscanf( line, "format %63s", name ) == 1) {
+            v->format = snd_pcm_format_value( name );
+        } else if (sscanf( line, "channels %u", &v->channels ) == 1) {
+        } else if (sscanf( line, "rate %u", &v->rate ) == 1) {
+        } else if (sscanf( line, "period %u", &v->period ) == 1) {
+        } else if (sscanf( line, "encoding %63s", name ) == 1) {
+            if (seq_encoding_parse( name, &seq_encoding )) {
+                printf("'%s': unknown encoding '%s'\n", meta_path, name);
+                fclose( f );
+                return -1;
+            }
+        } else if ((sscanf( line, "jump %llu", &a ) == 1) || (sscanf( line, "dropped %llu %llu", &a, &b ) == 2) ||
+                (resync = (sscanf( line, "resync %llu %lu %u", &a, &lost, &tolerance ) == 3))) {
+            struct verify_event *events = realloc( v->events, (v->event_count + 1) * sizeof(*events) );
+            if (!events) {
+                printf("out of memory\n");
+                fclose( f );
+                return -1;
+            }
+            v->events = events;
+            v->events[ v->event_count ].pos = a;
+            v->events[ v->event_count ].dropped = (line[0] == 'd') ? b : 0;
+            v->events[ v->event_count ].resync = resync;
+            v->events[ v->event_count ].resync_lost = resync ? lost : 0;
+            v->events[ v->event_count ].resync_tolerance = resync ? tolerance : 0;
+            v->event_count++;
+        }
+    }
+    fclose( f );
+
+    if (!seq_format_supported( v->format ) || !v->channels || !v->period) {
+        printf("'%s': invalid or unsupported stream description\n", meta_path);
+        return -1;
+    }
+    v->frame_bytes = v->channels * snd_pcm_format_physical_width( v->format ) / 8;
+    return 0;
+}
+
+
+static void usage( void ) {
+    puts(
+        "usage: atest [OPTIONS] verify [-j THREADS] FILE\n"
+        "check a recording made by 'capture -w FILE'\n"
+        "-j N       number of threads (default: every core)\n"
+        "global -I applies, as for the online checker\n"
+        );
+    exit(1);
+}
+
+int verify_main( int argc, char * const argv[] ) {
+    struct verify v;
+    int threads = sysconf( _SC_NPROCESSORS_ONLN );
+    unsigned long long chunk_frames, errors = 0, dropped = 0, jumps = 0;
+    pthread_t *thread_ids = NULL;
+    int fd = -1, result, i, exit_status = 2, log_warn, log_err;
+    unsigned c;
+    struct stat st;
+    void *map = MAP_FAILED;
+    uint64_t t0;
+
+    memset( &v, 0, sizeof(v) );
+    optind = 1;
+    while ((result = getopt( argc, argv, "+j:" )) != EOF) {
+        switch (result) {
+        case 'j':
+            threads = atoi(optarg);
+            break;
+        default:
+            usage();
+        }
+    }
+    if ((optind != argc - 1) || (threads <= 0)) usage();
+
+    if (verify_meta_read( &v, argv[optind] )) goto failed;
+
+    fd = open( argv[optind], O_RDONLY );
+    if ((fd < 0) || fstat( fd, &st )) {
+        printf("can't open '%s': %s\n", argv[optind], strerror(errno));
+        goto failed;
+    }
+    v.frame_count = st.st_size / v.frame_bytes;
+    if (st.st_size % v.frame_bytes)
+        warn("%s: ignoring the last %lu bytes (incomplete frame)", argv[optind], (unsigned long)(st.st_size % v.frame_bytes));
+    if (v.frame_count) {
+        map = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+        if (map == MAP_FAILED) {
+            printf("can't map '%s': %s\n", argv[optind], strerror(errno));
+            goto failed;
+        }
+        madvise( map, st.st_size, MADV_SEQUENTIAL );
+        v.frames = (const uint8_t *)map;
+    }
+
+    /* chunks of whole periods, a few per thread */
+    chunk_frames = v.frame_count / ((unsigned long long)threads * VERIFY_CHUNKS_PER_THREAD);
+    chunk_frames = (chunk_frames + v.period - 1) / v.period * v.period;
+    if (chunk_frames < (unsigned long long)VERIFY_CHUNK_MIN_PERIODS * v.period)
+        chunk_frames = (unsigned long long)VERIFY_CHUNK_MIN_PERIODS * v.period;
+    v.chunk_count = (v.frame_count + chunk_frames - 1) / chunk_frames;
+    v.chunks = calloc( v.chunk_count + 1, sizeof(*v.chunks) );
+    thread_ids = calloc( threads, sizeof(*thread_ids) );
+    if (!v.chunks || !thread_ids) {
+        printf("out of memory\n");
+        goto failed;
+    }
+    for (c = 0; c < v.chunk_count; c++) {
+        v.chunks[c].start = c * chunk_frames;
+        v.chunks[c].end = (c == v.chunk_count - 1) ? v.frame_count : (c + 1) * chunk_frames;
+    }
+
+    /* parallel pass, without logs */
+    t0 = hist_now_ns();
+    seq_simd_init();
+    log_warn = log_level_enabled( LOG_WARN );
+    log_err = log_level_enabled( LOG_ERR );
+    log_level_enable( LOG_WARN, 0 );
+    log_level_enable( LOG_ERR, 0 );
+    if (threads > v.chunk_count) threads = v.chunk_count ? v.chunk_count : 1;
+    for (i = 0; i < threads; i++) {
+        if (pthread_create( &thread_ids[i], NULL, verify_thread, &v )) {
+            printf("can't create the verify threads\n");
+            exit(2);
+        }
+    }
+    for (i = 0; i < threads; i++)
+        pthread_join( thread_ids[i], NULL );
+
+    /* stitch the chunks in order (the first one started from the real initial state) */
+    for (c = 1; c < v.chunk_count; c++) {
+        v.chunks[c].entry = v.chunks[c-1].exit;
+        verify_stitch( &v, &v.chunks[c] );
+    }
+    log_level_enable( LOG_WARN, log_warn );
+    log_level_enable( LOG_ERR, log_err );
+
+    /* print the logs of the chunks with errors, as the online checker did */
+    for (c = 0; c < v.chunk_count; c++) {
+        struct seq_info seq;
+        unsigned long long e = 0;
+        if (!v.chunks[c].errors) continue;
+        printf("frames %llu-%llu: %llu errors\n", v.chunks[c].start, v.chunks[c].end - 1, v.chunks[c].errors);
+        verify_seq_init( &v, &seq );
+        state_load( &seq, &v.chunks[c].entry );
+        verify_range( &v, &seq, v.chunks[c].start, v.chunks[c].end, &e );
+        errors += v.chunks[c].errors;
+    }
+
+    for (c = 0; c < v.event_count; c++) {
+        if (v.events[c].dropped) dropped += v.events[c].dropped; else jumps++;
+    }
+    printf("%s: %llu frames (%s, %u channels, %u Hz), %d threads, %.1f MB/s\n",
+            argv[optind], v.frame_count, snd_pcm_format_name( v.format ), v.channels, v.rate, threads,
+            (double)v.frame_count * v.frame_bytes / 1e6 / ((hist_now_ns() - t0) * 1e-9 + 1e-9));
+    printf("seq errors: %llu, stream interruptions: %llu\n", errors, jumps);
+    if (dropped)
+        printf("warning: %llu frames were not recorded, the result may differ from the online check\n", dropped);
+    exit_status = errors ? 1 : 0;
+
+failed:
+    if (map != MAP_FAILED) munmap( map, st.st_size );
+    if (fd >= 0) close( fd );
+    free( thread_ids );
+    free( v.chunks );
+    free( v.events );
+    return exit_status;
+}
@@ -0,0 +1,20 @@
+/*
+ * Copyright (C) 2015 Arnaud Mouiche <arnaud.mouiche@invoxia.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ */
+
+#ifndef __verify_h__
+#define __verify_h__
+
+/*
+ * atest verify [-j THREADS] FILE
+ * check a recording made by 'capture -w FILE' (see record.h), using every core.
+ * return the process exit status: 0 if no sequence error was found.
+ */
+int verify_main( int argc, char * const argv[] );
+
+#endif //__verify_h__